@@ -0,0 +1,58 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+namespace HPHP {
+namespace IJK {
+
+Arena::Arena(size_t chunkSize)
+  : m_chunkSize(chunkSize), m_capacity(0), m_cur(nullptr), m_end(nullptr) {
+}
+
+Arena::~Arena() {
+  reset();
+  for (auto& chunk : m_chunks) free(chunk.first);
+}
+
+void Arena::grow(size_t size) {
+  // Oversized requests get a chunk of their own.
+  auto const chunkSize = std::max(m_chunkSize, size);
+  auto const chunk = static_cast<char*>(malloc(chunkSize));
+  if (!chunk) throw std::bad_alloc();
+  m_chunks.emplace_back(chunk, chunkSize);
+  m_capacity += chunkSize;
+  m_cur = chunk;
+  m_end = chunk + chunkSize;
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+  auto aligned = [&] {
+    auto const p = reinterpret_cast<uintptr_t>(m_cur);
+    return reinterpret_cast<char*>((p + align - 1) & ~(uintptr_t)(align - 1));
+  };
+  if (!m_cur || aligned() + size > m_end) grow(size + align);
+  auto const ret = aligned();
+  m_cur = ret + size;
+  return ret;
+}
+
+void Arena::reset() {
+  for (auto it = m_finalizers.rbegin(); it != m_finalizers.rend(); ++it) {
+    it->destroy(it->object);
+  }
+  m_finalizers.clear();
+  if (m_chunks.empty()) return;
+
+  for (auto i = size_t{1}; i < m_chunks.size(); ++i) {
+    free(m_chunks[i].first);
+    m_capacity -= m_chunks[i].second;
+  }
+  m_chunks.resize(1);
+  m_cur = m_chunks[0].first;
+  m_end = m_cur + m_chunks[0].second;
+}
+
+}
+}
@@ -0,0 +1,92 @@
+#ifndef IJK_ARENA_H
+#define IJK_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace HPHP {
+namespace IJK {
+
+// Bump allocator for translator metadata that lives no longer than the
+// function being translated.  reset() destroys everything made since
+// the last reset and returns all but the first chunk to the system, so
+// a large function doesn't leave its footprint behind.
+class Arena {
+  public:
+    explicit Arena(size_t chunkSize = kDefaultChunkSize);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align);
+    void reset();
+
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+      T* ret = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      if (!std::is_trivially_destructible<T>::value) {
+        m_finalizers.push_back(
+                Finalizer{ [] (void* p) { static_cast<T*>(p)->~T(); }, ret });
+      }
+      return ret;
+    }
+
+    // Bytes currently held from the system, for reporting.
+    size_t capacity() const { return m_capacity; }
+
+    static const size_t kDefaultChunkSize = 64 * 1024;
+
+  private:
+    struct Finalizer {
+      void (*destroy)(void*);
+      void* object;
+    };
+
+    void grow(size_t size);
+
+    size_t m_chunkSize;
+    size_t m_capacity;
+    std::vector<std::pair<char*, size_t>> m_chunks;
+    char* m_cur;
+    char* m_end;
+    std::vector<Finalizer> m_finalizers;
+};
+
+// Lets standard containers allocate from an Arena.  Deallocation is a
+// no-op; the memory goes back with Arena::reset().
+template<class T>
+struct ArenaAllocator {
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena& arena) : m_arena(&arena) {}
+  template<class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.m_arena) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  template<class U>
+  struct rebind { typedef ArenaAllocator<U> other; };
+
+  Arena* m_arena;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.m_arena == b.m_arena;
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.m_arena != b.m_arena;
+}
+
+}
+}
+
+#endif
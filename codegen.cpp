@@ -0,0 +1,315 @@
+#include "codegen.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Partition each defined function goes to, keyed by name.
+typedef std::map<std::string, unsigned> Partitioning;
+
+// Symbols local to the module may be referenced from other partitions,
+// so they become hidden externals that resolve between the partitions.
+// ld -r keeps them global, so whoever combines the pieces must run
+// localize_hidden() on the result or they clash with other objects.
+static void externalize_locals(llvm::Module* module) {
+  auto externalize = [] (llvm::GlobalValue& gv) {
+    if (!gv.hasLocalLinkage()) return;
+    if (!gv.hasName()) gv.setName("ijk.anon");
+    gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    gv.setVisibility(llvm::GlobalValue::HiddenVisibility);
+  };
+  for (auto& function : *module) externalize(function);
+  for (auto& global : module->globals()) externalize(global);
+}
+
+// Spreads functions over partitions by instruction count, largest
+// first, each to whichever partition is currently lightest.
+static Partitioning partition_functions(llvm::Module* module, unsigned partitions) {
+  std::vector<std::pair<size_t, std::string>> sizes;
+  for (auto& function : *module) {
+    if (function.isDeclaration()) continue;
+    size_t size = 0;
+    for (auto& block : function) size += block.size();
+    sizes.emplace_back(size, function.getName().str());
+  }
+  std::sort(sizes.rbegin(), sizes.rend());
+  
+  Partitioning ret;
+  std::vector<size_t> loads(partitions, 0);
+  for (auto& kv : sizes) {
+    auto const lightest = std::min_element(loads.begin(), loads.end()) - loads.begin();
+    loads[lightest] += kv.first;
+    ret[kv.second] = lightest;
+  }
+  return ret;
+}
+
+// Reduces a full copy of the module to partition index: other
+// partitions' functions become declarations, and global variables are
+// defined only in partition 0.
+static void extract_partition(llvm::Module* module, const Partitioning& partitioning, 
+                              unsigned index) {
+  for (auto& function : *module) {
+    if (function.isDeclaration()) continue;
+    auto it = partitioning.find(function.getName().str());
+    if (it != partitioning.end() && it->second != index) {
+      function.deleteBody();
+    }
+  }
+  if (index == 0) return;
+  
+  std::vector<llvm::GlobalVariable*> appending;
+  for (auto& global : module->globals()) {
+    if (global.hasAppendingLinkage()) {
+      appending.push_back(&global);
+    } else if (global.hasInitializer()) {
+      global.setInitializer(nullptr);
+      global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+  // llvm.global_ctors and friends.
+  for (auto global : appending) global->eraseFromParent();
+}
+
+// Runs on a worker thread, with a context of its own since an
+// LLVMContext can't be shared between threads.
+static bool compile_partition(const std::string& bitcode, const Partitioning& partitioning,
+                              unsigned index, const std::string& objectPath, 
+                              AddPassesFn addPasses) {
+  llvm::LLVMContext ctx;
+  std::unique_ptr<llvm::MemoryBuffer> buffer(
+          llvm::MemoryBuffer::getMemBuffer(bitcode, "", false));
+  llvm::ErrorOr<llvm::Module*> parsed = llvm::parseBitcodeFile(buffer.get(), ctx);
+  if (!parsed) return false;
+  std::unique_ptr<llvm::Module> module(parsed.get());
+  extract_partition(module.get(), partitioning, index);
+  
+  std::string triple = module->getTargetTriple();
+  if (triple.empty()) {
+    triple = llvm::sys::getDefaultTargetTriple();
+    module->setTargetTriple(triple);
+  }
+  std::string error;
+  const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    fprintf(stderr, "ijk: %s\n", error.c_str());
+    return false;
+  }
+  std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(
+          triple, "", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+  module->setDataLayout(machine->getDataLayout());
+  
+  llvm::raw_fd_ostream rawStream(objectPath.c_str(), error, llvm::sys::fs::F_None);
+  if (!error.empty()) {
+    fprintf(stderr, "ijk: %s\n", error.c_str());
+    return false;
+  }
+  llvm::formatted_raw_ostream stream(rawStream);
+  llvm::PassManager passManager;
+  passManager.add(new llvm::DataLayoutPass(module.get()));
+  addPasses(passManager);
+  if (machine->addPassesToEmitFile(passManager, stream, 
+                                   llvm::TargetMachine::CGFT_ObjectFile)) {
+    return false;
+  }
+  passManager.run(*module);
+  return true;
+}
+
+// Hidden symbols only link the pieces of one object together; making
+// them local keeps them from clashing with those of other objects.
+static bool localize_hidden(const std::string& objectPath) {
+  std::string objcopy = llvm::sys::FindProgramByName("objcopy");
+  if (objcopy.empty()) {
+    fprintf(stderr, "ijk: can't find objcopy to localize hidden symbols\n");
+    return false;
+  }
+  const char* args[] = { objcopy.c_str(), "--localize-hidden", objectPath.c_str(), nullptr };
+  std::string error;
+  if (llvm::sys::ExecuteAndWait(objcopy, args, nullptr, nullptr, 0, 0, &error) != 0) {
+    fprintf(stderr, "ijk: objcopy failed: %s\n", error.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Combines the partitions' objects with a relocatable link.
+static bool link_objects(const std::vector<std::string>& objects, 
+                         const std::string& objectPath) {
+  std::string ld = llvm::sys::FindProgramByName("ld");
+  if (ld.empty()) {
+    fprintf(stderr, "ijk: can't find ld to combine partitions\n");
+    return false;
+  }
+  std::vector<const char*> args = { ld.c_str(), "-r", "-o", objectPath.c_str() };
+  for (auto& object : objects) args.push_back(object.c_str());
+  args.push_back(nullptr);
+  std::string error;
+  if (llvm::sys::ExecuteAndWait(ld, args.data(), nullptr, nullptr, 0, 0, &error) != 0) {
+    fprintf(stderr, "ijk: ld failed: %s\n", error.c_str());
+    return false;
+  }
+  return localize_hidden(objectPath);
+}
+
+bool compile_module(llvm::Module* module, const std::string& objectPath, 
+                    unsigned jobs, AddPassesFn addPasses) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  
+  if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+  size_t numDefined = 0;
+  for (auto& function : *module) {
+    if (!function.isDeclaration()) ++numDefined;
+  }
+  auto const partitions = std::max<unsigned>(1, std::min<size_t>(jobs, numDefined));
+  
+  if (partitions > 1) externalize_locals(module);
+  auto const partitioning = partition_functions(module, partitions);
+  std::string bitcode;
+  {
+    llvm::raw_string_ostream stream(bitcode);
+    llvm::WriteBitcodeToFile(module, stream);
+  }
+  
+  if (partitions == 1) {
+    return compile_partition(bitcode, partitioning, 0, objectPath, addPasses);
+  }
+  
+  std::vector<std::string> objects;
+  for (auto i = unsigned{0}; i < partitions; ++i) {
+    objects.push_back(objectPath + ".part" + std::to_string(i) + ".o");
+  }
+  std::vector<char> results(partitions, false);
+  std::vector<std::thread> threads;
+  for (auto i = unsigned{0}; i < partitions; ++i) {
+    threads.emplace_back([&, i] {
+      results[i] = compile_partition(bitcode, partitioning, i, objects[i], addPasses);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  
+  auto ok = std::all_of(results.begin(), results.end(), [] (char r) { return r; })
+    && link_objects(objects, objectPath);
+  for (auto& object : objects) llvm::sys::fs::remove(object);
+  return ok;
+}
+
+StreamingCompiler::StreamingCompiler(llvm::Module* module, const std::string& objectPath, 
+                                     AddPassesFn addPasses)
+  : m_module(module), m_objectPath(objectPath), m_addPasses(addPasses), m_failed(false) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  
+  std::string triple = module->getTargetTriple();
+  if (triple.empty()) {
+    triple = llvm::sys::getDefaultTargetTriple();
+    module->setTargetTriple(triple);
+  }
+  std::string error;
+  const llvm::Target* target = llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target) {
+    fprintf(stderr, "ijk: %s\n", error.c_str());
+    m_failed = true;
+    return;
+  }
+  m_machine.reset(target->createTargetMachine(
+          triple, "", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+  module->setDataLayout(m_machine->getDataLayout());
+}
+
+StreamingCompiler::~StreamingCompiler() {
+  for (auto& object : m_objects) llvm::sys::fs::remove(object);
+}
+
+size_t StreamingCompiler::pendingInstructions() const {
+  size_t ret = 0;
+  for (auto& function : *m_module) {
+    for (auto& block : function) ret += block.size();
+  }
+  return ret;
+}
+
+bool StreamingCompiler::flush() {
+  if (m_failed) return false;
+  auto const pending = std::any_of(m_module->begin(), m_module->end(), 
+          [] (const llvm::Function& f) { return !f.isDeclaration(); }) ||
+    std::any_of(m_module->global_begin(), m_module->global_end(), 
+          [] (const llvm::GlobalVariable& g) { return g.hasInitializer(); });
+  if (!pending) return true;
+  
+  // What this flush defines is referred to by code of later flushes.
+  externalize_locals(m_module);
+  
+  auto const objectPath = m_objectPath + ".part" + std::to_string(m_objects.size()) + ".o";
+  std::string error;
+  {
+    llvm::raw_fd_ostream rawStream(objectPath.c_str(), error, llvm::sys::fs::F_None);
+    if (!error.empty()) {
+      fprintf(stderr, "ijk: %s\n", error.c_str());
+      m_failed = true;
+      return false;
+    }
+    m_objects.push_back(objectPath);
+    llvm::formatted_raw_ostream stream(rawStream);
+    llvm::PassManager passManager;
+    passManager.add(new llvm::DataLayoutPass(m_module));
+    m_addPasses(passManager);
+    if (m_machine->addPassesToEmitFile(passManager, stream, 
+                                       llvm::TargetMachine::CGFT_ObjectFile)) {
+      m_failed = true;
+      return false;
+    }
+    passManager.run(*m_module);
+  }
+  
+  for (auto& function : *m_module) {
+    if (!function.isDeclaration()) function.deleteBody();
+  }
+  std::vector<llvm::GlobalVariable*> appending;
+  for (auto& global : m_module->globals()) {
+    if (global.hasAppendingLinkage()) {
+      appending.push_back(&global);
+    } else if (global.hasInitializer()) {
+      global.setInitializer(nullptr);
+      global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+  for (auto global : appending) global->eraseFromParent();
+  return true;
+}
+
+bool StreamingCompiler::finish() {
+  if (!flush()) return false;
+  return link_objects(m_objects, m_objectPath);
+}
+
+size_t peak_memory_kb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  // Linux reports ru_maxrss in KiB.
+  return usage.ru_maxrss;
+}
+
+}
+}
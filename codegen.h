@@ -0,0 +1,58 @@
+#ifndef IJK_CODEGEN_H
+#define IJK_CODEGEN_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Target/TargetMachine.h"
+
+namespace HPHP {
+namespace IJK {
+
+typedef void (*AddPassesFn)(llvm::PassManager& passManager);
+
+// Splits module into up to jobs partitions of whole functions, then
+// optimises each with addPasses and compiles it to an object on its own
+// thread.  The objects are combined into a single relocatable object at
+// objectPath.  jobs == 0 uses one partition per core.
+bool compile_module(llvm::Module* module, const std::string& objectPath, 
+                    unsigned jobs, AddPassesFn addPasses);
+
+// Compiles a module piecewise while it is being built, so that only the
+// code translated since the last flush is held in memory.  Each flush()
+// optimises the function bodies and global definitions added since the
+// previous one, emits them to an object of their own and strips them
+// back to declarations, which later code can still refer to.  finish()
+// combines the objects into one at objectPath.
+class StreamingCompiler {
+  public:
+    StreamingCompiler(llvm::Module* module, const std::string& objectPath, 
+                      AddPassesFn addPasses);
+    ~StreamingCompiler();
+    
+    // Instructions in function bodies not flushed yet.
+    size_t pendingInstructions() const;
+    bool flush();
+    bool finish();
+    
+    size_t numObjects() const { return m_objects.size(); }
+    
+  private:
+    llvm::Module* m_module;
+    std::string m_objectPath;
+    AddPassesFn m_addPasses;
+    std::unique_ptr<llvm::TargetMachine> m_machine;
+    std::vector<std::string> m_objects;
+    bool m_failed;
+};
+
+// High water mark of this process's resident set, in KiB.
+size_t peak_memory_kb();
+
+}
+}
+
+#endif
@@ -1,6 +1,9 @@
 include("LLVM.cmake")
 
-HHVM_EXTENSION(ijk ijk.cpp translator.cpp)
+HHVM_EXTENSION(ijk ijk.cpp translator.cpp profile.cpp refcount.cpp purity.cpp arena.cpp vm-bridge.cpp jit.cpp codegen.cpp ijk-runtime.c)
 HHVM_SYSTEMLIB(ijk ext_ijk.php)
 
 target_link_libraries(ijk ${LLVM_LIBS})
+
+# Runtime support for modules produced by the translator.
+add_library(ijk-runtime STATIC ijk-runtime.c)
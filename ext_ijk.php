@@ -2,6 +2,27 @@
 <<__Native>>
 function ijk_translate_file(string $moduleName, string $filePath): bool;
 
+<<__Native>>
+function ijk_translate_file_instrumented(string $moduleName, string $filePath, string $profilePath): bool;
+
+<<__Native>>
+function ijk_translate_file_with_profile(string $moduleName, string $filePath, string $profilePath): bool;
+
+<<__Native>>
+function ijk_translate_program(string $moduleName, string $entryFilePath, array $filePaths): bool;
+
+<<__Native>>
+function ijk_compile_file(string $moduleName, string $filePath, string $objectPath, int $jobs = 0): bool;
+
+<<__Native>>
+function ijk_compile_files(array $filePaths, string $objectDir): mixed;
+
+<<__Native>>
+function ijk_run_file(string $filePath): int;
+
+<<__Native>>
+function ijk_call_native(string $library, string $function, array $args = array()): mixed;
+
 <<__Native>>
 function ijk_class_exists(string $className): bool;
 
@@ -0,0 +1,227 @@
+/*
+ * Behaviour checks of the runtime's string concatenation, which
+ * reuses the buffer of a string it owns.  Built and run on its own:
+ *
+ *   cc -o ijk-runtime-test ijk-runtime-test.c ijk-runtime.c && ./ijk-runtime-test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ijk-runtime.h"
+
+static int s_failures;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++s_failures; \
+    } \
+  } while (0)
+
+static void set_null(typed_value_t* tv) {
+  static string_data empty = { 1, "", IJK_STATIC_REFCOUNT, 0 };
+  memset(tv, 0, sizeof(typed_value_t));
+  tv->type = IJK_KIND_NULL;
+  tv->pstr = &empty;
+}
+
+/* A counted string with a buffer of its own, len bytes of data. */
+static void set_string(typed_value_t* tv, const char* data, int32_t len, int32_t count) {
+  string_data* str = malloc(sizeof(string_data));
+  str->data = malloc(len + 1);
+  memcpy(str->data, data, len);
+  str->data[len] = '\0';
+  str->size = len + 1;
+  str->capacity = len + 1;
+  str->count = count;
+  set_null(tv);
+  tv->type = IJK_KIND_STRING;
+  tv->pstr = str;
+}
+
+static void set_int(typed_value_t* tv, int64_t num) {
+  set_null(tv);
+  tv->type = IJK_KIND_INT64;
+  tv->num = num;
+}
+
+static int has_bytes(const typed_value_t* tv, const char* data, int32_t len) {
+  return tv->type == IJK_KIND_STRING && tv->pstr->size == len + 1 &&
+         memcmp(tv->pstr->data, data, len) == 0 && tv->pstr->data[len] == '\0';
+}
+
+static void to_string(typed_value_t* retval, object_data* this,
+                      int64_t num_args, typed_value_t** args) {
+  /* Translated methods hand back a reference. */
+  set_string(retval, "obj", 3, 1);
+}
+
+static const method_entry s_methods[] = {
+  { "__tostring", (void*)to_string },
+};
+
+static const typed_value_t s_no_props[1];
+
+static const class_t s_class = {
+  "Stringable", NULL, NULL, s_methods, 1, sizeof(object_data), s_no_props, NULL, 0,
+};
+
+static void test_concat_n_fresh(void) {
+  typed_value_t a, b, dst;
+  typed_value_t* parts[2] = { &a, &b };
+  set_string(&a, "foo", 3, 2);
+  set_int(&b, 42);
+  ijk_concat_n(&dst, parts, 2);
+  CHECK(has_bytes(&dst, "foo42", 5));
+  CHECK(dst.pstr != a.pstr);
+  CHECK(has_bytes(&a, "foo", 3));
+  dst.pstr->count = 1;
+  ijk_decref(&dst);
+  a.pstr->count = 1;
+  ijk_decref(&a);
+}
+
+static void test_concat_n_reuses_owned(void) {
+  typed_value_t a, b, dst;
+  typed_value_t* parts[2] = { &a, &b };
+  string_data* str;
+  set_string(&a, "foo", 3, 1);
+  set_string(&b, "bar", 3, 1);
+  str = a.pstr;
+  ijk_concat_n(&dst, parts, 2);
+  CHECK(has_bytes(&dst, "foobar", 6));
+  CHECK(dst.pstr == str);
+  CHECK(a.type == IJK_KIND_NULL);
+  dst.pstr->count = 1;
+  ijk_decref(&dst);
+  ijk_decref(&b);
+}
+
+static void test_concat_n_shared_operand(void) {
+  /* $a . $a with both operands the same value. */
+  typed_value_t a, dst;
+  typed_value_t* parts[3] = { &a, &a, &a };
+  set_string(&a, "ab", 2, 1);
+  ijk_concat_n(&dst, parts, 3);
+  CHECK(has_bytes(&dst, "ababab", 6));
+  dst.pstr->count = 1;
+  ijk_decref(&dst);
+  ijk_decref(&a);
+}
+
+static void test_concat_n_object(void) {
+  typed_value_t a, b, dst;
+  typed_value_t* parts[2] = { &a, &b };
+  object_data* obj = ijk_object_alloc(&s_class);
+  set_string(&a, "x=", 2, 1);
+  set_null(&b);
+  b.type = IJK_KIND_OBJECT;
+  b.pobj = obj;
+  obj->count = 1;
+  ijk_concat_n(&dst, parts, 2);
+  CHECK(has_bytes(&dst, "x=obj", 5));
+  CHECK(b.type == IJK_KIND_OBJECT && obj->count == 1);
+  dst.pstr->count = 1;
+  ijk_decref(&dst);
+  ijk_decref(&a);
+  ijk_decref(&b);
+}
+
+static void test_concat_n_nul(void) {
+  typed_value_t a, b, dst;
+  typed_value_t* parts[2] = { &a, &b };
+  set_string(&a, "a\0b", 3, 2);
+  set_string(&b, "\0c", 2, 1);
+  ijk_concat_n(&dst, parts, 2);
+  CHECK(has_bytes(&dst, "a\0b\0c", 5));
+  dst.pstr->count = 1;
+  ijk_decref(&dst);
+  a.pstr->count = 1;
+  ijk_decref(&a);
+  ijk_decref(&b);
+}
+
+static void test_append_owned(void) {
+  typed_value_t dst, value;
+  int i;
+  set_string(&dst, "", 0, 1);
+  set_int(&value, 7);
+  for (i = 0; i < 1000; ++i) ijk_concat_append(&dst, &value, 0);
+  CHECK(dst.type == IJK_KIND_STRING && dst.pstr->size == 1001);
+  CHECK(dst.pstr->data[0] == '7' && dst.pstr->data[999] == '7' && dst.pstr->data[1000] == '\0');
+  ijk_decref(&dst);
+}
+
+static void test_append_shared(void) {
+  /* $b = $a; $a .= "x"; leaves $b alone. */
+  typed_value_t dst, copy, value;
+  set_string(&dst, "abc", 3, 2);
+  copy = dst;
+  set_string(&value, "x", 1, 1);
+  ijk_concat_append(&dst, &value, 0);
+  CHECK(has_bytes(&dst, "abcx", 4));
+  CHECK(has_bytes(&copy, "abc", 3));
+  CHECK(copy.pstr->count == 1);
+  ijk_decref(&dst);
+  ijk_decref(&copy);
+  ijk_decref(&value);
+}
+
+static void test_append_self(void) {
+  /* $a .= $a, through every growth of the buffer. */
+  typed_value_t dst;
+  int i;
+  set_string(&dst, "ab", 2, 1);
+  for (i = 0; i < 10; ++i) ijk_concat_append(&dst, &dst, 0);
+  CHECK(dst.type == IJK_KIND_STRING && dst.pstr->size == (2 << 10) + 1);
+  CHECK(memcmp(dst.pstr->data + (2 << 10) - 2, "ab", 2) == 0);
+  ijk_decref(&dst);
+}
+
+static void test_append_object(void) {
+  typed_value_t dst, value;
+  object_data* obj = ijk_object_alloc(&s_class);
+  set_string(&dst, "x=", 2, 1);
+  set_null(&value);
+  value.type = IJK_KIND_OBJECT;
+  value.pobj = obj;
+  obj->count = 1;
+  ijk_concat_append(&dst, &value, 0);
+  CHECK(has_bytes(&dst, "x=obj", 5));
+  ijk_concat_append(&value, &dst, 0);
+  CHECK(has_bytes(&value, "objx=obj", 8));
+  ijk_decref(&dst);
+  ijk_decref(&value);
+}
+
+static void test_append_nul(void) {
+  typed_value_t dst, value;
+  set_string(&dst, "a\0", 2, 1);
+  set_string(&value, "\0b", 2, 1);
+  ijk_concat_append(&dst, &value, 0);
+  CHECK(has_bytes(&dst, "a\0\0b", 4));
+  ijk_decref(&dst);
+  ijk_decref(&value);
+}
+
+int main(void) {
+  test_concat_n_fresh();
+  test_concat_n_reuses_owned();
+  test_concat_n_shared_operand();
+  test_concat_n_object();
+  test_concat_n_nul();
+  test_append_owned();
+  test_append_shared();
+  test_append_self();
+  test_append_object();
+  test_append_nul();
+  if (s_failures) {
+    fprintf(stderr, "%d checks failed\n", s_failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,871 @@
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ijk-runtime.h"
+
+static string_data s_empty_string = { 1, "", IJK_STATIC_REFCOUNT, 0 };
+
+static void set_null(typed_value_t* tv) {
+  memset(tv, 0, sizeof(typed_value_t));
+  tv->type = IJK_KIND_NULL;
+  tv->pstr = &s_empty_string;
+}
+
+static generator_data* window_generator(const array_data* arr) {
+  return (generator_data*)((char*)arr - offsetof(generator_data, iter_window));
+}
+
+static void generator_resume(generator_data* gen, typed_value_t* sent) {
+  typed_value_t null_tv;
+  if (gen->state == -1) return;
+  if (!sent) {
+    set_null(&null_tv);
+    sent = &null_tv;
+  }
+  gen->resume(gen, sent);
+}
+
+static void generator_start(generator_data* gen) {
+  if (gen->state == 0) generator_resume(gen, NULL);
+}
+
+int64_t ijk_array_iter_begin(const array_data* arr) {
+  if (arr->kind == IJK_ARRAY_GENERATOR) {
+    generator_data* gen = window_generator(arr);
+    generator_start(gen);
+    return gen->state == -1 ? arr->used : 0;
+  }
+  return ijk_array_iter_advance(arr, -1);
+}
+
+int64_t ijk_array_iter_advance(const array_data* arr, int64_t pos) {
+  if (arr->kind == IJK_ARRAY_GENERATOR) {
+    /* The window always shows the current element at 0. */
+    generator_data* gen = window_generator(arr);
+    generator_resume(gen, NULL);
+    return gen->state == -1 ? arr->used : 0;
+  }
+  /* Deleted elements of a mixed array are left as Uninit tombstones. */
+  for (++pos; pos < arr->used; ++pos) {
+    if (arr->elems[pos].type != IJK_KIND_UNINIT) break;
+  }
+  return pos;
+}
+
+static typed_value_t* copy_typed_values(const typed_value_t* src, int64_t n) {
+  typed_value_t* dst;
+  if (!src || n == 0) return NULL;
+  dst = malloc(sizeof(typed_value_t) * n);
+  memcpy(dst, src, sizeof(typed_value_t) * n);
+  return dst;
+}
+
+array_data* ijk_array_separate(typed_value_t* tv) {
+  typed_value_t old = *tv;
+  array_data* arr = tv->parr;
+  array_data* copy;
+  int64_t i;
+  /* Static counts, as of generator windows, are negative. */
+  if (!arr->is_static && arr->count <= 1) return arr;
+
+  copy = malloc(sizeof(array_data));
+  *copy = *arr;
+  copy->is_static = 0;
+  copy->count = 1; /* owned by the local it was separated into */
+  copy->elems = copy_typed_values(arr->elems, arr->used);
+  copy->keys = copy_typed_values(arr->keys, arr->used);
+  /* The copy shares what the elements point to. */
+  for (i = 0; i < copy->used; ++i) {
+    if (copy->elems[i].type == IJK_KIND_UNINIT) continue;
+    ijk_incref(&copy->elems[i]);
+    if (copy->keys) ijk_incref(&copy->keys[i]);
+  }
+  tv->parr = copy;
+  ijk_decref(&old);
+  return copy;
+}
+
+static int32_t* refcount_of(const typed_value_t* tv) {
+  switch (tv->type) {
+    case IJK_KIND_STRING: return tv->pstr ? &tv->pstr->count : NULL;
+    case IJK_KIND_ARRAY:  return tv->parr ? &tv->parr->count : NULL;
+    case IJK_KIND_OBJECT: return tv->pobj ? &tv->pobj->count : NULL;
+  }
+  return NULL;
+}
+
+static void release(typed_value_t* tv) {
+  int64_t i;
+  switch (tv->type) {
+    case IJK_KIND_STRING:
+      free(tv->pstr->data);
+      free(tv->pstr);
+      break;
+    case IJK_KIND_ARRAY:
+      for (i = 0; i < tv->parr->used; ++i) {
+        if (tv->parr->elems[i].type == IJK_KIND_UNINIT) continue;
+        ijk_decref(&tv->parr->elems[i]);
+        if (tv->parr->keys) ijk_decref(&tv->parr->keys[i]);
+      }
+      free(tv->parr->elems);
+      free(tv->parr->keys);
+      free(tv->parr);
+      break;
+    case IJK_KIND_OBJECT:
+      if (tv->pobj->cls == &ijk_wait_handle_class) {
+        wait_handle_data* wh = (wait_handle_data*)tv->pobj;
+        if (wh->vm_handle) ijk_vm_release(wh->vm_handle);
+        ijk_decref(&wh->result);
+      }
+      for (i = 0; i < tv->pobj->cls->num_props; ++i) {
+        ijk_decref(&tv->pobj->props[i]);
+      }
+      free(tv->pobj);
+      break;
+  }
+}
+
+void ijk_incref(typed_value_t* tv) {
+  int32_t* count = refcount_of(tv);
+  if (!count || *count == IJK_STATIC_REFCOUNT) return;
+  ++*count;
+}
+
+void ijk_decref(typed_value_t* tv) {
+  int32_t* count = refcount_of(tv);
+  if (!count || *count <= 0) return;
+  if (--*count == 0) release(tv);
+}
+
+typedef void (*method_fn)(typed_value_t* retval, object_data* this,
+                          int64_t num_args, typed_value_t** args);
+
+static void* find_method(const class_t* cls, const char* name) {
+  int64_t i;
+  for (i = 0; i < cls->num_methods; ++i) {
+    if (strcmp(cls->methods[i].name, name) == 0) return cls->methods[i].fn;
+  }
+  return NULL;
+}
+
+/* PHP converts an object to a string with its __toString().  For an
+ * object, stores the result in *tmp, which the caller releases, and
+ * returns tmp; returns any other value as it is. */
+static const typed_value_t* to_string_operand(const typed_value_t* tv, typed_value_t* tmp) {
+  method_fn fn;
+  if (tv->type != IJK_KIND_OBJECT) return tv;
+  fn = (method_fn)find_method(tv->pobj->cls, "__tostring");
+  if (!fn) {
+    fprintf(stderr, "Catchable fatal error: Object of class %s could not be converted to string\n",
+            tv->pobj->cls->name);
+    abort();
+  }
+  set_null(tmp);
+  fn(tmp, tv->pobj, 0, NULL);
+  if (tmp->type != IJK_KIND_STRING) {
+    fprintf(stderr, "Catchable fatal error: Method %s::__toString() must return a string value\n",
+            tv->pobj->cls->name);
+    abort();
+  }
+  return tmp;
+}
+
+/* The bytes PHP's string conversion gives tv; numbers are formatted
+ * into buf.  Objects go through to_string_operand() first. */
+static const char* string_view(const typed_value_t* tv, char* buf, size_t buf_size,
+                               int64_t* len) {
+  switch (tv->type) {
+    case IJK_KIND_STRING:
+      *len = tv->pstr->size - 1;
+      return tv->pstr->data;
+    case IJK_KIND_INT64:
+      *len = snprintf(buf, buf_size, "%lld", (long long)tv->num);
+      return buf;
+    case IJK_KIND_DOUBLE:
+      /* PHP's default precision. */
+      *len = snprintf(buf, buf_size, "%.14G", tv->dbl);
+      return buf;
+    case IJK_KIND_BOOL:
+      *len = tv->num ? 1 : 0;
+      return "1";
+    case IJK_KIND_ARRAY:
+      *len = 5;
+      return "Array";
+  }
+  *len = 0;
+  return "";
+}
+
+/* string_data sizes are 32 bit. */
+static void check_string_size(int64_t size) {
+  if (size > INT32_MAX) {
+    fprintf(stderr, "Fatal error: String size overflow\n");
+    abort();
+  }
+}
+
+static string_data* string_alloc(int64_t capacity) {
+  string_data* str;
+  check_string_size(capacity);
+  str = malloc(sizeof(string_data));
+  str->data = malloc(capacity);
+  str->data[0] = '\0';
+  str->size = 1;
+  str->count = 0; /* counted once it is stored */
+  str->capacity = capacity;
+  return str;
+}
+
+/* Grows geometrically, so repeated appends stay linear overall. */
+static void string_reserve(string_data* str, int64_t capacity) {
+  if (str->capacity >= capacity) return;
+  check_string_size(capacity);
+  if (capacity < 2 * (int64_t)str->capacity) capacity = 2 * (int64_t)str->capacity;
+  if (capacity > INT32_MAX) capacity = INT32_MAX;
+  str->data = realloc(str->data, capacity);
+  str->capacity = capacity;
+}
+
+static void string_append(string_data* str, const char* data, int64_t len) {
+  memcpy(str->data + str->size - 1, data, len);
+  str->size += len;
+  str->data[str->size - 1] = '\0';
+}
+
+static int owns_string(const typed_value_t* tv) {
+  return tv->type == IJK_KIND_STRING && tv->pstr->count == 1 && tv->pstr->capacity > 0;
+}
+
+/* Converts tv to a number as PHP's arithmetic does.  Returns 1 and
+ * sets *dbl for a double, otherwise returns 0 and sets *num. */
+static int to_number(const typed_value_t* tv, int64_t* num, double* dbl) {
+  const char* p;
+  char* end;
+  *num = 0;
+  switch (tv->type) {
+    case IJK_KIND_BOOL:
+    case IJK_KIND_INT64:
+      *num = tv->num;
+      return 0;
+    case IJK_KIND_DOUBLE:
+      *dbl = tv->dbl;
+      return 1;
+    case IJK_KIND_STRING:
+      p = tv->pstr->data;
+      *num = strtoll(p, &end, 10);
+      if (*end == '.' || *end == 'e' || *end == 'E') {
+        *dbl = strtod(p, NULL);
+        return 1;
+      }
+      return 0;
+  }
+  return 0;
+}
+
+static int keys_equal(const typed_value_t* a, const typed_value_t* b) {
+  if (a->type != b->type) return 0;
+  if (a->type == IJK_KIND_INT64) return a->num == b->num;
+  return a->pstr->size == b->pstr->size &&
+         memcmp(a->pstr->data, b->pstr->data, a->pstr->size) == 0;
+}
+
+static void key_at(const array_data* arr, int64_t pos, typed_value_t* key) {
+  if (arr->keys) {
+    *key = arr->keys[pos];
+    return;
+  }
+  set_null(key);
+  key->type = IJK_KIND_INT64;
+  key->num = pos;
+}
+
+static void array_push(array_data* arr, const typed_value_t* key, const typed_value_t* value) {
+  arr->elems[arr->used] = *value;
+  ijk_incref(&arr->elems[arr->used]);
+  if (arr->keys) {
+    arr->keys[arr->used] = *key;
+    ijk_incref(&arr->keys[arr->used]);
+  }
+  ++arr->used;
+  ++arr->size;
+}
+
+/* PHP's array + array: the elements of a, then those of b under keys a
+ * lacks.  Keys are compared linearly, as mixed arrays have no hash. */
+static array_data* array_union(const array_data* a, const array_data* b) {
+  int64_t i, j, n = a->used + b->used;
+  int packed = a->kind == IJK_ARRAY_PACKED && b->kind == IJK_ARRAY_PACKED;
+  typed_value_t key;
+  array_data* ret = malloc(sizeof(array_data));
+  ret->kind = packed ? IJK_ARRAY_PACKED : IJK_ARRAY_MIXED;
+  ret->is_static = 0;
+  ret->size = 0;
+  ret->used = 0;
+  ret->elems = malloc(sizeof(typed_value_t) * (n ? n : 1));
+  ret->keys = packed ? NULL : malloc(sizeof(typed_value_t) * (n ? n : 1));
+  ret->count = 0; /* counted once it is stored */
+  
+  for (i = 0; i < a->used; ++i) {
+    if (a->elems[i].type == IJK_KIND_UNINIT) continue;
+    key_at(a, i, &key);
+    array_push(ret, &key, &a->elems[i]);
+  }
+  for (j = 0; j < b->used; ++j) {
+    if (b->elems[j].type == IJK_KIND_UNINIT) continue;
+    if (packed) {
+      /* Packed arrays have no holes, so a has every key below its size. */
+      if (j < a->used) continue;
+    } else {
+      key_at(b, j, &key);
+      for (i = 0; i < ret->used; ++i) {
+        if (keys_equal(&ret->keys[i], &key)) break;
+      }
+      if (i < ret->used) continue;
+    }
+    key_at(b, j, &key);
+    array_push(ret, &key, &b->elems[j]);
+  }
+  return ret;
+}
+
+void ijk_arith(int64_t op, typed_value_t* dst, const typed_value_t* a,
+               const typed_value_t* b) {
+  int64_t an, bn;
+  double ad = 0.0, bd = 0.0;
+  int a_dbl, b_dbl;
+  array_data* arr;
+  
+  if (a->type == IJK_KIND_ARRAY || b->type == IJK_KIND_ARRAY) {
+    if (op != IJK_ARITH_ADD || a->type != b->type) {
+      fprintf(stderr, "Fatal error: Unsupported operand types\n");
+      abort();
+    }
+    arr = array_union(a->parr, b->parr);
+    set_null(dst);
+    dst->type = IJK_KIND_ARRAY;
+    dst->parr = arr;
+    return;
+  }
+  
+  a_dbl = to_number(a, &an, &ad);
+  b_dbl = to_number(b, &bn, &bd);
+  set_null(dst);
+  
+  if (!a_dbl && !b_dbl) {
+    int overflow = 0;
+    uint64_t r = 0;
+    switch (op) {
+      case IJK_ARITH_ADD:
+        overflow = (bn > 0 && an > INT64_MAX - bn) || (bn < 0 && an < INT64_MIN - bn);
+        r = (uint64_t)an + (uint64_t)bn;
+        break;
+      case IJK_ARITH_SUB:
+        overflow = (bn < 0 && an > INT64_MAX + bn) || (bn > 0 && an < INT64_MIN + bn);
+        r = (uint64_t)an - (uint64_t)bn;
+        break;
+      case IJK_ARITH_MUL:
+        r = (uint64_t)an * (uint64_t)bn;
+        /* -1 * INT64_MIN would trap in the division below. */
+        overflow = an != 0 && ((an == -1 && bn == INT64_MIN) || (int64_t)r / an != bn);
+        break;
+      case IJK_ARITH_DIV:
+        /* Only exact quotients stay integers. */
+        overflow = bn == 0 || (an == INT64_MIN && bn == -1) || an % bn != 0;
+        if (!overflow) r = (uint64_t)(an / bn);
+        break;
+    }
+    if (!overflow) {
+      dst->type = IJK_KIND_INT64;
+      dst->num = (int64_t)r;
+      return;
+    }
+  }
+  
+  if (!a_dbl) ad = (double)an;
+  if (!b_dbl) bd = (double)bn;
+  dst->type = IJK_KIND_DOUBLE;
+  switch (op) {
+    case IJK_ARITH_ADD: dst->dbl = ad + bd; break;
+    case IJK_ARITH_SUB: dst->dbl = ad - bd; break;
+    case IJK_ARITH_MUL: dst->dbl = ad * bd; break;
+    case IJK_ARITH_DIV:
+      if (bd == 0.0) {
+        fprintf(stderr, "Warning: Division by zero\n");
+        dst->type = IJK_KIND_BOOL;
+        dst->num = 0;
+        break;
+      }
+      dst->dbl = ad / bd;
+      break;
+  }
+}
+
+/* Concatenates parts after converting the objects among them. */
+static void concat_objects(typed_value_t* dst, typed_value_t** parts, int64_t n) {
+  typed_value_t* tmps = malloc(sizeof(typed_value_t) * n);
+  typed_value_t** converted = malloc(sizeof(typed_value_t*) * n);
+  int64_t i;
+  for (i = 0; i < n; ++i) {
+    set_null(&tmps[i]);
+    converted[i] = (typed_value_t*)to_string_operand(parts[i], &tmps[i]);
+  }
+  ijk_concat_n(dst, converted, n);
+  for (i = 0; i < n; ++i) ijk_decref(&tmps[i]);
+  free(converted);
+  free(tmps);
+}
+
+void ijk_concat_n(typed_value_t* dst, typed_value_t** parts, int64_t n) {
+  char buf[32];
+  int64_t i, len, total = 1;
+  int reuse;
+  string_data* str;
+  for (i = 0; i < n; ++i) {
+    if (parts[i]->type == IJK_KIND_OBJECT) {
+      concat_objects(dst, parts, n);
+      return;
+    }
+  }
+  for (i = 0; i < n; ++i) {
+    string_view(parts[i], buf, sizeof buf, &len);
+    total += len;
+  }
+  reuse = n > 0 && owns_string(parts[0]);
+  for (i = 1; reuse && i < n; ++i) {
+    /* As in $a . $a, where the first part is read again below. */
+    reuse = parts[i]->pstr != parts[0]->pstr;
+  }
+  if (reuse) {
+    str = parts[0]->pstr;
+    string_reserve(str, total);
+    str->count = 0;
+    set_null(parts[0]);
+    i = 1;
+  } else {
+    str = string_alloc(total);
+    i = 0;
+  }
+  for (; i < n; ++i) {
+    const char* data = string_view(parts[i], buf, sizeof buf, &len);
+    string_append(str, data, len);
+  }
+  set_null(dst);
+  dst->type = IJK_KIND_STRING;
+  dst->pstr = str;
+}
+
+void ijk_concat_append(typed_value_t* dst, const typed_value_t* value, int64_t reserve) {
+  char buf[32], dst_buf[32];
+  int64_t len, dst_len, size;
+  typed_value_t value_tmp, dst_tmp;
+  const char* data;
+  const char* dst_data;
+  string_data* str;
+  set_null(&value_tmp);
+  set_null(&dst_tmp);
+  data = string_view(to_string_operand(value, &value_tmp), buf, sizeof buf, &len);
+  if (owns_string(dst)) {
+    string_reserve(dst->pstr, dst->pstr->size + len);
+    /* $a .= $a reads what string_reserve() may have moved. */
+    if (value->type == IJK_KIND_STRING && value->pstr == dst->pstr) data = dst->pstr->data;
+    string_append(dst->pstr, data, len);
+    ijk_decref(&value_tmp);
+    return;
+  }
+  dst_data = string_view(to_string_operand(dst, &dst_tmp), dst_buf, sizeof dst_buf, &dst_len);
+  size = dst_len + len + 1;
+  check_string_size(size);
+  if (reserve > INT32_MAX - size) reserve = INT32_MAX - size;
+  str = string_alloc(size + reserve);
+  string_append(str, dst_data, dst_len);
+  string_append(str, data, len);
+  str->count = 1;
+  ijk_decref(dst);
+  set_null(dst);
+  dst->type = IJK_KIND_STRING;
+  dst->pstr = str;
+  ijk_decref(&value_tmp);
+  ijk_decref(&dst_tmp);
+}
+
+object_data* ijk_object_alloc(const class_t* cls) {
+  object_data* obj = malloc(cls->size);
+  obj->cls = cls;
+  obj->count = 0; /* counted once it is pushed */
+  memcpy(obj->props, cls->prop_defaults, sizeof(typed_value_t) * cls->num_props);
+  return obj;
+}
+
+void* ijk_method_lookup(const class_t* cls, const char* name, method_cache* cache) {
+  /* Names are lowercased by the translator. */
+  void* fn = find_method(cls, name);
+  if (fn) {
+    cache->cls = cls;
+    cache->fn = fn;
+    return fn;
+  }
+  fprintf(stderr, "Fatal error: Call to undefined method %s::%s()\n", cls->name, name);
+  abort();
+}
+
+typed_value_t* ijk_object_prop(object_data* obj, const char* name, prop_cache* cache) {
+  int64_t i;
+  if (cache->cls == obj->cls) return &obj->props[cache->index];
+  for (i = 0; i < obj->cls->num_props; ++i) {
+    if (strcmp(obj->cls->prop_names[i], name) == 0) {
+      cache->cls = obj->cls;
+      cache->index = i;
+      return &obj->props[i];
+    }
+  }
+  /* Dynamic properties are not supported. */
+  fprintf(stderr, "Fatal error: Undefined property %s::$%s\n", obj->cls->name, name);
+  abort();
+}
+
+/* Generator methods, called through the dispatch convention. */
+
+static void generator_current(typed_value_t* retval, object_data* this,
+                              int64_t num_args, typed_value_t** args) {
+  generator_data* gen = (generator_data*)this;
+  generator_start(gen);
+  *retval = gen->current;
+  ijk_incref(retval);
+}
+
+static void generator_key(typed_value_t* retval, object_data* this,
+                          int64_t num_args, typed_value_t** args) {
+  generator_data* gen = (generator_data*)this;
+  generator_start(gen);
+  *retval = gen->key;
+  ijk_incref(retval);
+}
+
+static void generator_next(typed_value_t* retval, object_data* this,
+                           int64_t num_args, typed_value_t** args) {
+  generator_data* gen = (generator_data*)this;
+  generator_start(gen);
+  generator_resume(gen, NULL);
+}
+
+static void generator_send(typed_value_t* retval, object_data* this,
+                           int64_t num_args, typed_value_t** args) {
+  generator_data* gen = (generator_data*)this;
+  generator_start(gen);
+  generator_resume(gen, num_args > 0 ? args[0] : NULL);
+  *retval = gen->current;
+  ijk_incref(retval);
+}
+
+static void generator_valid(typed_value_t* retval, object_data* this,
+                            int64_t num_args, typed_value_t** args) {
+  generator_data* gen = (generator_data*)this;
+  generator_start(gen);
+  retval->type = IJK_KIND_BOOL;
+  retval->num = gen->state != -1;
+}
+
+static void generator_rewind(typed_value_t* retval, object_data* this,
+                             int64_t num_args, typed_value_t** args) {
+  generator_start((generator_data*)this);
+}
+
+static const method_entry s_generator_methods[] = {
+  { "current", (void*)generator_current },
+  { "key",     (void*)generator_key },
+  { "next",    (void*)generator_next },
+  { "rewind",  (void*)generator_rewind },
+  { "send",    (void*)generator_send },
+  { "valid",   (void*)generator_valid },
+};
+
+const class_t ijk_generator_class = {
+  "Continuation", NULL, NULL, s_generator_methods,
+  sizeof(s_generator_methods) / sizeof(s_generator_methods[0]),
+  sizeof(generator_data), NULL, NULL, 0
+};
+
+generator_data* ijk_generator_create(int64_t frame_size, void* resume) {
+  generator_data* gen = malloc(sizeof(generator_data) + frame_size);
+  gen->cls = &ijk_generator_class;
+  gen->count = 0; /* counted once it is pushed */
+  gen->resume = (generator_resume_fn)resume;
+  gen->state = 0;
+  gen->next_key = 0;
+  set_null(&gen->key);
+  set_null(&gen->current);
+  gen->iter_window.kind = IJK_ARRAY_GENERATOR;
+  gen->iter_window.is_static = 0;
+  gen->iter_window.size = 1;
+  gen->iter_window.used = 1;
+  gen->iter_window.elems = &gen->current;
+  gen->iter_window.keys = &gen->key;
+  gen->iter_window.count = IJK_STATIC_REFCOUNT;
+  return gen;
+}
+
+void ijk_generator_yield(generator_data* gen, const typed_value_t* value,
+                         const typed_value_t* key) {
+  gen->current = *value;
+  if (!key) {
+    set_null(&gen->key);
+    gen->key.type = IJK_KIND_INT64;
+    gen->key.num = gen->next_key++;
+    return;
+  }
+  gen->key = *key;
+  /* Auto keys continue after the largest integer key, as in PHP. */
+  if (key->type == IJK_KIND_INT64 && key->num >= gen->next_key) {
+    gen->next_key = key->num + 1;
+  }
+}
+
+void ijk_generator_finish(generator_data* gen) {
+  gen->state = -1;
+  set_null(&gen->key);
+  set_null(&gen->current);
+}
+
+array_data* ijk_object_iter_array(typed_value_t* tv) {
+  /* Plain objects aren't iterable by translated code. */
+  if (!tv->pobj || tv->pobj->cls != &ijk_generator_class) return NULL;
+  return &((generator_data*)tv->pobj)->iter_window;
+}
+
+static void wait_handle_join(typed_value_t* retval, object_data* this,
+                             int64_t num_args, typed_value_t** args) {
+  typed_value_t awaitable;
+  set_null(&awaitable);
+  awaitable.type = IJK_KIND_OBJECT;
+  awaitable.pobj = this;
+  ijk_await(&awaitable, retval);
+  ijk_incref(retval);
+}
+
+static void wait_handle_get_wait_handle(typed_value_t* retval, object_data* this,
+                                        int64_t num_args, typed_value_t** args) {
+  set_null(retval);
+  retval->type = IJK_KIND_OBJECT;
+  retval->pobj = this;
+}
+
+static void wait_handle_is_finished(typed_value_t* retval, object_data* this,
+                                    int64_t num_args, typed_value_t** args) {
+  /* A VM handle counts as finished once it has been awaited. */
+  set_null(retval);
+  retval->type = IJK_KIND_BOOL;
+  retval->num = ((wait_handle_data*)this)->vm_handle == NULL;
+}
+
+static const method_entry s_wait_handle_methods[] = {
+  { "getwaithandle", (void*)wait_handle_get_wait_handle },
+  { "isfinished",    (void*)wait_handle_is_finished },
+  { "join",          (void*)wait_handle_join },
+};
+
+const class_t ijk_wait_handle_class = {
+  "StaticResultWaitHandle", NULL, NULL, s_wait_handle_methods,
+  sizeof(s_wait_handle_methods) / sizeof(s_wait_handle_methods[0]),
+  sizeof(wait_handle_data), NULL, NULL, 0
+};
+
+object_data* ijk_wait_handle_create(const typed_value_t* result) {
+  wait_handle_data* wh = malloc(sizeof(wait_handle_data));
+  wh->cls = &ijk_wait_handle_class;
+  wh->count = 0; /* counted once it is pushed */
+  wh->result = *result; /* takes over the caller's reference */
+  wh->vm_handle = NULL;
+  return (object_data*)wh;
+}
+
+object_data* ijk_wait_handle_wrap(void* vm_handle) {
+  wait_handle_data* wh = malloc(sizeof(wait_handle_data));
+  wh->cls = &ijk_wait_handle_class;
+  wh->count = 0; /* counted once it is pushed */
+  set_null(&wh->result);
+  wh->vm_handle = vm_handle;
+  return (object_data*)wh;
+}
+
+void ijk_await(const typed_value_t* awaitable, typed_value_t* result) {
+  wait_handle_data* wh;
+  if (awaitable->type != IJK_KIND_OBJECT || 
+      awaitable->pobj->cls != &ijk_wait_handle_class) {
+    /* Wait handles of the VM are wrapped as they cross in
+     * ijk_vm_call(), so this is PHP's own error. */
+    fprintf(stderr, "Fatal error: Await on a non-WaitHandle\n");
+    abort();
+  }
+  wh = (wait_handle_data*)awaitable->pobj;
+  if (wh->vm_handle) {
+    /* The VM runs whatever the handle waits on, e.g. I/O, and the
+     * result is kept so that later awaits needn't go back. */
+    ijk_vm_await(wh->vm_handle, &wh->result);
+    ijk_vm_release(wh->vm_handle);
+    wh->vm_handle = NULL;
+  }
+  *result = wh->result;
+}
+
+/* Globals by name: open addressing over a power of two table.  Each
+ * global has one slot, which registered modules point their fixed
+ * slots at, so that they all alias. */
+typedef struct global_bucket {
+  char* name;
+  int64_t len;
+  typed_value_t* slot;
+} global_bucket;
+
+static global_bucket* s_globals;
+static int64_t s_globals_size;
+static int64_t s_globals_used;
+
+static uint64_t hash_name(const char* name, int64_t len) {
+  /* FNV-1a */
+  uint64_t h = 14695981039346656037ULL;
+  int64_t i;
+  for (i = 0; i < len; ++i) {
+    h ^= (unsigned char)name[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static global_bucket* global_bucket_of(const char* name, int64_t len) {
+  uint64_t i;
+  if (!s_globals) return NULL;
+  for (i = hash_name(name, len); ; ++i) {
+    global_bucket* b = &s_globals[i & (s_globals_size - 1)];
+    if (!b->name) return b;
+    if (b->len == len && memcmp(b->name, name, len) == 0) return b;
+  }
+}
+
+static void globals_grow(void) {
+  global_bucket* old = s_globals;
+  int64_t old_size = s_globals_size, i;
+  s_globals_size = old_size ? 2 * old_size : 64;
+  s_globals = calloc(s_globals_size, sizeof(global_bucket));
+  for (i = 0; i < old_size; ++i) {
+    if (old[i].name) *global_bucket_of(old[i].name, old[i].len) = old[i];
+  }
+  free(old);
+}
+
+/* The slot of the global, made on first use.  Slots are never freed,
+ * as modules keep pointers to them past being unloaded by the JIT. */
+static typed_value_t* global_bind(const char* name, int64_t len) {
+  global_bucket* b;
+  if (2 * (s_globals_used + 1) > s_globals_size) globals_grow();
+  b = global_bucket_of(name, len);
+  if (!b->name) {
+    b->name = malloc(len + 1);
+    memcpy(b->name, name, len);
+    b->name[len] = '\0';
+    b->len = len;
+    b->slot = malloc(sizeof(typed_value_t));
+    ++s_globals_used;
+    /* Superglobals, and whatever the VM has set so far. */
+    ijk_vm_global(b->name, b->slot);
+  }
+  return b->slot;
+}
+
+void ijk_globals_register(const global_entry* entries) {
+  for (; entries->name; ++entries) {
+    *entries->slot = global_bind(entries->name, strlen(entries->name));
+  }
+}
+
+void ijk_globals_visit(global_visit_fn fn, void* ctx) {
+  int64_t i;
+  for (i = 0; i < s_globals_size; ++i) {
+    if (s_globals[i].name) fn(s_globals[i].name, s_globals[i].slot, ctx);
+  }
+}
+
+typed_value_t* ijk_global_find(const typed_value_t* name) {
+  char buf[32];
+  int64_t len;
+  const char* data = string_view(name, buf, sizeof(buf), &len);
+  global_bucket* b = global_bucket_of(data, len);
+  return b && b->name ? b->slot : NULL;
+}
+
+typed_value_t* ijk_global_lookup(const typed_value_t* name) {
+  char buf[32];
+  int64_t len;
+  const char* data = string_view(name, buf, sizeof(buf), &len);
+  return global_bind(data, len);
+}
+
+/* Overridden by vm-bridge.cpp when the module is loaded into HHVM. */
+__attribute__((weak))
+void ijk_vm_call(const char* name, typed_value_t* retval,
+                 int64_t num_args, typed_value_t** args) {
+  fprintf(stderr, "Fatal error: %s() needs the HHVM VM\n", name);
+  abort();
+}
+
+__attribute__((weak))
+void ijk_vm_call_method(const char* cls, const char* name, typed_value_t* retval,
+                        int64_t num_args, typed_value_t** args) {
+  fprintf(stderr, "Fatal error: %s::%s() needs the HHVM VM\n", cls, name);
+  abort();
+}
+
+__attribute__((weak))
+void ijk_vm_include(const char* path) {
+  fprintf(stderr, "Fatal error: %s needs the HHVM VM\n", path);
+  abort();
+}
+
+__attribute__((weak))
+void ijk_vm_load(const char* path) {
+  fprintf(stderr, "Fatal error: %s needs the HHVM VM\n", path);
+  abort();
+}
+
+__attribute__((weak))
+void ijk_vm_global(const char* name, typed_value_t* value) {
+  set_null(value);
+}
+
+/* Only reached with a handle from the VM, so never outside it. */
+__attribute__((weak))
+void ijk_vm_await(void* vm_handle, typed_value_t* result) {
+  abort();
+}
+
+__attribute__((weak))
+void ijk_vm_release(void* vm_handle) {
+}
+
+void ijk_fatal(const char* message) {
+  fprintf(stderr, "Fatal error: %s\n", message);
+  abort();
+}
+
+void ijk_profile_write(const char* path, const ijk_probe* probes, int64_t n) {
+  /* Read back by IJK::ProfileData::load(), which sums the counts of
+   * repeated keys, so each run adds to what earlier runs wrote. */
+  int64_t i, type;
+  FILE* out = fopen(path, "a");
+  if (!out) return;
+
+  for (i = 0; i < n; ++i) {
+    if (probes[i].width == 1) {
+      fprintf(out, "%lld %s\n", (long long)probes[i].counters[0], probes[i].key);
+      continue;
+    }
+    for (type = 0; type < probes[i].width; ++type) {
+      if (probes[i].counters[type] == 0) continue;
+      fprintf(out, "%lld %s=%lld\n",
+              (long long)probes[i].counters[type], probes[i].key, (long long)type);
+    }
+  }
+  fclose(out);
+}
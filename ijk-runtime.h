@@ -0,0 +1,223 @@
+#ifndef IJK_RUNTIME_H
+#define IJK_RUNTIME_H
+
+#include <stdint.h>
+
+/*
+ * Runtime support linked into translated modules.  The layouts below
+ * must match the LLVM types built by Translator::defineTypes().
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Mirrors HPHP::DataType. */
+#define IJK_KIND_UNINIT 0x00
+#define IJK_KIND_NULL   0x08
+#define IJK_KIND_BOOL   0x09
+#define IJK_KIND_INT64  0x0a
+#define IJK_KIND_DOUBLE 0x0b
+#define IJK_KIND_STRING 0x14
+#define IJK_KIND_ARRAY  0x20
+#define IJK_KIND_OBJECT 0x40
+
+/* Count of values that live in the module's constants or on the C
+ * stack; ijk_incref()/ijk_decref() leave them alone. */
+#define IJK_STATIC_REFCOUNT (-1)
+
+/* Mirrors IJK::ArithOp. */
+#define IJK_ARITH_ADD 0
+#define IJK_ARITH_SUB 1
+#define IJK_ARITH_MUL 2
+#define IJK_ARITH_DIV 3
+
+/* Mirrors IJK::ArrayDataKind. */
+#define IJK_ARRAY_PACKED 0
+#define IJK_ARRAY_MIXED  1
+#define IJK_ARRAY_GENERATOR 2
+
+typedef struct string_data {
+  int32_t size;      /* bytes used, including the terminating NUL */
+  char* data;
+  int32_t count;
+  int32_t capacity;  /* bytes allocated for data; 0 if not owned */
+} string_data;
+
+struct array_data;
+struct object_data;
+
+typedef struct typed_value_t {
+  int8_t type;
+  int64_t num;
+  double dbl;
+  string_data* pstr;
+  struct array_data* parr;
+  struct object_data* pobj;
+} typed_value_t;
+
+typedef struct array_data {
+  uint8_t kind;
+  uint8_t is_static;
+  int64_t size;
+  int64_t used;      /* slots in elems, including tombstones */
+  typed_value_t* elems;
+  typed_value_t* keys; /* NULL when packed */
+  int32_t count;
+} array_data;
+
+typedef struct method_entry {
+  const char* name; /* lowercased */
+  void* fn;         /* dispatch thunk */
+} method_entry;
+
+/* Emitted once per class by Translator::emitClassGlobal(). */
+typedef struct class_t {
+  const char* name;
+  const struct class_t* parent;
+  void** vtable;
+  const method_entry* methods;
+  int64_t num_methods;
+  int64_t size;
+  const typed_value_t* prop_defaults;
+  const char** prop_names;
+  int64_t num_props;
+} class_t;
+
+typedef struct object_data {
+  const class_t* cls;
+  int32_t count;
+  typed_value_t props[];
+} object_data;
+
+struct generator_data;
+typedef void (*generator_resume_fn)(struct generator_data* gen, typed_value_t* sent);
+
+/* A generator object.  The frame of its translated resume function
+ * follows the header in the same allocation. */
+typedef struct generator_data {
+  const class_t* cls; /* &ijk_generator_class; laid out as object_data */
+  int32_t count;
+  generator_resume_fn resume;
+  int64_t state;      /* 0 before the start, k after the k-th Yield, -1 once finished */
+  int64_t next_key;
+  typed_value_t key;
+  typed_value_t current;
+  array_data iter_window; /* what foreach walks; see ijk_object_iter_array() */
+} generator_data;
+
+/* Translated async functions run to completion, so their wait handles
+ * are always finished.  A wait handle the VM returned is held in
+ * vm_handle instead and awaited through ijk_vm_await(). */
+typedef struct wait_handle_data {
+  const class_t* cls; /* &ijk_wait_handle_class */
+  int32_t count;
+  typed_value_t result;
+  void* vm_handle;    /* the VM's ObjectData*, or NULL */
+} wait_handle_data;
+
+extern const class_t ijk_generator_class;
+extern const class_t ijk_wait_handle_class;
+
+/* Per-call-site caches, zero initialised. */
+typedef struct method_cache {
+  const class_t* cls;
+  void* fn;
+} method_cache;
+
+typedef struct prop_cache {
+  const class_t* cls;
+  int64_t index;
+} prop_cache;
+
+/* One counter array of an instrumented module; see Translator::getProbe(). */
+typedef struct ijk_probe {
+  const char* key;
+  int64_t* counters;
+  int64_t width;     /* 1, or 256 for a type observation probe */
+} ijk_probe;
+
+int64_t ijk_array_iter_begin(const array_data* arr);
+int64_t ijk_array_iter_advance(const array_data* arr, int64_t pos);
+array_data* ijk_array_separate(typed_value_t* tv);
+
+/* Recognised by IJK::RefcountElision; see refcount.h. */
+void ijk_incref(typed_value_t* tv);
+void ijk_decref(typed_value_t* tv);
+
+/* dst = a <op> b for operands the translated fast paths don't handle,
+ * converting them to numbers the way PHP does.  Two arrays add up to
+ * their union; any other arithmetic on an array is a fatal error. */
+void ijk_arith(int64_t op, typed_value_t* dst, const typed_value_t* a,
+               const typed_value_t* b);
+
+/* PHP's "." on parts[0] .. parts[n-1], in a single allocation.  A
+ * leading string nothing else refers to is appended to in place and
+ * moved out of parts[0]. */
+void ijk_concat_n(typed_value_t* dst, typed_value_t** parts, int64_t n);
+/* dst .= value.  Appends in place when dst owns its string outright,
+ * otherwise copies, leaving room for reserve more bytes. */
+void ijk_concat_append(typed_value_t* dst, const typed_value_t* value, int64_t reserve);
+
+object_data* ijk_object_alloc(const class_t* cls);
+void* ijk_method_lookup(const class_t* cls, const char* name, method_cache* cache);
+typed_value_t* ijk_object_prop(object_data* obj, const char* name, prop_cache* cache);
+
+generator_data* ijk_generator_create(int64_t frame_size, void* resume);
+void ijk_generator_yield(generator_data* gen, const typed_value_t* value,
+                         const typed_value_t* key);
+void ijk_generator_finish(generator_data* gen);
+array_data* ijk_object_iter_array(typed_value_t* tv);
+object_data* ijk_wait_handle_create(const typed_value_t* result);
+/* Wraps a wait handle of the VM, taking over a reference to it. */
+object_data* ijk_wait_handle_wrap(void* vm_handle);
+void ijk_await(const typed_value_t* awaitable, typed_value_t* result);
+
+/* A global variable the translator gave a fixed slot; each module has
+ * a table of them, ending with a NULL name. */
+typedef struct global_entry {
+  const char* name;
+  typed_value_t** slot;
+} global_entry;
+
+/* Points a module's fixed slots at the storage of their globals, shared
+ * with every other module and with lookups by a name only known at run
+ * time.  Called by the module's constructor. */
+void ijk_globals_register(const global_entry* entries);
+typedef void (*global_visit_fn)(const char* name, typed_value_t* slot, void* ctx);
+/* Calls fn on every global translated code has a slot for. */
+void ijk_globals_visit(global_visit_fn fn, void* ctx);
+/* The global variable named name, created as null if there's none. */
+typed_value_t* ijk_global_lookup(const typed_value_t* name);
+/* As ijk_global_lookup() but NULL if there's none. */
+typed_value_t* ijk_global_find(const typed_value_t* name);
+
+/* Run a function, or a whole file, in the HHVM VM; see vm-bridge.cpp.
+ * Outside HHVM these abort. */
+void ijk_vm_call(const char* name, typed_value_t* retval,
+                 int64_t num_args, typed_value_t** args);
+void ijk_vm_call_method(const char* cls, const char* name, typed_value_t* retval,
+                        int64_t num_args, typed_value_t** args);
+void ijk_vm_include(const char* path);
+/* Defines a file's functions and classes in the VM without running its
+ * top-level code. */
+void ijk_vm_load(const char* path);
+/* The VM's value of a global variable, such as $_SERVER, when translated
+ * code first uses it; null outside HHVM.  vm-bridge.cpp keeps the two
+ * in sync across calls between them from then on. */
+void ijk_vm_global(const char* name, typed_value_t* value);
+/* Joins a wait handle of the VM, running its scheduler until the
+ * handle finishes, and drops a reference to one. */
+void ijk_vm_await(void* vm_handle, typed_value_t* result);
+void ijk_vm_release(void* vm_handle);
+
+/* Code the translator could only lower to a fatal error. */
+void ijk_fatal(const char* message);
+
+void ijk_profile_write(const char* path, const ijk_probe* probes, int64_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,9 @@
 #include "ijk.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
 
 namespace HPHP {
 
@@ -11,6 +15,104 @@ bool HHVM_FUNCTION(ijk_translate_file, const String& moduleName, const String& f
   return translator.print();
 }
 
+bool HHVM_FUNCTION(ijk_translate_file_instrumented, const String& moduleName, const String& filePath, const String& profilePath) {
+  IJK::Translator translator(moduleName);
+  translator.setProfile(IJK::ProfileMode::Instrument, profilePath.toCppString());
+  translator.translateFile(filePath);
+  return translator.print();
+}
+
+bool HHVM_FUNCTION(ijk_translate_file_with_profile, const String& moduleName, const String& filePath, const String& profilePath) {
+  IJK::Translator translator(moduleName);
+  if (!translator.setProfile(IJK::ProfileMode::Use, profilePath.toCppString())) {
+    return false;
+  }
+  translator.translateFile(filePath);
+  return translator.print();
+}
+
+bool HHVM_FUNCTION(ijk_translate_program, const String& moduleName, const String& entryFilePath, const Array& filePaths) {
+  std::vector<std::string> paths;
+  for (ArrayIter it(filePaths); it; ++it) {
+    paths.push_back(it.second().toString().toCppString());
+  }
+  IJK::Translator translator(moduleName);
+  if (!translator.translateProgram(entryFilePath, paths)) {
+    return false;
+  }
+  return translator.print();
+}
+
+bool HHVM_FUNCTION(ijk_compile_file, const String& moduleName, const String& filePath, const String& objectPath, int64_t jobs) {
+  IJK::Translator translator(moduleName);
+  if (!translator.translateFile(filePath)) {
+    return false;
+  }
+  return translator.compile(objectPath.toCppString(), jobs > 0 ? jobs : 0);
+}
+
+// The directories of path, made absolute.
+static std::vector<std::string> dir_components(const String& path) {
+  llvm::SmallString<256> absolute(path.toCppString());
+  llvm::sys::fs::make_absolute(absolute);
+  llvm::StringRef dir = llvm::sys::path::parent_path(absolute);
+  return std::vector<std::string>(llvm::sys::path::begin(dir), llvm::sys::path::end(dir));
+}
+
+Variant HHVM_FUNCTION(ijk_compile_files, const Array& filePaths, const String& objectDir) {
+  // Objects mirror the files' layout under the deepest directory they
+  // share, so that a/util.php and b/util.php don't collide.
+  std::vector<std::string> common;
+  auto first = true;
+  for (ArrayIter it(filePaths); it; ++it) {
+    auto const dirs = dir_components(it.second().toString());
+    if (first) {
+      common = dirs;
+      first = false;
+      continue;
+    }
+    auto n = size_t{0};
+    while (n < common.size() && n < dirs.size() && common[n] == dirs[n]) ++n;
+    common.resize(n);
+  }
+  
+  // Each file streams into an object of its own, in a context of its own
+  // so that nothing of one file's translation outlives it.
+  for (ArrayIter it(filePaths); it; ++it) {
+    const String filePath = it.second().toString();
+    auto const dirs = dir_components(filePath);
+    llvm::SmallString<256> objectPath(objectDir.toCppString());
+    for (auto i = common.size(); i < dirs.size(); ++i) {
+      llvm::sys::path::append(objectPath, dirs[i]);
+    }
+    llvm::sys::fs::create_directories(objectPath.str());
+    llvm::sys::path::append(objectPath, llvm::sys::path::filename(filePath.toCppString()));
+    llvm::sys::path::replace_extension(objectPath, "o");
+    
+    llvm::LLVMContext ctx;
+    IJK::Translator translator(filePath, ctx);
+    translator.beginStreaming(objectPath.str());
+    if (!translator.translateFile(filePath) || !translator.finishStreaming()) {
+      raise_warning("ijk: failed to compile %s", filePath.c_str());
+      return false;
+    }
+  }
+  // What the batch cost at most, in KiB.
+  return static_cast<int64_t>(IJK::peak_memory_kb());
+}
+
+int64_t HHVM_FUNCTION(ijk_run_file, const String& filePath) {
+  IJK::Translator translator(filePath);
+  if (!translator.translateFile(filePath)) {
+    return -1;
+  }
+  return translator.run();
+}
+
+Variant HHVM_FUNCTION(ijk_call_native, const String& library, const String& function, const Array& args) {
+  return IJK::call_native(library, function, args);
+}
+
 bool HHVM_FUNCTION(ijk_class_exists, const String& className) {
   return HHVM_FN(class_exists)(className);
 }
@@ -30,6 +132,13 @@ static class IJKExtension : public Extension {
   IJKExtension() : Extension("ijk") {}
   virtual void moduleInit() {
     HHVM_FE(ijk_translate_file);
+    HHVM_FE(ijk_translate_file_instrumented);
+    HHVM_FE(ijk_translate_file_with_profile);
+    HHVM_FE(ijk_translate_program);
+    HHVM_FE(ijk_compile_file);
+    HHVM_FE(ijk_compile_files);
+    HHVM_FE(ijk_run_file);
+    HHVM_FE(ijk_call_native);
     HHVM_FE(ijk_class_exists);
     HHVM_FE(ijk_assemble);
     loadSystemlib();
@@ -2,11 +2,19 @@
 
 #include "hphp/runtime/ext/std/ext_std_classobj.h"
 #include "translator.h"
+#include "vm-bridge.h"
 
 namespace HPHP {
   
 bool HHVM_FUNCTION(ijk_translate_file, const String& moduleName, const String& filePath);
+bool HHVM_FUNCTION(ijk_translate_file_instrumented, const String& moduleName, const String& filePath, const String& profilePath);
+bool HHVM_FUNCTION(ijk_translate_file_with_profile, const String& moduleName, const String& filePath, const String& profilePath);
+Variant HHVM_FUNCTION(ijk_call_native, const String& library, const String& function, const Array& args);
 bool HHVM_FUNCTION(ijk_class_exists, const String& className);
+bool HHVM_FUNCTION(ijk_translate_program, const String& moduleName, const String& entryFilePath, const Array& filePaths);
+bool HHVM_FUNCTION(ijk_compile_file, const String& moduleName, const String& filePath, const String& objectPath, int64_t jobs);
+Variant HHVM_FUNCTION(ijk_compile_files, const Array& filePaths, const String& objectDir);
+int64_t HHVM_FUNCTION(ijk_run_file, const String& filePath);
 String HHVM_FUNCTION(ijk_assemble, const String& sourceFilePath);
 
 }
\ No newline at end of file
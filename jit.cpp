@@ -0,0 +1,117 @@
+#include "jit.h"
+
+#include <unistd.h>
+
+#include <memory>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/ObjectImage.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include "ijk-runtime.h"
+
+namespace HPHP {
+namespace IJK {
+
+PerfMapListener::PerfMapListener() {
+  char path[64];
+  snprintf(path, sizeof path, "/tmp/perf-%d.map", getpid());
+  m_file = fopen(path, "a");
+}
+
+PerfMapListener::~PerfMapListener() {
+  if (m_file) fclose(m_file);
+}
+
+void PerfMapListener::NotifyObjectEmitted(const llvm::ObjectImage& obj) {
+  if (!m_file) return;
+  for (auto it = obj.begin_symbols(), stop = obj.end_symbols(); it != stop; ++it) {
+    llvm::object::SymbolRef::Type type;
+    if (it->getType(type) || type != llvm::object::SymbolRef::ST_Function) continue;
+    llvm::StringRef name;
+    uint64_t addr;
+    uint64_t size;
+    if (it->getName(name) || it->getAddress(addr) || it->getSize(size)) continue;
+    fprintf(m_file, "%lx %lx %s\n", 
+            (unsigned long)addr, (unsigned long)size, name.str().c_str());
+  }
+  fflush(m_file);
+}
+
+// The extension links the runtime in, but its symbols needn't be
+// visible to dlsym(), so hand them to the JIT explicitly.
+static void register_runtime_symbols() {
+#define RUNTIME_SYMBOL(name) \
+  llvm::sys::DynamicLibrary::AddSymbol(#name, reinterpret_cast<void*>(&name))
+  RUNTIME_SYMBOL(ijk_arith);
+  RUNTIME_SYMBOL(ijk_concat_n);
+  RUNTIME_SYMBOL(ijk_concat_append);
+  RUNTIME_SYMBOL(ijk_array_iter_begin);
+  RUNTIME_SYMBOL(ijk_array_iter_advance);
+  RUNTIME_SYMBOL(ijk_array_separate);
+  RUNTIME_SYMBOL(ijk_incref);
+  RUNTIME_SYMBOL(ijk_decref);
+  RUNTIME_SYMBOL(ijk_object_alloc);
+  RUNTIME_SYMBOL(ijk_method_lookup);
+  RUNTIME_SYMBOL(ijk_object_prop);
+  RUNTIME_SYMBOL(ijk_globals_register);
+  RUNTIME_SYMBOL(ijk_global_lookup);
+  RUNTIME_SYMBOL(ijk_global_find);
+  RUNTIME_SYMBOL(ijk_generator_create);
+  RUNTIME_SYMBOL(ijk_generator_yield);
+  RUNTIME_SYMBOL(ijk_generator_finish);
+  RUNTIME_SYMBOL(ijk_object_iter_array);
+  RUNTIME_SYMBOL(ijk_wait_handle_create);
+  RUNTIME_SYMBOL(ijk_await);
+  RUNTIME_SYMBOL(ijk_vm_call);
+  RUNTIME_SYMBOL(ijk_vm_call_method);
+  RUNTIME_SYMBOL(ijk_vm_include);
+  RUNTIME_SYMBOL(ijk_vm_load);
+  RUNTIME_SYMBOL(ijk_vm_global);
+  RUNTIME_SYMBOL(ijk_fatal);
+  RUNTIME_SYMBOL(ijk_profile_write);
+#undef RUNTIME_SYMBOL
+}
+
+int64_t run_jit(llvm::Module* module) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  register_runtime_symbols();
+  
+  // Declared first so that it outlives the engine, which tells it about
+  // the objects it frees as it is destroyed.
+  PerfMapListener perfMap;
+  std::string error;
+  std::unique_ptr<llvm::ExecutionEngine> engine(
+          llvm::EngineBuilder(module)
+            .setErrorStr(&error)
+            .setUseMCJIT(true)
+            .setEngineKind(llvm::EngineKind::JIT)
+            .create());
+  if (!engine) {
+    fprintf(stderr, "ijk: can't create the JIT: %s\n", error.c_str());
+    delete module;
+    return -1;
+  }
+  
+  // MCJIT registers objects with gdb by itself.
+  engine->RegisterJITEventListener(&perfMap);
+  engine->finalizeObject();
+  
+  // Constructors bind the module's globals; destructors write profiles.
+  engine->runStaticConstructorsDestructors(false);
+  auto const main = reinterpret_cast<int64_t (*)()>(engine->getFunctionAddress("main"));
+  auto const ret = main ? main() : -1;
+  engine->runStaticConstructorsDestructors(true);
+  // Globals outlive the run and may hold the module's constant strings,
+  // so its code and data stay mapped.
+  engine->UnregisterJITEventListener(&perfMap);
+  engine.release();
+  return ret;
+}
+
+}
+}
@@ -0,0 +1,33 @@
+#ifndef IJK_JIT_H
+#define IJK_JIT_H
+
+#include <cstdio>
+
+#include "llvm/IR/Module.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Appends "<start> <size> <name>" for every function of each emitted
+// object to /tmp/perf-<pid>.map, which perf reads to symbolise JIT
+// code.
+class PerfMapListener : public llvm::JITEventListener {
+  public:
+    PerfMapListener();
+    ~PerfMapListener();
+    
+    void NotifyObjectEmitted(const llvm::ObjectImage& obj) override;
+    
+  private:
+    FILE* m_file;
+};
+
+// Compiles module in process, registers the code with GDB and perf, and
+// runs its main().  Takes ownership of module.
+int64_t run_jit(llvm::Module* module);
+
+}
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace HPHP {
+namespace IJK {
+
+static const std::string kEntrySuffix = "@entry";
+
+bool ProfileData::load(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) return false;
+  
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    uint64_t count;
+    std::string key;
+    if (!(fields >> count >> key)) continue;
+    
+    auto const eq = key.rfind('=');
+    if (eq != std::string::npos) {
+      m_types[key.substr(0, eq)][std::stoi(key.substr(eq + 1))] += count;
+      continue;
+    }
+    m_counts[key] += count;
+    if (key.size() > kEntrySuffix.size() &&
+        key.compare(key.size() - kEntrySuffix.size(), 
+                    kEntrySuffix.size(), kEntrySuffix) == 0) {
+      m_maxEntryCount = std::max(m_maxEntryCount, m_counts[key]);
+    }
+  }
+  return true;
+}
+
+uint64_t ProfileData::count(const std::string& key) const {
+  auto it = m_counts.find(key);
+  return it != m_counts.end() ? it->second : 0;
+}
+
+bool ProfileData::has(const std::string& key) const {
+  return m_counts.count(key) != 0;
+}
+
+const std::map<int, uint64_t>& ProfileData::types(const std::string& key) const {
+  static const std::map<int, uint64_t> none;
+  auto it = m_types.find(key);
+  return it != m_types.end() ? it->second : none;
+}
+
+} // namespace IJK
+} // namespace HPHP
@@ -0,0 +1,48 @@
+#ifndef IJK_PROFILE_H
+#define IJK_PROFILE_H
+
+#include <map>
+#include <string>
+#include <unordered_map>
+
+namespace HPHP {
+namespace IJK {
+
+enum class ProfileMode {
+  None,
+  Instrument, // insert counters; the module writes a profile at exit
+  Use,        // read a profile back and optimise with it
+};
+
+// Counters read back from a profile written by an instrumented module.
+// Each line of the file is "<count> <key>", where type observation
+// probes use keys of the form "<key>=<DataType>".
+class ProfileData {
+  public:
+    ProfileData() : m_maxEntryCount(0) {}
+    
+    bool load(const std::string& path);
+    bool empty() const { return m_counts.empty(); }
+    
+    uint64_t count(const std::string& key) const;
+    bool has(const std::string& key) const;
+    const std::map<int, uint64_t>& types(const std::string& key) const;
+    
+    // A function is hot when it is entered at least 1/hotRatio as often
+    // as the most frequently entered function.
+    bool isHotEntry(uint64_t count) const {
+      return m_maxEntryCount != 0 && count * kHotRatio >= m_maxEntryCount;
+    }
+    
+    static const uint64_t kHotRatio = 100;
+    
+  private:
+    std::unordered_map<std::string, uint64_t> m_counts;
+    std::unordered_map<std::string, std::map<int, uint64_t>> m_types;
+    uint64_t m_maxEntryCount;
+};
+
+} // namespace IJK
+} // namespace HPHP
+
+#endif
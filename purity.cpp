@@ -0,0 +1,186 @@
+#include "purity.h"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+
+#include "hphp/runtime/base/builtin-functions.h"
+#include "hphp/runtime/base/execution-context.h"
+#include "hphp/runtime/vm/unit.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Deterministic builtins without side effects.  Nothing here reads
+// the clock, files or random state, and nothing whose result depends
+// on ini settings such as precision (strval, implode, str_replace) or
+// on the locale (strtolower, ucfirst and the like) belongs here, nor
+// anything whose result can be far bigger than its arguments
+// (str_repeat, str_pad, range), as it is built before its size is
+// checked.
+static const std::unordered_set<std::string> s_pureBuiltins = {
+  "abs", "ceil", "floor", "round", "sqrt", "pow", "min", "max", "intdiv",
+  "intval", "floatval", "boolval",
+  "is_int", "is_float", "is_string", "is_array", "is_bool", "is_null", 
+  "is_numeric",
+  "strlen", "strrev", "substr", "strpos", "stripos", "strrpos", "trim", 
+  "ltrim", "rtrim", "explode", "ord", "chr", "md5", "sha1", "crc32", "base64_encode", 
+  "base64_decode", "bin2hex", "dechex", "hexdec", "decbin", "bindec",
+  "count", "sizeof", "in_array", "array_key_exists", "array_keys", 
+  "array_values", "array_merge", "array_flip", "array_reverse", 
+  "array_slice", "array_sum",
+};
+
+// Largest result folded into the module, in string bytes plus array
+// elements; bigger ones are cheaper to compute at run time than to
+// load.
+static const size_t kMaxFoldedSize = 4096;
+
+bool is_pure_builtin(const std::string& name) {
+  std::string lowerName(name);
+  std::transform(lowerName.begin(), lowerName.end(), lowerName.begin(), ::tolower);
+  return s_pureBuiltins.count(lowerName) != 0;
+}
+
+bool infer_purity(const Func* func) {
+  if (func->isPseudoMain() || func->preClass() || 
+      func->isGenerator() || func->isAsync()) {
+    return false;
+  }
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    if (func->byRef(i)) return false;
+  }
+  
+  auto const unit = func->unit();
+  auto       pc   = unit->at(func->base());
+  auto const stop = unit->at(func->past());
+  for (; pc != stop; pc += instrLen(reinterpret_cast<const Op*>(pc))) {
+    auto const op = *reinterpret_cast<const Op*>(pc);
+    PC imm = pc + 1;
+    switch (op) {
+      case Op::Null:
+      case Op::True:
+      case Op::False:
+      case Op::Int:
+      case Op::Double:
+      case Op::String:
+      case Op::Array:
+      case Op::CGetL:
+      case Op::SetL:
+      case Op::PopC:
+      case Op::RetC:
+      case Op::Add:
+      case Op::Sub:
+      case Op::Mul:
+      case Op::Div:
+      case Op::Mod:
+      case Op::Concat:
+      case Op::ConcatN:
+      case Op::Not:
+      case Op::Same:
+      case Op::NSame:
+      case Op::Eq:
+      case Op::Neq:
+      case Op::Lt:
+      case Op::Lte:
+      case Op::Gt:
+      case Op::Gte:
+      case Op::FPassC:
+      case Op::FPassCE:
+      case Op::FPassL:
+      case Op::FCall:
+        break;
+      case Op::Jmp:
+      case Op::JmpZ:
+      case Op::JmpNZ:
+        // Only forward jumps, so no loops.
+        if (*reinterpret_cast<const Offset*>(imm) <= 0) return false;
+        break;
+      case Op::FPushFuncD:
+        {
+          decodeVariableSizeImm(&imm);
+          auto const name = unit->lookupLitstrId(*reinterpret_cast<const Id*>(imm));
+          if (!is_pure_builtin(name->toCppString())) return false;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+// Adds the size value takes as a constant to size, and returns false if
+// it can't be a constant at all.
+static bool add_folded_size(const Variant& value, size_t& size) {
+  switch (value.getType()) {
+    case KindOfUninit:
+    case KindOfNull:
+    case KindOfBoolean:
+    case KindOfInt64:
+    case KindOfDouble:
+      return true;
+    case KindOfStaticString:
+    case KindOfString:
+      size += value.toString().size();
+      return true;
+    case KindOfArray:
+      for (ArrayIter it(value.toArray()); it; ++it) {
+        ++size;
+        if (it.first().isString()) size += it.first().toString().size();
+        if (!add_folded_size(it.second(), size)) return false;
+        if (size > kMaxFoldedSize) return false;
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool is_foldable(const Variant& value) {
+  size_t size = 0;
+  return add_folded_size(value, size) && size <= kMaxFoldedSize;
+}
+
+// Message of the last error raised in the request, or null.
+static Variant last_error_message() {
+  Variant last = vm_call_user_func("error_get_last", Array::Create());
+  if (!last.isArray()) return init_null();
+  return last.toArray()[String("message")];
+}
+
+bool evaluate_pure_call(const Func* func, const StringData* name, 
+                        const Array& args, Variant& result) {
+  // Diagnostics are silenced rather than printed at translation time.
+  // A sentinel error marks where the call starts, so that any notice or
+  // warning it raises shows up as a different last error.
+  static const StaticString s_sentinel("ijk: evaluating pure call");
+  auto const oldLevel = vm_call_user_func("error_reporting", make_packed_array(0));
+  vm_call_user_func("trigger_error", make_packed_array(s_sentinel));
+  auto restore = [&] {
+    vm_call_user_func("error_reporting", make_packed_array(oldLevel));
+  };
+  
+  Variant ret;
+  try {
+    if (func) {
+      TypedValue retval;
+      g_context->invokeFunc(&retval, func, Variant(args));
+      ret = tvAsVariant(&retval);
+      tvRefcountedDecRef(&retval);
+    } else {
+      ret = vm_call_user_func(String(name->data(), name->size(), CopyString), args);
+    }
+  } catch (...) {
+    restore();
+    return false;
+  }
+  restore();
+  if (!same(last_error_message(), Variant(s_sentinel))) return false;
+  if (!is_foldable(ret)) return false;
+  result = ret;
+  return true;
+}
+
+}
+}
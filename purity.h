@@ -0,0 +1,35 @@
+#ifndef IJK_PURITY_H
+#define IJK_PURITY_H
+
+#include <string>
+
+#include "hphp/runtime/base/base-includes.h"
+#include "hphp/runtime/vm/func.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Whether the builtin name, in any case, depends only on its arguments
+// and has no effects, so a call with constant arguments can be made
+// once at translation time.
+bool is_pure_builtin(const std::string& name);
+
+// Whether a user function is pure in the same sense: it only computes
+// on its arguments and calls pure builtins.  It also can't loop, so
+// evaluating it always terminates.
+bool infer_purity(const Func* func);
+
+// Whether value can become a constant of the module, and is small
+// enough to be worth it.
+bool is_foldable(const Variant& value);
+
+// Calls func, or the builtin name when func is null, in the VM.
+// Returns false, leaving result alone, if the call threw or raised any
+// notice or warning, or its result can't be folded.
+bool evaluate_pure_call(const Func* func, const StringData* name, 
+                        const Array& args, Variant& result);
+
+}
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "refcount.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "llvm/IR/Function.h"
+
+namespace HPHP {
+namespace IJK {
+
+const char* const kIncRefName = "ijk_incref";
+const char* const kDecRefName = "ijk_decref";
+const char* const kStaticMDName = "ijk.static";
+
+char RefcountElision::ID = 0;
+std::atomic<uint64_t> RefcountElision::s_numSeen(0);
+std::atomic<uint64_t> RefcountElision::s_numStatic(0);
+std::atomic<uint64_t> RefcountElision::s_numPaired(0);
+
+static llvm::RegisterPass<RefcountElision> 
+  registerRefcountElision("ijk-refcount-elision", "Elide redundant refcount operations");
+
+namespace {
+
+enum class RefcountOp { None, IncRef, DecRef };
+
+RefcountOp refcount_op(const llvm::Instruction& inst) {
+  auto const call = llvm::dyn_cast<llvm::CallInst>(&inst);
+  if (!call || !call->getCalledFunction()) return RefcountOp::None;
+  auto const name = call->getCalledFunction()->getName();
+  if (name == kIncRefName) return RefcountOp::IncRef;
+  if (name == kDecRefName) return RefcountOp::DecRef;
+  return RefcountOp::None;
+}
+
+llvm::Value* refcount_arg(llvm::CallInst* call) {
+  return call->getArgOperand(0)->stripPointerCasts();
+}
+
+}
+
+void RefcountElision::getAnalysisUsage(llvm::AnalysisUsage& AU) const {
+  AU.addRequired<llvm::AliasAnalysis>();
+  AU.setPreservesCFG();
+}
+
+bool RefcountElision::runOnFunction(llvm::Function& F) {
+  m_aa = &getAnalysis<llvm::AliasAnalysis>();
+  auto const staticKind = F.getContext().getMDKindID(kStaticMDName);
+  
+  bool changed = false;
+  std::vector<llvm::Instruction*> statics;
+  for (auto& BB : F) {
+    for (auto& inst : BB) {
+      if (refcount_op(inst) == RefcountOp::None) continue;
+      ++s_numSeen;
+      if (inst.getMetadata(staticKind)) statics.push_back(&inst);
+    }
+  }
+  for (auto inst : statics) {
+    inst->eraseFromParent();
+    ++s_numStatic;
+    changed = true;
+  }
+  
+  for (auto& BB : F) {
+    changed |= elideInBlock(BB);
+  }
+  return changed;
+}
+
+bool RefcountElision::elideInBlock(llvm::BasicBlock& BB) {
+  // Operations not yet paired, oldest first.
+  std::vector<llvm::CallInst*> pending;
+  std::vector<llvm::CallInst*> dead;
+  
+  for (auto& inst : BB) {
+    auto const op = refcount_op(inst);
+    if (op == RefcountOp::None) {
+      if (!inst.mayWriteToMemory()) continue;
+      if (llvm::isa<llvm::CallInst>(&inst) || llvm::isa<llvm::InvokeInst>(&inst)) {
+        // Opaque code may count, or free, anything.
+        pending.clear();
+        continue;
+      }
+      // A store into a pending value's typed_value_t changes what
+      // the operation refers to.
+      auto modifies = [&] (llvm::CallInst* call) {
+        auto const arg = refcount_arg(call);
+        auto const size = m_aa->getTypeStoreSize(
+                arg->getType()->getPointerElementType());
+        auto const mr = m_aa->getModRefInfo(&inst, llvm::AliasAnalysis::Location(arg, size));
+        return (mr & llvm::AliasAnalysis::Mod) != 0;
+      };
+      pending.erase(std::remove_if(pending.begin(), pending.end(), modifies), 
+                    pending.end());
+      continue;
+    }
+    
+    auto const call = llvm::cast<llvm::CallInst>(&inst);
+    auto const arg = refcount_arg(call);
+    auto const match = op == RefcountOp::IncRef ? RefcountOp::DecRef : RefcountOp::IncRef;
+    auto it = pending.rbegin();
+    for (; it != pending.rend(); ++it) {
+      if (refcount_op(**it) == match && refcount_arg(*it) == arg) break;
+    }
+    if (it != pending.rend()) {
+      dead.push_back(*it);
+      dead.push_back(call);
+      pending.erase(std::next(it).base());
+      continue;
+    }
+    
+    if (op == RefcountOp::DecRef) {
+      // This may free a value a pending incref refers to through
+      // another pointer; a pending decref only keeps counts higher.
+      pending.erase(std::remove_if(pending.begin(), pending.end(), [] (llvm::CallInst* c) {
+        return refcount_op(*c) == RefcountOp::IncRef;
+      }), pending.end());
+    }
+    pending.push_back(call);
+  }
+  
+  for (auto call : dead) {
+    call->eraseFromParent();
+  }
+  s_numPaired += dead.size();
+  return !dead.empty();
+}
+
+}
+}
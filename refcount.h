@@ -0,0 +1,51 @@
+#ifndef IJK_REFCOUNT_H
+#define IJK_REFCOUNT_H
+
+#include <atomic>
+
+#include "llvm/Pass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/IR/Instructions.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Names of the runtime calls the translator emits for reference
+// counting, implemented in ijk-runtime.c.
+extern const char* const kIncRefName;
+extern const char* const kDecRefName;
+// Metadata kind attached by the translator to a refcount operation on
+// a value it knows to be static.
+extern const char* const kStaticMDName;
+
+// Removes refcount operations that can't have any effect:
+// - operations on static values, which are never counted, and
+// - an incref and a decref of the same value within a basic block with
+//   nothing in between that could free it or change what it points to.
+class RefcountElision : public llvm::FunctionPass {
+  public:
+    static char ID;
+    RefcountElision() : llvm::FunctionPass(ID) {}
+    
+    bool runOnFunction(llvm::Function& F) override;
+    void getAnalysisUsage(llvm::AnalysisUsage& AU) const override;
+    
+    // Totals over every function run through the pass, on any thread.
+    static uint64_t numSeen() { return s_numSeen; }
+    static uint64_t numStatic() { return s_numStatic; }
+    static uint64_t numPaired() { return s_numPaired; }
+    
+  private:
+    bool elideInBlock(llvm::BasicBlock& BB);
+    
+    llvm::AliasAnalysis* m_aa;
+    
+    static std::atomic<uint64_t> s_numSeen;
+    static std::atomic<uint64_t> s_numStatic;
+    static std::atomic<uint64_t> s_numPaired;
+};
+
+}
+}
+
+#endif
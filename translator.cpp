@@ -1,6 +1,17 @@
 #include "ijk.h"
+#include "codegen.h"
+#include "jit.h"
+#include "vm-bridge.h"
 #include "hphp/util/match.h"
 
+#include <limits.h>
+#include <stdlib.h>
+
+#include <set>
+
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
 namespace HPHP {
 namespace IJK {
 
@@ -8,8 +19,110 @@ namespace IJK {
 template<class T> using min_priority_queue =
   std::priority_queue<T,std::vector<T>,std::greater<T>>;
 
-FuncInfo find_func_info(const Func* func) {
-  auto finfo = FuncInfo(func->unit(), func);
+template<class T> T decode(PC& pc) {
+  auto const ret = *reinterpret_cast<const T*>(pc);
+  pc += sizeof ret;
+  return ret;
+}
+
+// Decode an iterator table immediate (ILA), as used by IterBreak.
+std::vector<std::pair<IterKind,Id>> decode_itertab(PC& pc) {
+  auto const vecLen = decode<int32_t>(pc);
+  std::vector<std::pair<IterKind,Id>> ret;
+  for (auto i = int32_t{0}; i < vecLen; ++i) {
+    auto const kind = static_cast<IterKind>(decode<int32_t>(pc));
+    auto const id   = decode<int32_t>(pc);
+    ret.emplace_back(kind, id);
+  }
+  return ret;
+}
+
+// The path with symlinks and dots resolved, or "" if there's no such file.
+static std::string canonical_path(const std::string& path) {
+  char buf[PATH_MAX];
+  return realpath(path.c_str(), buf) ? std::string(buf) : std::string();
+}
+
+// PHP class and method names are case insensitive.
+std::string lower_name(const StringData* name) {
+  std::string str = name->toCppString();
+  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+  return str;
+}
+
+// Builtins insertInstructionMathBuiltin() lowers, with the arity it
+// handles; other arities go through the VM as usual.
+static const std::map<std::string, std::pair<MathBuiltin, uint32_t>> s_mathBuiltins = {
+  {"sqrt",  {MathBuiltin::Sqrt,  1}},
+  {"floor", {MathBuiltin::Floor, 1}},
+  {"ceil",  {MathBuiltin::Ceil,  1}},
+  {"round", {MathBuiltin::Round, 1}},
+  {"abs",   {MathBuiltin::Abs,   1}},
+  {"min",   {MathBuiltin::Min,   2}},
+  {"max",   {MathBuiltin::Max,   2}},
+  {"pow",   {MathBuiltin::Pow,   2}},
+};
+
+// Whether the default value funclets from parameter paramId on run
+// straight through to the jump back to the body, so that
+// Translator::appendDVEntry() can run them ahead of a call.
+static bool is_straight_line_funclet(const Func* func, uint32_t paramId) {
+  auto const unit   = func->unit();
+  auto const bcBase = reinterpret_cast<const Op*>(unit->at(0));
+  auto       pc     = unit->at(func->params()[paramId].funcletOff());
+  auto const stop   = unit->at(func->past());
+  for (; pc != stop; pc += instrLen(reinterpret_cast<const Op*>(pc))) {
+    auto const op = *reinterpret_cast<const Op*>(pc);
+    if (op == Op::Jmp || op == Op::JmpNS) return true;
+    if (isSwitch(op) || op == Op::RetC || op == Op::RetV || 
+        op == Op::Throw || op == Op::Unwind ||
+        instrJumpTarget(bcBase, unit->offsetOf(pc)) != InvalidAbsoluteOffset) {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Where the default value funclets start: they follow the body, which
+// only reaches them through a DV entry.
+static Offset funclets_base(const Func* func) {
+  auto base = func->past();
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    if (func->params()[i].hasDefaultValue()) {
+      base = std::min(base, func->params()[i].funcletOff());
+    }
+  }
+  return base;
+}
+
+// A member vector naming a single property of $this, a local or a
+// cell: the only shape CGetM and SetM are translated for.
+struct PropMember {
+  LocationCode lcode;
+  int64_t baseLocal;
+  const StringData* propName;
+};
+
+bool decode_prop_member(PC& pc, const Unit* unit, PropMember& member) {
+  auto const immVec = ImmVector::createFromStream(pc);
+  pc += immVec.size() + sizeof(int32_t) + sizeof(int32_t);
+  auto vec = immVec.vec();
+  member.lcode = static_cast<LocationCode>(*vec++);
+  member.baseLocal = -1;
+  if (numLocationCodeImms(member.lcode)) {
+    member.baseLocal = decodeVariableSizeImm(&vec);
+  }
+  auto const mcode = static_cast<MemberCode>(*vec++);
+  member.propName = nullptr;
+  if (mcode == MPT) {
+    member.propName = unit->lookupLitstrId(decodeMemberCodeImm(&vec, mcode));
+  }
+  return member.propName && vec == pc && 
+         (member.lcode == LH || member.lcode == LL || member.lcode == LC);
+}
+
+FuncInfo find_func_info(Arena& arena, const Func* func) {
+  auto finfo = FuncInfo(arena, func->unit(), func);
 
   auto label_num = uint32_t{0};
   auto gen_label = [&] (const char* kind) {
@@ -77,58 +190,129 @@ FuncInfo find_func_info(const Func* func) {
     }
   };
 
+  auto find_iter_tables = [&] {
+    auto it           = func->unit()->at(func->base());
+    auto const stop   = func->unit()->at(func->past());
+
+    for (; it != stop; it += instrLen(reinterpret_cast<const Op*>(it))) {
+      auto pc = it;
+      auto const op = *reinterpret_cast<const Op*>(pc);
+      ++pc;
+      switch (op) {
+        case Op::IterInit:
+        case Op::IterInitK:
+        case Op::IterNext:
+        case Op::IterNextK:
+        case Op::IterFree:
+          finfo.iterKinds[decodeVariableSizeImm(&pc)] = KindOfIter;
+          break;
+        case Op::MIterInit:
+        case Op::MIterInitK:
+        case Op::MIterNext:
+        case Op::MIterNextK:
+        case Op::MIterFree:
+          finfo.iterKinds[decodeVariableSizeImm(&pc)] = KindOfMIter;
+          break;
+        case Op::CIterFree:
+          finfo.iterKinds[decodeVariableSizeImm(&pc)] = KindOfCIter;
+          break;
+        case Op::IterBreak:
+          for (auto& kv : decode_itertab(pc)) {
+            finfo.iterKinds[kv.second] = kv.first;
+          }
+          break;
+        default:
+          break;
+      }
+    }
+  };
+
   find_jump_targets();
   find_eh_entries();
   find_dv_entries();
+  find_iter_tables();
   return finfo;
 }
 
 //////////////////////////////////////////////////////////////////////
 
-template<class T> T decode(PC& pc) {
-  auto const ret = *reinterpret_cast<const T*>(pc);
-  pc += sizeof ret;
-  return ret;
-}
-
-llvm::Function* Translator::generateFunction(const FuncInfo& finfo) {
-  m_currentFunctionArguments.clear();
-  
-  auto const func = finfo.func;
+llvm::FunctionType* Translator::generateFunctionType(const Func* func) {
   llvm::Type*               resultType = llvm::Type::getVoidTy(m_ctx);
   std::vector<llvm::Type*>  paramTypes;
   paramTypes.push_back(m_typedValue->getPointerTo()); // for return value
+  if (func->preClass() && !func->isStatic()) {
+    paramTypes.push_back(m_objectData->getPointerTo()); // for $this
+  }
   for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
     paramTypes.push_back(m_typedValue->getPointerTo());
   }
-          
-  std::string functionName = func->name()->data();
-  llvm::FunctionType* functionType = llvm::FunctionType::get(
-          resultType, paramTypes, false);
+  return llvm::FunctionType::get(resultType, paramTypes, false);
+}
+
+std::string Translator::functionName(const Func* func) {
+  if (func->preClass()) {
+    return folly::format("{}::{}", 
+                         func->preClass()->name()->data(), 
+                         func->name()->data()).str();
+  }
+  return func->name()->data();
+}
+
+llvm::Function* Translator::declareFunction(const Func* func) {
+  return llvm::cast<llvm::Function>(m_mod->getOrInsertFunction(
+          functionName(func), generateFunctionType(func)));
+}
+
+llvm::Function* Translator::generateFunction(const FuncInfo& finfo) {
+  m_currentFunctionArguments.clear();
+  
+  auto const func = finfo.func;
+  std::string functionName = this->functionName(func);
 //  llvm::Function* function = llvm::Function::Create(
 //          functionType, llvm::Function::ExternalLinkage, functionName, m_mod);
-  llvm::Function* function = llvm::cast<llvm::Function>(m_mod->getOrInsertFunction(functionName, functionType));
+  llvm::Function* function = declareFunction(func);
+  
+  auto const hasThis = func->preClass() && !func->isStatic();
+  m_firstParamArgument = hasThis ? 2 : 1;
+  m_currentThis = nullptr;
   
-  int paramSize = paramTypes.size();
   llvm::Function::arg_iterator ai = function->arg_begin();
-  for(
-          int i = 0;
-          i < paramSize && ai != function->arg_end();
-          i++, ai++)
-  {
+  for(int i = 0; ai != function->arg_end(); i++, ai++) {
     m_currentFunctionArguments.push_back(ai);
     if (i == 0) {
       ai->setName("retval");
+      addArgumentAttributes(ai, false);
+    } else if (hasThis && i == 1) {
+      ai->setName("this");
+      ai->addAttr(llvm::AttributeSet::get(m_ctx, ai->getArgNo() + 1, 
+                                          llvm::Attribute::NonNull));
+      m_currentThis = ai;
     } else {
-      ai->setName(loc_name(finfo, i-1));
+      ai->setName(loc_name(finfo, i - m_firstParamArgument));
+      addArgumentAttributes(ai, true);
     }
   }
   
   m_functions[functionName] = function;
-  
   return function;
 }
 
+void Translator::addArgumentAttributes(llvm::Argument* arg, bool readOnly) {
+  // The caller always passes a fresh typed_value_t for the return value,
+  // and parameters are copied into locals on entry, so neither escapes
+  // nor aliases anything the callee can reach another way.
+  llvm::DataLayout dataLayout(m_mod);
+  llvm::AttrBuilder attrs;
+  attrs.addAttribute(llvm::Attribute::NoAlias);
+  attrs.addAttribute(llvm::Attribute::NoCapture);
+  attrs.addAttribute(llvm::Attribute::NonNull);
+  attrs.addDereferenceableAttr(dataLayout.getTypeAllocSize(m_typedValue));
+  if (readOnly) {
+    attrs.addAttribute(llvm::Attribute::ReadOnly);
+  }
+  arg->addAttr(llvm::AttributeSet::get(m_ctx, arg->getArgNo() + 1, attrs));
+}
+
 std::string Translator::loc_name(const FuncInfo& finfo, uint32_t id) {
   auto const sd = finfo.func->localVarName(id);
   if (!sd || sd->empty()) {
@@ -143,13 +327,590 @@ std::string jmp_label(const FuncInfo& finfo, Offset tgt) {
   return it->second;
 };
 
+llvm::BasicBlock* Translator::getBlock(const FuncInfo& finfo, Offset off) {
+  auto it = m_blocks.find(off);
+  if (it != end(m_blocks)) return it->second;
+  llvm::BasicBlock* block = llvm::BasicBlock::Create(
+          m_ctx, jmp_label(finfo, off), m_currentFunction);
+  m_blocks[off] = block;
+  return block;
+}
+
+llvm::Value* Translator::createEntryAlloca(llvm::Type* type, const llvm::Twine& name) {
+  // Keep every alloca in the entry block so that loops don't grow the
+  // native stack and mem2reg can promote them.
+  llvm::BasicBlock& entry = m_currentFunction->getEntryBlock();
+  llvm::IRBuilder<> builder(&entry, entry.begin());
+  return builder.CreateAlloca(type, nullptr, name);
+}
+
+void Translator::allocLocals(const FuncInfo& finfo) {
+  auto const func = finfo.func;
+  // A DV entry lacks the trailing parameters its funclets initialise,
+  // and leaves the type probes to the full function it calls.
+  auto const isDVEntry = !m_currentFunctionIsPseudoMain &&
+          m_currentFunctionArguments.size() < m_firstParamArgument + func->numParams();
+  m_locals.clear();
+  m_localStorage.clear();
+  for (auto i = uint32_t{0}; i < func->numLocals(); ++i) {
+    // Each local is a pointer to its storage so that by-reference
+    // foreach can rebind it to an array element.
+    llvm::Value* local_pp = createEntryAlloca(
+            m_typedValue->getPointerTo(), "local_pp");
+    auto const name = func->localVarName(i);
+    if (m_currentFunctionIsPseudoMain && name && !name->empty()) {
+      // Names at the top level are the global variables themselves.
+      m_builder->CreateStore(insertInstructionLoadGlobalSlot(name->toCppString()), local_pp);
+      m_locals.push_back(local_pp);
+      m_localStorage.push_back(nullptr);
+      m_globalLocals.insert(i);
+      continue;
+    }
+    llvm::Value* local_p = createTypedValueNull();
+    if (!m_currentFunctionIsPseudoMain && i < func->numParams() &&
+        i + m_firstParamArgument < m_currentFunctionArguments.size()) {
+      llvm::Value* arg_p = m_currentFunctionArguments[i + m_firstParamArgument];
+      llvm::Value* arg_type_p = m_builder->CreateStructGEP(arg_p, 0);
+      if (!isDVEntry) {
+        insertInstructionTypeProbe(paramProbeKey(i), m_builder->CreateLoad(arg_type_p));
+      }
+      insertInstructionCopyTypedValue(local_p, arg_p);
+      // A parameter the caller left out arrives as Uninit.
+      llvm::Value* type_p = m_builder->CreateStructGEP(local_p, 0);
+      llvm::Value* type = m_builder->CreateLoad(type_p);
+      llvm::Type* int8Ty = llvm::Type::getInt8Ty(m_ctx);
+      m_builder->CreateStore(m_builder->CreateSelect(
+              m_builder->CreateICmpEQ(type, llvm::ConstantInt::get(int8Ty, KindOfUninit)),
+              llvm::ConstantInt::get(int8Ty, KindOfNull), type), type_p);
+    }
+    m_builder->CreateStore(local_p, local_pp);
+    m_locals.push_back(local_pp);
+    m_localStorage.push_back(local_p);
+  }
+}
+
+void Translator::allocIters(const FuncInfo& finfo) {
+  m_iters.clear();
+  m_iters.resize(finfo.func->numIterators());
+  for (auto& kv : finfo.iterKinds) {
+    IterSlots& iter = m_iters[kv.first];
+    iter.arr_p  = createEntryAlloca(m_arrayData->getPointerTo(), "iter_arr_p");
+    iter.pos_p  = createEntryAlloca(llvm::Type::getInt64Ty(m_ctx), "iter_pos_p");
+    iter.end_p  = createEntryAlloca(llvm::Type::getInt64Ty(m_ctx), "iter_end_p");
+    iter.kind_p = createEntryAlloca(llvm::Type::getInt8Ty(m_ctx), "iter_kind_p");
+  }
+}
+
+std::string Translator::probeKey(const char* what) {
+  return folly::format("{}@{}:{}", m_currentFunctionName, m_currentOffset, what).str();
+}
+
+std::string Translator::paramProbeKey(uint32_t paramId) {
+  return folly::format("{}@param{}", m_currentFunctionName, paramId).str();
+}
+
+llvm::GlobalVariable* Translator::getProbe(const std::string& key, unsigned width) {
+  auto it = m_probes.find(key);
+  if (it != end(m_probes)) return it->second;
+  llvm::ArrayType* type = llvm::ArrayType::get(llvm::Type::getInt64Ty(m_ctx), width);
+  llvm::GlobalVariable* probe = new llvm::GlobalVariable(
+          *m_mod, type, false,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantAggregateZero::get(type),
+          "ijk_probe");
+  m_probes[key] = probe;
+  return probe;
+}
+
+void Translator::createProfiledCondBr(
+  llvm::Value* cond, 
+  llvm::BasicBlock* trueBlock,
+  llvm::BasicBlock* falseBlock, 
+  const std::string& key) 
+{
+  auto const trueKey = key + ":true";
+  auto const falseKey = key + ":false";
+  
+  switch (m_profileMode) {
+    case ProfileMode::None:
+      m_builder->CreateCondBr(cond, trueBlock, falseBlock);
+      break;
+    case ProfileMode::Instrument:
+      {
+        // Count each edge on a block of its own.
+        llvm::BasicBlock* current = m_builder->GetInsertBlock();
+        auto edge = [&] (llvm::BasicBlock* target, const std::string& edgeKey) {
+          llvm::BasicBlock* block = llvm::BasicBlock::Create(m_ctx, "prof_edge", m_currentFunction);
+          m_builder->SetInsertPoint(block);
+          insertInstructionProbe(edgeKey);
+          m_builder->CreateBr(target);
+          return block;
+        };
+        llvm::BasicBlock* trueEdge = edge(trueBlock, trueKey);
+        llvm::BasicBlock* falseEdge = edge(falseBlock, falseKey);
+        m_builder->SetInsertPoint(current);
+        m_builder->CreateCondBr(cond, trueEdge, falseEdge);
+      }
+      break;
+    case ProfileMode::Use:
+      {
+        llvm::BranchInst* br = m_builder->CreateCondBr(cond, trueBlock, falseBlock);
+        if (!m_profile.has(trueKey) && !m_profile.has(falseKey)) break;
+        // Branch weights are 32 bit, and an edge never seen must still
+        // be possible.
+        auto weight = [&] (const std::string& edgeKey) {
+          return uint32_t(std::min<uint64_t>(m_profile.count(edgeKey), 
+                                             UINT32_MAX - 1) + 1);
+        };
+        llvm::MDBuilder mdBuilder(m_ctx);
+        br->setMetadata(llvm::LLVMContext::MD_prof, 
+                        mdBuilder.createBranchWeights(weight(trueKey), 
+                                                      weight(falseKey)));
+      }
+      break;
+  }
+}
+
+void Translator::specialiseParams(const FuncInfo& finfo, llvm::Function* function) {
+  if (m_profileMode != ProfileMode::Use || m_profile.empty()) return;
+  if (!m_profile.isHotEntry(m_profile.count(m_currentFunctionName + "@entry"))) return;
+  
+  // Parameters that only ever saw one type.
+  std::vector<std::pair<llvm::Argument*, llvm::Constant*>> hints;
+  llvm::Function::arg_iterator ai = function->arg_begin();
+  std::advance(ai, m_firstParamArgument);
+  for (auto i = uint32_t{0}; i < finfo.func->numParams(); ++i, ++ai) {
+    auto& types = m_profile.types(paramProbeKey(i));
+    if (types.size() != 1) continue;
+    hints.emplace_back(ai, llvm::ConstantInt::get(
+            llvm::Type::getInt8Ty(m_ctx), types.begin()->first));
+  }
+  if (hints.empty()) return;
+  
+  // The clone reads each hinted type tag as a constant, so that the
+  // type checks on those parameters' locals fold away.
+  llvm::ValueToValueMapTy vmap;
+  llvm::Function* clone = llvm::CloneFunction(function, vmap, false);
+  clone->setName(function->getName() + "$hinted");
+  clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+  m_mod->getFunctionList().push_back(clone);
+  for (auto& hint : hints) {
+    llvm::Value* arg = vmap[hint.first];
+    std::vector<llvm::LoadInst*> tagLoads;
+    for (auto user : arg->users()) {
+      auto const gep = llvm::dyn_cast<llvm::GetElementPtrInst>(user);
+      if (!gep || gep->getNumIndices() != 2) continue;
+      auto const field = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(2));
+      if (!field || !field->isZero()) continue;
+      for (auto gepUser : gep->users()) {
+        if (auto load = llvm::dyn_cast<llvm::LoadInst>(gepUser)) tagLoads.push_back(load);
+      }
+    }
+    for (auto load : tagLoads) {
+      load->replaceAllUsesWith(hint.second);
+      load->eraseFromParent();
+    }
+  }
+  
+  // The original checks the tags after its allocas and tail calls the
+  // clone when they all match.
+  llvm::BasicBlock& entry = function->getEntryBlock();
+  llvm::BasicBlock::iterator it = entry.begin();
+  while (llvm::isa<llvm::AllocaInst>(it)) ++it;
+  llvm::BasicBlock* genericBlock = entry.splitBasicBlock(it, "param_generic");
+  llvm::BasicBlock* hintedBlock = llvm::BasicBlock::Create(
+          m_ctx, "param_hinted", function, genericBlock);
+  entry.getTerminator()->eraseFromParent();
+  
+  m_builder->SetInsertPoint(&entry);
+  llvm::Value* isHinted = m_builder->getTrue();
+  for (auto& hint : hints) {
+    llvm::Value* type = m_builder->CreateLoad(m_builder->CreateStructGEP(hint.first, 0));
+    isHinted = m_builder->CreateAnd(isHinted, m_builder->CreateICmpEQ(type, hint.second));
+  }
+  llvm::BranchInst* br = m_builder->CreateCondBr(isHinted, hintedBlock, genericBlock);
+  llvm::MDBuilder mdBuilder(m_ctx);
+  br->setMetadata(llvm::LLVMContext::MD_prof, 
+                  mdBuilder.createBranchWeights(ProfileData::kHotRatio, 1));
+  
+  m_builder->SetInsertPoint(hintedBlock);
+  std::vector<llvm::Value*> args;
+  for (ai = function->arg_begin(); ai != function->arg_end(); ++ai) args.push_back(ai);
+  m_builder->CreateCall(clone, args)->setTailCall();
+  m_builder->CreateRetVoid();
+}
+
+void Translator::applyProfile(llvm::Function* function) {
+  if (m_profileMode != ProfileMode::Use || m_profile.empty()) return;
+  
+  auto const entryCount = m_profile.count(m_currentFunctionName + "@entry");
+  if (entryCount == 0) {
+    function->addFnAttr(llvm::Attribute::Cold);
+    function->addFnAttr(llvm::Attribute::OptimizeForSize);
+    return;
+  }
+  if (m_profile.isHotEntry(entryCount)) {
+    function->addFnAttr(llvm::Attribute::InlineHint);
+  }
+  
+  // Move blocks the profile never reached out of the hot path.
+  for (auto& kv : m_blockProbeKeys) {
+    if (m_profile.count(kv.second) == 0) {
+      kv.first->moveAfter(&function->back());
+    }
+  }
+}
+
+void Translator::emitProfileWriter() {
+  // Mirrors ijk_probe in ijk-runtime.h.
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  llvm::StructType* probeType = llvm::StructType::create(m_ctx, "ijk_probe");
+  std::vector<llvm::Type*> probeElems;
+  probeElems.push_back(llvm::Type::getInt8Ty(m_ctx)->getPointerTo());
+  probeElems.push_back(int64Ty->getPointerTo());
+  probeElems.push_back(int64Ty);
+  probeType->setBody(probeElems);
+  
+  llvm::Constant* zero = llvm::ConstantInt::get(int64Ty, 0);
+  llvm::Constant* indices[] = { zero, zero };
+  std::vector<llvm::Constant*> probes;
+  for (auto& kv : m_probes) {
+    std::vector<llvm::Constant*> fields;
+    fields.push_back(createConstantCString(kv.first));
+    fields.push_back(llvm::ConstantExpr::getGetElementPtr(kv.second, indices));
+    fields.push_back(llvm::ConstantInt::get(int64Ty, 
+            kv.second->getType()->getElementType()->getArrayNumElements()));
+    probes.push_back(llvm::ConstantStruct::get(probeType, fields));
+  }
+  llvm::ArrayType* tableType = llvm::ArrayType::get(probeType, probes.size());
+  llvm::GlobalVariable* table = new llvm::GlobalVariable(
+          *m_mod, tableType, true,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantArray::get(tableType, probes),
+          "ijk_probes");
+  
+  std::vector<llvm::Type*> writeParams;
+  writeParams.push_back(llvm::Type::getInt8Ty(m_ctx)->getPointerTo());
+  writeParams.push_back(probeType->getPointerTo());
+  writeParams.push_back(int64Ty);
+  llvm::Function* write = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), writeParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_profile_write", 
+          m_mod);
+  
+  // Write the profile when the translated program exits.
+  llvm::Function* writer = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), false),
+          llvm::Function::InternalLinkage, 
+          "ijk_profile_writer", 
+          m_mod);
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(m_ctx, "entry", writer));
+  builder.CreateCall3(write, 
+                      createConstantCString(m_profilePath),
+                      llvm::ConstantExpr::getGetElementPtr(table, indices),
+                      llvm::ConstantInt::get(int64Ty, probes.size()));
+  builder.CreateRetVoid();
+  llvm::appendToGlobalDtors(*m_mod, writer, 0);
+}
+
+llvm::Function* Translator::getDispatchThunk(const Func* func) {
+  auto it = m_dispatchThunks.find(func);
+  if (it != end(m_dispatchThunks)) return it->second;
+  
+  // Adapts the dispatch convention used by vtables and inline caches,
+  // (retval, this, numArgs, args), to the method's own signature.
+  llvm::Function* target = declareFunction(func);
+  llvm::Function* thunk = llvm::Function::Create(
+          m_dispatchFunctionType, 
+          llvm::Function::InternalLinkage, 
+          functionName(func) + "$dispatch", 
+          m_mod);
+  m_dispatchThunks[func] = thunk;
+  
+  llvm::Function::arg_iterator ai = thunk->arg_begin();
+  llvm::Value* retval_p = ai++;
+  llvm::Value* this_p = ai++;
+  llvm::Value* numArgs = ai++;
+  llvm::Value* args_p = ai++;
+  retval_p->setName("retval");
+  this_p->setName("this");
+  numArgs->setName("numArgs");
+  args_p->setName("args");
+  
+  llvm::Function* savedFunction = m_currentFunction;
+  llvm::IRBuilderBase::InsertPoint savedIP = m_builder->saveIP();
+  llvm::DebugLoc savedLoc = m_builder->getCurrentDebugLocation();
+  m_currentFunction = thunk;
+  m_builder->SetInsertPoint(llvm::BasicBlock::Create(m_ctx, "entry", thunk));
+  m_builder->SetCurrentDebugLocation(llvm::DebugLoc());
+  
+  auto& entries = declareDVEntries(func);
+  if (!entries.empty()) {
+    // Calls leaving out defaulted parameters go to their entry.
+    llvm::BasicBlock* fullBlock = llvm::BasicBlock::Create(m_ctx, "full", thunk);
+    llvm::SwitchInst* dispatch = m_builder->CreateSwitch(numArgs, fullBlock, entries.size());
+    for (auto& kv : entries) {
+      llvm::BasicBlock* arityBlock = llvm::BasicBlock::Create(m_ctx, "arity", thunk);
+      dispatch->addCase(
+              llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), kv.first), 
+              arityBlock);
+      m_builder->SetInsertPoint(arityBlock);
+      std::vector<llvm::Value*> params;
+      params.push_back(retval_p);
+      if (func->preClass() && !func->isStatic()) {
+        params.push_back(this_p);
+      }
+      for (auto i = uint32_t{0}; i < kv.first; ++i) {
+        params.push_back(m_builder->CreateLoad(m_builder->CreateConstGEP1_64(args_p, i)));
+      }
+      m_builder->CreateCall(kv.second, params);
+      m_builder->CreateRetVoid();
+    }
+    m_builder->SetInsertPoint(fullBlock);
+  }
+  
+  std::vector<llvm::Value*> params;
+  params.push_back(retval_p);
+  if (func->preClass() && !func->isStatic()) {
+    params.push_back(this_p);
+  }
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    // Parameters the caller didn't pass are Uninit, as with FCall.
+    llvm::Value* uninit_p = createTypedValueUninit();
+    llvm::Constant* index = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), i);
+    llvm::Value* passed = m_builder->CreateICmpULT(index, numArgs);
+    llvm::BasicBlock* currentBlock = m_builder->GetInsertBlock();
+    llvm::BasicBlock* argBlock = llvm::BasicBlock::Create(m_ctx, "arg", thunk);
+    llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "arg_join", thunk);
+    m_builder->CreateCondBr(passed, argBlock, joinBlock);
+    
+    m_builder->SetInsertPoint(argBlock);
+    llvm::Value* arg_p = m_builder->CreateLoad(m_builder->CreateGEP(args_p, index));
+    m_builder->CreateBr(joinBlock);
+    
+    m_builder->SetInsertPoint(joinBlock);
+    llvm::PHINode* phi = m_builder->CreatePHI(m_typedValue->getPointerTo(), 2);
+    phi->addIncoming(arg_p, argBlock);
+    phi->addIncoming(uninit_p, currentBlock);
+    params.push_back(phi);
+  }
+  m_builder->CreateCall(target, params);
+  m_builder->CreateRetVoid();
+  annotateTBAA(thunk);
+  
+  m_currentFunction = savedFunction;
+  m_builder->restoreIP(savedIP);
+  m_builder->SetCurrentDebugLocation(savedLoc);
+  return thunk;
+}
+
+const ClassInfo* Translator::findClass(const StringData* className) {
+  auto it = m_classes.find(lower_name(className));
+  return it != end(m_classes) ? &it->second : nullptr;
+}
+
+const PreClass* Translator::findPreClass(const StringData* name, const Unit* unit, 
+                                         const Unit** owner) {
+  // The unit's own classes come first, then those of the rest of the
+  // program when it is translated as a whole.
+  std::vector<const Unit*> scope(1, unit);
+  scope.insert(scope.end(), m_programUnits.begin(), m_programUnits.end());
+  for (auto u : scope) {
+    for (auto& pcls : u->preclasses()) {
+      if (!pcls->name()->isame(name)) continue;
+      *owner = u;
+      return pcls.get();
+    }
+  }
+  return nullptr;
+}
+
+const ClassInfo* Translator::defineClass(const PreClass* preClass, const Unit* unit) {
+  auto const key = lower_name(preClass->name());
+  auto it = m_classes.find(key);
+  if (it != end(m_classes)) return &it->second;
+  
+  // Interfaces have no objects, and traits are flattened into the
+  // classes that use them below.
+  if (preClass->attrs() & (AttrInterface | AttrTrait)) return nullptr;
+  
+  std::vector<const PreClass*> traits;
+  if (!preClass->traitPrecRules().empty() || !preClass->traitAliasRules().empty()) {
+    printf("unsupported: class %s resolves trait conflicts\n", preClass->name()->data());
+    return nullptr;
+  }
+  for (auto& traitName : preClass->usedTraits()) {
+    const Unit* owner;
+    auto const trait = findPreClass(traitName, unit, &owner);
+    if (!trait || !trait->usedTraits().empty()) {
+      printf("unsupported: trait %s of class %s is not in the unit or uses traits\n", 
+             traitName->data(), preClass->name()->data());
+      return nullptr;
+    }
+    traits.push_back(trait);
+  }
+  
+  const ClassInfo* parent = nullptr;
+  if (!preClass->parent()->empty()) {
+    // The parent has to come from the same unit, or one of the
+    // program's, for the layout to be known statically.
+    parent = findClass(preClass->parent());
+    const Unit* owner;
+    if (!parent) {
+      if (auto const pcls = findPreClass(preClass->parent(), unit, &owner)) {
+        parent = defineClass(pcls, owner);
+      }
+    }
+    if (!parent) {
+      printf("unsupported: parent %s of class %s is not in the unit\n", 
+             preClass->parent()->data(), preClass->name()->data());
+      return nullptr;
+    }
+  }
+  
+  ClassInfo& cls = m_classes[key];
+  cls.preClass = preClass;
+  cls.parent = parent;
+  if (parent) {
+    cls.props = parent->props;
+    cls.propIndex = parent->propIndex;
+    cls.methods = parent->methods;
+    cls.vtable = parent->vtable;
+    cls.vtableSlots = parent->vtableSlots;
+  }
+  
+  auto addProps = [&] (const PreClass* from) {
+    for (auto i = size_t{0}; i < from->numProperties(); ++i) {
+      auto const prop = &from->properties()[i];
+      if (prop->attrs() & AttrStatic) continue;
+      auto const name = prop->name()->toCppString();
+      // A redeclared property keeps its parent's slot.
+      if (cls.propIndex.count(name)) continue;
+      cls.propIndex[name] = cls.props.size();
+      cls.props.push_back(prop);
+    }
+  };
+  auto addMethods = [&] (const PreClass* from) {
+    for (auto i = size_t{0}; i < from->numMethods(); ++i) {
+      const Func* method = from->methods()[i];
+      // Abstract methods have no body; calls on them go through the
+      // method table of the receiver's class.
+      if (method->attrs() & AttrAbstract) continue;
+      auto const name = lower_name(method->name());
+      cls.methods[name] = method;
+      if (method->attrs() & AttrPrivate) continue;
+      auto slot = cls.vtableSlots.find(name);
+      if (slot != end(cls.vtableSlots)) {
+        cls.vtable[slot->second] = method;
+      } else if (!(method->attrs() & AttrFinal) && !method->isStatic()) {
+        cls.vtableSlots[name] = cls.vtable.size();
+        cls.vtable.push_back(method);
+      }
+    }
+  };
+  
+  // Trait members are copied in as if the class declared them, and its
+  // own methods override theirs.
+  addProps(preClass);
+  for (auto trait : traits) addProps(trait);
+  for (auto trait : traits) addMethods(trait);
+  addMethods(preClass);
+  
+  std::vector<llvm::Type*> elems;
+  elems.push_back(m_objectData);
+  for (auto i = size_t{0}; i < cls.props.size(); ++i) {
+    elems.push_back(m_typedValue);
+  }
+  cls.objectType = llvm::StructType::create(
+          m_ctx, elems, std::string("obj.") + preClass->name()->data());
+  // The initializer is filled in by emitClassGlobal() once every class
+  // it may refer to exists.
+  cls.classGlobal = new llvm::GlobalVariable(
+          *m_mod, m_class, true,
+          llvm::GlobalValue::InternalLinkage, nullptr,
+          std::string("class.") + preClass->name()->data());
+  return &cls;
+}
+
+void Translator::emitClassGlobal(ClassInfo& cls) {
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  llvm::Constant* zero = llvm::ConstantInt::get(int64Ty, 0);
+  llvm::Constant* indices[] = { zero, zero };
+  auto globalArray = [&] (llvm::Type* elemType, 
+                          const std::vector<llvm::Constant*>& values) -> llvm::Constant* {
+    if (values.empty()) {
+      return llvm::ConstantPointerNull::get(elemType->getPointerTo());
+    }
+    llvm::ArrayType* type = llvm::ArrayType::get(elemType, values.size());
+    llvm::GlobalVariable* global = new llvm::GlobalVariable(
+            *m_mod, type, true,
+            llvm::GlobalValue::InternalLinkage, 
+            llvm::ConstantArray::get(type, values));
+    return llvm::ConstantExpr::getGetElementPtr(global, indices);
+  };
+  
+  std::vector<llvm::Constant*> vtable;
+  for (auto method : cls.vtable) {
+    vtable.push_back(llvm::ConstantExpr::getBitCast(getDispatchThunk(method), int8PtrTy));
+  }
+  
+  std::vector<llvm::Constant*> methods;
+  for (auto& kv : cls.methods) {
+    std::vector<llvm::Constant*> entry;
+    entry.push_back(createConstantCString(kv.first));
+    entry.push_back(llvm::ConstantExpr::getBitCast(getDispatchThunk(kv.second), int8PtrTy));
+    methods.push_back(llvm::ConstantStruct::get(m_methodEntry, entry));
+  }
+  
+  std::vector<llvm::Constant*> propDefaults;
+  std::vector<llvm::Constant*> propNames;
+  for (auto prop : cls.props) {
+    propDefaults.push_back(createConstantTypedValue(prop->val()));
+    propNames.push_back(createConstantCString(prop->name()->toCppString()));
+  }
+  
+  std::vector<llvm::Constant*> fields;
+  fields.push_back(createConstantCString(cls.preClass->name()->toCppString()));
+  fields.push_back(cls.parent 
+          ? static_cast<llvm::Constant*>(cls.parent->classGlobal)
+          : llvm::ConstantPointerNull::get(m_class->getPointerTo()));
+  fields.push_back(globalArray(int8PtrTy, vtable));
+  fields.push_back(globalArray(m_methodEntry, methods));
+  fields.push_back(llvm::ConstantInt::get(int64Ty, methods.size()));
+  fields.push_back(llvm::ConstantExpr::getSizeOf(cls.objectType));
+  fields.push_back(globalArray(m_typedValue, propDefaults));
+  fields.push_back(globalArray(int8PtrTy, propNames));
+  fields.push_back(llvm::ConstantInt::get(int64Ty, propNames.size()));
+  cls.classGlobal->setInitializer(llvm::ConstantStruct::get(m_class, fields));
+}
+
+void Translator::defineClasses(const Unit* unit) {
+  for (auto& pcls : unit->preclasses()) {
+    defineClass(pcls.get(), unit);
+  }
+  for (auto& kv : m_classes) {
+    emitClassGlobal(kv.second);
+  }
+}
+
+KnownValue Translator::topStackKnown() {
+  if (m_stackKnown.empty()) return KnownValue();
+  return m_stackKnown.back();
+}
+
 void Translator::appendInstruction(
   llvm::Value* stack_p, 
   const FuncInfo& finfo, 
   PC pc) 
 {
   auto const startPc = pc;
-  
+
+  auto rel_block = [&] (Offset off) {
+    return getBlock(finfo, finfo.unit->offsetOf(startPc) + off);
+  };
+
 //
 //  auto rel_label = [&] (Offset off) {
 //    auto const tgt = startPc - finfo.unit->at(0) + off;
@@ -217,25 +978,6 @@ void Translator::appendInstruction(
 //    out.fmt(">");
 //  };
 //
-//  auto print_itertab = [&] {
-//    auto const vecLen = decode<int32_t>(pc);
-//    out.fmt(" <");
-//    for (auto i = int32_t{0}; i < vecLen; ++i) {
-//      auto const kind = static_cast<IterKind>(decode<int32_t>(pc));
-//      auto const id   = decode<int32_t>(pc);
-//      auto const kindStr = [&]() -> const char* {
-//        switch (kind) {
-//        case KindOfIter:   return "(Iter)";
-//        case KindOfMIter:  return "(MIter)";
-//        case KindOfCIter:  return "(CIter)";
-//        }
-//        not_reached();
-//      }();
-//      out.fmt("{}{} {}", i != 0 ? ", " : "", kindStr, id);
-//    }
-//    out.fmt(">");
-//  };
-//
 //  auto print_stringvec = [&] {
 //    auto const vecLen = decode<int32_t>(pc);
 //    out.fmt(" <");
@@ -252,15 +994,123 @@ void Translator::appendInstruction(
       printf("Op::Int\n");
       insertInstructionInt(stack_p, decode<int64_t>(pc));
       break;
+    case Op::Double:
+      ++pc;
+      printf("Op::Double\n");
+      insertInstructionDouble(stack_p, decode<double>(pc));
+      break;
+    case Op::Add:
+      ++pc;
+      printf("Op::Add\n");
+      insertInstructionArith(stack_p, ArithOp::Add);
+      break;
+    case Op::Sub:
+      ++pc;
+      printf("Op::Sub\n");
+      insertInstructionArith(stack_p, ArithOp::Sub);
+      break;
+    case Op::Mul:
+      ++pc;
+      printf("Op::Mul\n");
+      insertInstructionArith(stack_p, ArithOp::Mul);
+      break;
+    case Op::Div:
+      ++pc;
+      printf("Op::Div\n");
+      insertInstructionArith(stack_p, ArithOp::Div);
+      break;
     case Op::String:
       ++pc;
       printf("Op::String\n");
       insertInstructionString(stack_p, finfo.unit->lookupLitstrId(decode<Id>(pc)));
       break;
+    case Op::Array:
+      ++pc;
+      printf("Op::Array\n");
+      insertInstructionArray(stack_p, finfo.unit->lookupArrayId(decode<Id>(pc)));
+      break;
+    case Op::CGetL:
+      ++pc;
+      printf("Op::CGetL\n");
+      insertInstructionCGetL(stack_p, decodeVariableSizeImm(&pc));
+      break;
+    case Op::VGetL:
+      ++pc;
+      printf("Op::VGetL\n");
+      insertInstructionVGetL(stack_p, decodeVariableSizeImm(&pc));
+      break;
     case Op::SetL:
       ++pc;
       printf("Op::SetL\n");
-      insertInstructionSetL(stack_p, loc_name(finfo, decodeVariableSizeImm(&pc)));
+      insertInstructionSetL(stack_p, decodeVariableSizeImm(&pc));
+      break;
+    case Op::BindL:
+      ++pc;
+      printf("Op::BindL\n");
+      insertInstructionBindL(stack_p, decodeVariableSizeImm(&pc));
+      break;
+    case Op::CGetG:
+      ++pc;
+      printf("Op::CGetG\n");
+      insertInstructionCGetG(stack_p);
+      break;
+    case Op::VGetG:
+      ++pc;
+      printf("Op::VGetG\n");
+      insertInstructionVGetG(stack_p);
+      break;
+    case Op::SetG:
+      ++pc;
+      printf("Op::SetG\n");
+      insertInstructionSetG(stack_p);
+      break;
+    case Op::IssetG:
+      ++pc;
+      printf("Op::IssetG\n");
+      insertInstructionIssetG(stack_p);
+      break;
+    case Op::StaticLoc:
+      ++pc;
+      printf("Op::StaticLoc\n");
+      {
+        auto const localId = decodeVariableSizeImm(&pc);
+        insertInstructionStaticLoc(stack_p, localId, 
+                finfo.unit->lookupLitstrId(decode<Id>(pc)));
+      }
+      break;
+    case Op::StaticLocInit:
+      ++pc;
+      printf("Op::StaticLocInit\n");
+      {
+        auto const localId = decodeVariableSizeImm(&pc);
+        insertInstructionStaticLocInit(stack_p, localId, 
+                finfo.unit->lookupLitstrId(decode<Id>(pc)));
+      }
+      break;
+    case Op::SetOpL:
+      ++pc;
+      printf("Op::SetOpL\n");
+      {
+        auto const localId = decodeVariableSizeImm(&pc);
+        ++pc; // SetOpOp, always ConcatEqual; see isTranslatable()
+        // The first of a run of appends to a local sizes the copy for
+        // all of them.
+        int64_t reserve = 0;
+        if (m_reservedAppends.insert(localId).second) {
+          reserve = pendingAppendBytes(finfo, pc, localId);
+        }
+        insertInstructionConcatAppendL(stack_p, localId, reserve);
+      }
+      break;
+    case Op::Concat:
+      ++pc;
+      printf("Op::Concat\n");
+      insertInstructionConcatN(stack_p, 2);
+      break;
+    case Op::ConcatN:
+      ++pc;
+      printf("Op::ConcatN\n");
+      insertInstructionConcatN(stack_p, decodeVariableSizeImm(&pc));
       break;
     case Op::PopC:
       ++pc;
@@ -272,6 +1122,11 @@ void Translator::appendInstruction(
       printf("Op::PopR\n");
       insertInstructionPopR(stack_p);
       break;
+    case Op::PopV:
+      ++pc;
+      printf("Op::PopV\n");
+      insertInstructionPopV(stack_p);
+      break;
     case Op::Print:
       ++pc;
       printf("Op::Print\n");
@@ -308,8 +1163,221 @@ void Translator::appendInstruction(
       ++pc;
       insertInstructionFCall(stack_p, decodeVariableSizeImm(&pc));
       break;
-    default:
-      printf("default\n");
+    case Op::FPushCtorD:
+      ++pc;
+      printf("Op::FPushCtorD\n");
+      {
+        uint32_t numArgs = decodeVariableSizeImm(&pc);
+        StringData* className = finfo.unit->lookupLitstrId(decode<Id>(pc));
+        insertInstructionFPushCtorD(stack_p, numArgs, className);
+      }
+      break;
+    case Op::FPushObjMethodD:
+      ++pc;
+      printf("Op::FPushObjMethodD\n");
+      {
+        uint32_t numArgs = decodeVariableSizeImm(&pc);
+        StringData* methodName = finfo.unit->lookupLitstrId(decode<Id>(pc));
+        insertInstructionFPushObjMethodD(stack_p, numArgs, methodName);
+      }
+      break;
+    case Op::FPushClsMethodD:
+      ++pc;
+      printf("Op::FPushClsMethodD\n");
+      {
+        uint32_t numArgs = decodeVariableSizeImm(&pc);
+        StringData* methodName = finfo.unit->lookupLitstrId(decode<Id>(pc));
+        StringData* className = finfo.unit->lookupLitstrId(decode<Id>(pc));
+        insertInstructionFPushClsMethodD(stack_p, numArgs, methodName, className);
+      }
+      break;
+    case Op::This:
+      ++pc;
+      printf("Op::This\n");
+      insertInstructionThis(stack_p);
+      break;
+    case Op::BareThis:
+      ++pc;
+      printf("Op::BareThis\n");
+      decode<uint8_t>(pc);
+      insertInstructionThis(stack_p);
+      break;
+    case Op::CheckThis:
+      ++pc;
+      printf("Op::CheckThis\n");
+      break;
+    case Op::DefCls:
+      // Classes are laid out statically by defineClasses().
+      ++pc;
+      printf("Op::DefCls\n");
+      decodeVariableSizeImm(&pc);
+      break;
+    case Op::CGetM:
+    case Op::SetM:
+      {
+        auto const op = *reinterpret_cast<const Op*>(pc);
+        ++pc;
+        printf(op == Op::CGetM ? "Op::CGetM\n" : "Op::SetM\n");
+        PropMember member;
+        if (!decode_prop_member(pc, finfo.unit, member)) {
+          // isTranslatable() falls back for these.
+          printf("unsupported member vector\n");
+          break;
+        }
+        if (member.lcode == LH && !m_currentThis) {
+          // isTranslatable() falls back for these too, save where it can't.
+          if (op == Op::SetM) insertInstructionDecRef(insertInstructionStackPop(stack_p));
+          insertInstructionFatal("Using $this when not in object context");
+          insertInstructionNull(stack_p);
+          break;
+        }
+        auto const lcode = member.lcode;
+        auto const baseLocal = member.baseLocal;
+        auto const propName = member.propName;
+        
+        llvm::Value* value_p = nullptr;
+        if (op == Op::SetM) {
+          value_p = insertInstructionStackPop(stack_p);
+        }
+        KnownValue base;
+        llvm::Value* base_p = nullptr;
+        llvm::Value* object_p;
+        if (lcode == LH) {
+          base.cls = m_currentClass;
+          object_p = m_currentThis;
+        } else {
+          if (lcode == LL) {
+            auto it = m_localKnown.find(baseLocal);
+            if (it != end(m_localKnown)) base = it->second;
+            base_p = insertInstructionGetLocal(baseLocal);
+          } else {
+            base = topStackKnown();
+            base_p = insertInstructionStackPop(stack_p);
+          }
+          if (!base.cls) {
+            insertInstructionCheckObject(base_p, op == Op::CGetM 
+                                                 ? "Trying to get property of non-object"
+                                                 : "Attempt to assign property of non-object");
+          }
+          object_p = m_builder->CreateLoad(m_builder->CreateStructGEP(base_p, 5));
+        }
+        
+        if (op == Op::CGetM) {
+          insertInstructionCGetProp(stack_p, base, object_p, propName);
+        } else {
+          insertInstructionSetProp(stack_p, base, object_p, propName, value_p);
+        }
+        // The result holds its own reference by now.
+        if (lcode == LC) insertInstructionDecRef(base_p);
+      }
+      break;
+    case Op::CreateCont:
+      ++pc;
+      printf("Op::CreateCont\n");
+      insertInstructionCreateCont(stack_p);
+      break;
+    case Op::ContCheck:
+      // The generator's methods check its state in the runtime.
+      ++pc;
+      printf("Op::ContCheck\n");
+      decodeVariableSizeImm(&pc);
+      break;
+    case Op::Yield:
+      ++pc;
+      printf("Op::Yield\n");
+      insertInstructionYield(stack_p, false);
+      break;
+    case Op::YieldK:
+      ++pc;
+      printf("Op::YieldK\n");
+      insertInstructionYield(stack_p, true);
+      break;
+    case Op::Incl:
+    case Op::InclOnce:
+    case Op::Req:
+    case Op::ReqOnce:
+      {
+        // Only translated for a whole program and a file it has; see
+        // isTranslatable().
+        auto const op = *reinterpret_cast<const Op*>(startPc);
+        ++pc;
+        printf("Op::%s\n", opcodeToName(op));
+        insertInstructionIncl(stack_p, m_includePaths[finfo.unit->offsetOf(startPc)], 
+                              op == Op::InclOnce || op == Op::ReqOnce);
+      }
+      break;
+    case Op::Await:
+      ++pc;
+      printf("Op::Await\n");
+      decodeVariableSizeImm(&pc);
+      insertInstructionAwait(stack_p);
+      break;
+    case Op::Jmp:
+      ++pc;
+      printf("Op::Jmp\n");
+      insertInstructionJmp(rel_block(decode<Offset>(pc)));
+      break;
+    case Op::JmpNS:
+      // No surprise check, which translated code never makes anyway.
+      ++pc;
+      printf("Op::JmpNS\n");
+      insertInstructionJmp(rel_block(decode<Offset>(pc)));
+      break;
+    case Op::IterInit:
+    case Op::IterInitK:
+    case Op::MIterInit:
+    case Op::MIterInitK:
+      {
+        auto const op = *reinterpret_cast<const Op*>(pc);
+        ++pc;
+        printf("Op::IterInit\n");
+        auto const byRef = op == Op::MIterInit || op == Op::MIterInitK;
+        auto const withKey = op == Op::IterInitK || op == Op::MIterInitK;
+        uint32_t iterId = decodeVariableSizeImm(&pc);
+        llvm::BasicBlock* doneBlock = rel_block(decode<Offset>(pc));
+        uint32_t valLocal = decodeVariableSizeImm(&pc);
+        int64_t keyLocal = withKey ? decodeVariableSizeImm(&pc) : -1;
+        insertInstructionIterInit(stack_p, iterId, doneBlock, 
+                                  valLocal, keyLocal, byRef);
+      }
+      break;
+    case Op::IterNext:
+    case Op::IterNextK:
+    case Op::MIterNext:
+    case Op::MIterNextK:
+      {
+        auto const op = *reinterpret_cast<const Op*>(pc);
+        ++pc;
+        printf("Op::IterNext\n");
+        auto const byRef = op == Op::MIterNext || op == Op::MIterNextK;
+        auto const withKey = op == Op::IterNextK || op == Op::MIterNextK;
+        uint32_t iterId = decodeVariableSizeImm(&pc);
+        llvm::BasicBlock* bodyBlock = rel_block(decode<Offset>(pc));
+        uint32_t valLocal = decodeVariableSizeImm(&pc);
+        int64_t keyLocal = withKey ? decodeVariableSizeImm(&pc) : -1;
+        insertInstructionIterNext(iterId, bodyBlock, valLocal, keyLocal, byRef);
+      }
+      break;
+    case Op::IterFree:
+    case Op::MIterFree:
+      ++pc;
+      printf("Op::IterFree\n");
+      insertInstructionIterFree(decodeVariableSizeImm(&pc));
+      break;
+    case Op::IterBreak:
+      ++pc;
+      printf("Op::IterBreak\n");
+      {
+        auto const iters = decode_itertab(pc);
+        llvm::BasicBlock* target = rel_block(decode<Offset>(pc));
+        for (auto& kv : iters) {
+          insertInstructionIterFree(kv.second);
+        }
+        insertInstructionJmp(target);
+      }
+      break;
+    default:
+      printf("default\n");
       ++pc;
       //printf("op: %d\n", op);
       break;
@@ -318,6 +1386,531 @@ void Translator::appendInstruction(
 }
 
 
+bool Translator::finishesEagerly(const Func* func) {
+  auto const known = m_eagerFuncs.find(func);
+  if (known != end(m_eagerFuncs)) return known->second;
+  // A function that ends up calling itself is taken to suspend.
+  m_eagerFuncs[func] = false;
+  auto eager = func->isAsync() && !func->isGenerator();
+  // The user function each pending call pushed, if it is known.
+  std::vector<const Func*> callees;
+  const Func* lastCallee = nullptr;
+  auto prevOp = Op::Nop;
+  auto it   = func->unit()->at(func->base());
+  auto stop = func->unit()->at(func->past());
+  for (; eager && it != stop; prevOp = *reinterpret_cast<const Op*>(it),
+                              it += instrLen(reinterpret_cast<const Op*>(it))) {
+    auto const op = *reinterpret_cast<const Op*>(it);
+    if (op == Op::FPushFuncD) {
+      PC pc = it + 1;
+      decodeVariableSizeImm(&pc);
+      auto const callee = m_userFuncs.find(lower_name(func->unit()->lookupLitstrId(decode<Id>(pc))));
+      callees.push_back(callee != end(m_userFuncs) ? callee->second : nullptr);
+    } else if (isFPush(op)) {
+      callees.push_back(nullptr);
+    } else if (op == Op::FCall) {
+      lastCallee = callees.empty() ? nullptr : callees.back();
+      if (!callees.empty()) callees.pop_back();
+    } else if (op == Op::Await) {
+      eager = prevOp == Op::FCall && lastCallee && finishesEagerly(lastCallee);
+    }
+  }
+  return m_eagerFuncs[func] = eager;
+}
+
+bool Translator::isTranslatable(const FuncInfo& finfo) {
+  auto const func = finfo.func;
+  auto fallback = [&] (const char* reason) {
+    if (func->preClass() && !func->isStatic()) {
+      // The VM can't be handed a native $this; appendTrampoline()
+      // makes calling it a fatal error rather than a miscompile.
+      printf("unsupported: %s can't fall back to the VM: %s\n", 
+             m_currentFunctionName.c_str(), reason);
+      return false;
+    }
+    printf("%s falls back to the VM: %s\n", 
+           m_currentFunctionName.c_str(), reason);
+    return false;
+  };
+  
+  if (func->isGenerator() && func->isAsync()) return fallback("async generator");
+  // Translated async functions run to completion, so an await must not
+  // have anything to wait for; the VM suspends the rest.
+  if (func->isAsync() && !finishesEagerly(func)) return fallback("await that may suspend");
+  if (!finfo.ehInfo.empty()) return fallback("exception handler");
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    // A DV entry runs each default's funclet; one that branches would
+    // be skipped and leave the parameter null.
+    if (func->params()[i].hasDefaultValue() && !is_straight_line_funclet(func, i)) {
+      return fallback("default value with control flow");
+    }
+  }
+  
+  auto       it   = func->unit()->at(func->base());
+  auto const stop = func->unit()->at(func->past());
+  auto       prevOp = Op::Nop;
+  auto       namesGlobals = false;
+  // The values on top of the stack, when they are strings built from
+  // literals alone.
+  std::vector<std::string> literals;
+  m_includePaths.clear();
+  for (; it != stop; prevOp = *reinterpret_cast<const Op*>(it), 
+                     it += instrLen(reinterpret_cast<const Op*>(it))) {
+    auto const op = *reinterpret_cast<const Op*>(it);
+    auto const isInclude = 
+      op == Op::Incl || op == Op::InclOnce || op == Op::Req || op == Op::ReqOnce;
+    if (op == Op::Concat && literals.size() >= 2) {
+      literals[literals.size() - 2] += literals.back();
+      literals.pop_back();
+    } else if (op != Op::String && !isInclude) {
+      literals.clear();
+    }
+    switch (op) {
+      case Op::String:
+        {
+          PC pc = it + 1;
+          auto const str = func->unit()->lookupLitstrId(decode<Id>(pc));
+          namesGlobals |= str->toCppString() == "GLOBALS";
+          literals.push_back(str->toCppString());
+        }
+        break;
+      case Op::CGetG:
+      case Op::VGetG:
+      case Op::SetG:
+      case Op::IssetG:
+        // $GLOBALS itself would need the globals as an array.
+        if (namesGlobals) return fallback("$GLOBALS");
+        break;
+      case Op::BindL:
+        // A name at the top level is its global's slot; binding it to
+        // anything else would detach the two.
+        if (func->isPseudoMain() && prevOp != Op::VGetG) {
+          return fallback("reference binding at the top level");
+        }
+        break;
+      case Op::Null:
+      case Op::Int:
+      case Op::Array:
+      case Op::Print:
+      case Op::PopC:
+      case Op::PopR:
+      case Op::PopV:
+      case Op::RetC:
+      case Op::CGetL:
+      case Op::VGetL:
+      case Op::SetL:
+      case Op::Concat:
+      case Op::ConcatN:
+      case Op::Double:
+      case Op::Add:
+      case Op::Sub:
+      case Op::Mul:
+      case Op::Div:
+      case Op::FPushFuncD:
+      case Op::FPassCE:
+      case Op::FCall:
+      case Op::FPushObjMethodD:
+      case Op::This:
+      case Op::BareThis:
+      case Op::CheckThis:
+      case Op::DefCls:
+      case Op::Jmp:
+      case Op::JmpNS:
+      case Op::IterInit:
+      case Op::IterInitK:
+      case Op::MIterInit:
+      case Op::MIterInitK:
+      case Op::IterNext:
+      case Op::IterNextK:
+      case Op::MIterNext:
+      case Op::MIterNextK:
+      case Op::IterFree:
+      case Op::MIterFree:
+      case Op::CIterFree:
+      case Op::IterBreak:
+      case Op::CreateCont:
+      case Op::ContCheck:
+      case Op::Yield:
+      case Op::YieldK:
+      case Op::Await:
+      case Op::StaticLoc:
+      case Op::StaticLocInit:
+        break;
+      case Op::FPushCtorD:
+        {
+          PC pc = it + 1;
+          decodeVariableSizeImm(&pc);
+          if (!findClass(func->unit()->lookupLitstrId(decode<Id>(pc)))) {
+            return fallback("class outside the unit");
+          }
+        }
+        break;
+      case Op::FPushClsMethodD:
+        {
+          PC pc = it + 1;
+          decodeVariableSizeImm(&pc);
+          auto const methodName = func->unit()->lookupLitstrId(decode<Id>(pc));
+          auto const cls = findClass(func->unit()->lookupLitstrId(decode<Id>(pc)));
+          if (!cls || !cls->methods.count(lower_name(methodName))) {
+            return fallback("method outside the unit");
+          }
+          if (!cls->methods.at(lower_name(methodName))->isStatic() && 
+              !(func->preClass() && !func->isStatic())) {
+            return fallback("non-static method called statically");
+          }
+        }
+        break;
+      case Op::Incl:
+      case Op::InclOnce:
+      case Op::Req:
+      case Op::ReqOnce:
+        {
+          if (!m_wholeProgram) return fallback(opcodeToName(op));
+          // The included file's top-level code runs in the global scope
+          // here, not in the including function's.
+          if (!func->isPseudoMain()) return fallback("include in a function");
+          auto const path = literals.empty() ? std::string() : resolveIncludePath(literals.back());
+          if (!m_pseudoMains.count(path)) {
+            return fallback("include of a file that is not known statically");
+          }
+          m_includePaths[func->unit()->offsetOf(it)] = path;
+          literals.clear();
+        }
+        break;
+      case Op::SetOpL:
+        {
+          PC pc = it + 1;
+          decodeVariableSizeImm(&pc);
+          if (static_cast<SetOpOp>(*pc) != SetOpOp::ConcatEqual) {
+            return fallback("compound assignment");
+          }
+        }
+        break;
+      case Op::CGetM:
+      case Op::SetM:
+        {
+          PC pc = it + 1;
+          PropMember member;
+          if (!decode_prop_member(pc, finfo.unit, member)) {
+            return fallback("member vector");
+          }
+          if (member.lcode == LH && !(func->preClass() && !func->isStatic())) {
+            return fallback("$this outside an instance method");
+          }
+        }
+        break;
+      default:
+        return fallback(opcodeToName(op));
+    }
+  }
+  return true;
+}
+
+void Translator::appendTrampoline(const FuncInfo& finfo) {
+  auto const func = finfo.func;
+  if (func->isPseudoMain()) {
+    // Run the whole file in the VM instead.
+    m_currentFunction = declarePseudoMain(m_currentFunctionName);
+    m_builder->SetInsertPoint(llvm::BasicBlock::Create(m_ctx, "entry", m_currentFunction));
+    insertInstructionMarkIncluded();
+    m_builder->CreateCall(m_CFunctionVMInclude, createConstantCString(m_sourceFilePath));
+    m_builder->CreateRet(llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0));
+    return;
+  }
+  
+  // Same signature as a translated function, so callers can't tell.
+  m_currentFunction = generateFunction(finfo);
+  m_builder->SetInsertPoint(llvm::BasicBlock::Create(m_ctx, "entry", m_currentFunction));
+  
+  if (func->preClass() && !func->isStatic()) {
+    insertInstructionFatal(folly::format(
+            "Method {}() can't be translated nor run by the VM", m_currentFunctionName).str());
+    m_builder->CreateRetVoid();
+    return;
+  }
+  insertInstructionVMLoad();
+  
+  // Callers pass Uninit for the parameters they leave out, and the VM
+  // is only given those before them so that it fills in the defaults.
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  llvm::Value* numArgs = llvm::ConstantInt::get(int64Ty, func->numParams());
+  llvm::Value* trailingMissing = m_builder->getTrue();
+  for (auto i = func->numParams(); i-- > 0; ) {
+    llvm::Value* type = m_builder->CreateLoad(
+            m_builder->CreateStructGEP(m_currentFunctionArguments[i + m_firstParamArgument], 0));
+    trailingMissing = m_builder->CreateAnd(trailingMissing, m_builder->CreateICmpEQ(
+            type, llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfUninit)));
+    numArgs = m_builder->CreateSelect(
+            trailingMissing, llvm::ConstantInt::get(int64Ty, i), numArgs);
+  }
+  
+  llvm::Value* argv_p = llvm::ConstantPointerNull::get(
+          m_typedValue->getPointerTo()->getPointerTo());
+  if (func->numParams() > 0) {
+    llvm::Value* argv = createEntryAlloca(
+            llvm::ArrayType::get(m_typedValue->getPointerTo(), func->numParams()), "argv");
+    for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+      m_builder->CreateStore(m_currentFunctionArguments[i + m_firstParamArgument], 
+                             m_builder->CreateConstGEP2_64(argv, 0, i));
+    }
+    argv_p = m_builder->CreateConstGEP2_64(argv, 0, 0);
+  }
+  if (func->preClass()) {
+    // The VM resolves a static method by its class and name.
+    llvm::Value* params[] = {
+      createConstantCString(func->preClass()->name()->toCppString()),
+      createConstantCString(func->name()->toCppString()),
+      m_currentFunctionArguments[0],
+      numArgs,
+      argv_p,
+    };
+    m_builder->CreateCall(m_CFunctionVMCallMethod, params);
+  } else {
+    m_builder->CreateCall4(
+            m_CFunctionVMCall, 
+            createConstantCString(m_currentFunctionName),
+            m_currentFunctionArguments[0],
+            numArgs,
+            argv_p);
+  }
+  // The VM got copies; the arguments are still this function's own.
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    insertInstructionDecRef(m_currentFunctionArguments[i + m_firstParamArgument]);
+  }
+  m_builder->CreateRetVoid();
+}
+
+void Translator::insertInstructionVMLoad() {
+  // The first trampoline to run loads the unit into the VM, which then
+  // knows the functions and classes the trampolines reach.
+  auto& loaded = m_vmLoaded[m_sourceFilePath];
+  if (!loaded) {
+    loaded = new llvm::GlobalVariable(
+            *m_mod, llvm::Type::getInt1Ty(m_ctx), false,
+            llvm::GlobalValue::InternalLinkage, m_builder->getFalse(), "vm_loaded");
+  }
+  llvm::BasicBlock* loadBlock = llvm::BasicBlock::Create(m_ctx, "vm_load", m_currentFunction);
+  llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "vm_loaded", m_currentFunction);
+  m_builder->CreateCondBr(m_builder->CreateLoad(loaded), joinBlock, loadBlock);
+  
+  m_builder->SetInsertPoint(loadBlock);
+  m_builder->CreateCall(m_CFunctionVMLoad, createConstantCString(m_sourceFilePath));
+  m_builder->CreateStore(m_builder->getTrue(), loaded);
+  m_builder->CreateBr(joinBlock);
+  
+  m_builder->SetInsertPoint(joinBlock);
+}
+
+void Translator::insertInstructionFatal(const std::string& message) {
+  m_builder->CreateCall(m_CFunctionFatal, createConstantCString(message));
+}
+
+void Translator::insertInstructionCheckObject(llvm::Value* typed_value_p, 
+                                              const std::string& message) {
+  llvm::BasicBlock* objectBlock = llvm::BasicBlock::Create(m_ctx, "object", m_currentFunction);
+  llvm::BasicBlock* fatalBlock = llvm::BasicBlock::Create(m_ctx, "non_object", m_currentFunction);
+  m_builder->CreateCondBr(insertInstructionIsType(typed_value_p, KindOfObject), 
+                          objectBlock, fatalBlock);
+  
+  m_builder->SetInsertPoint(fatalBlock);
+  insertInstructionFatal(message);
+  m_builder->CreateUnreachable();
+  
+  m_builder->SetInsertPoint(objectBlock);
+}
+
+llvm::Function* Translator::declarePseudoMain(const std::string& name) {
+  // Those of a whole program are declared before any is translated, so
+  // includes can call them.
+  if (llvm::Function* function = m_mod->getFunction(name)) return function;
+  return llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getInt64Ty(m_ctx), false),
+          llvm::Function::ExternalLinkage, name, m_mod);
+}
+
+llvm::GlobalVariable* Translator::getIncludedFlag(const std::string& path) {
+  auto& flag = m_includedFlags[path];
+  if (!flag) {
+    flag = new llvm::GlobalVariable(
+            *m_mod, llvm::Type::getInt1Ty(m_ctx), false,
+            llvm::GlobalValue::InternalLinkage, m_builder->getFalse(), "included");
+  }
+  return flag;
+}
+
+std::string Translator::resolveIncludePath(const std::string& path) {
+  // A relative path is taken to be relative to the including file, as
+  // __DIR__-based includes are and PHP's own lookup falls back to.
+  llvm::SmallString<256> full;
+  if (!llvm::sys::path::is_absolute(path)) {
+    full = llvm::sys::path::parent_path(m_sourceFilePath);
+  }
+  llvm::sys::path::append(full, path);
+  return canonical_path(full.str().str());
+}
+
+void Translator::insertInstructionMarkIncluded() {
+  if (!m_wholeProgram) return;
+  m_builder->CreateStore(m_builder->getTrue(), 
+                         getIncludedFlag(canonical_path(m_sourceFilePath)));
+}
+
+void Translator::insertInstructionIncl(llvm::Value* stack_p, const std::string& path, 
+                                       bool once) {
+  insertInstructionPopC(stack_p);
+  llvm::Function* pseudoMain = m_pseudoMains.at(path);
+  if (!once) {
+    m_builder->CreateCall(pseudoMain);
+  } else {
+    // include_once skips a file that has run, however it got to.
+    llvm::BasicBlock* includeBlock = llvm::BasicBlock::Create(m_ctx, "include", m_currentFunction);
+    llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "include_join", m_currentFunction);
+    m_builder->CreateCondBr(m_builder->CreateLoad(getIncludedFlag(path)), joinBlock, includeBlock);
+    
+    m_builder->SetInsertPoint(includeBlock);
+    m_builder->CreateCall(pseudoMain);
+    m_builder->CreateBr(joinBlock);
+    
+    m_builder->SetInsertPoint(joinBlock);
+  }
+  // What a file returns isn't passed on; includes evaluate to 1, as
+  // they do for files without a return statement.
+  insertInstructionInt(stack_p, 1);
+}
+
+void Translator::appendGenerator(const FuncInfo& finfo) {
+  auto const func = finfo.func;
+  auto const hasThis = func->preClass() && !func->isStatic();
+  
+  // The body becomes "<name>$resume", a coroutine that keeps all of
+  // its state in a frame laid out right after the generator_data
+  // header, so a generator is a single allocation.  Each resume jumps
+  // straight to the block following the Yield it stopped at.
+  llvm::Function* resume = llvm::Function::Create(
+          m_resumeFunctionType, 
+          llvm::Function::InternalLinkage, 
+          m_currentFunctionName + "$resume", 
+          m_mod);
+  llvm::Function::arg_iterator ai = resume->arg_begin();
+  llvm::Value* gen_p = ai++;
+  llvm::Value* sent_p = ai++;
+  gen_p->setName("gen");
+  sent_p->setName("sent");
+  
+  m_currentFunction = resume;
+  m_currentGenerator = gen_p;
+  m_generatorSent = sent_p;
+  m_resumeBlocks.clear();
+  llvm::BasicBlock* entryBlock = llvm::BasicBlock::Create(m_ctx, "entry", resume);
+  llvm::BasicBlock* startBlock = llvm::BasicBlock::Create(m_ctx, "start", resume);
+  m_builder->SetInsertPoint(entryBlock);
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  llvm::Value* frame_raw = m_builder->CreateGEP(
+          m_builder->CreateBitCast(gen_p, int8PtrTy), 
+          llvm::ConstantExpr::getSizeOf(m_generatorData), 
+          "frame_raw");
+  
+  // Parameters and $this are stored into the frame by the ramp.
+  std::vector<llvm::AllocaInst*> argSlots;
+  m_currentFunctionArguments.clear();
+  m_currentFunctionArguments.push_back(sent_p);
+  m_currentThis = nullptr;
+  if (hasThis) {
+    auto const this_slot = llvm::cast<llvm::AllocaInst>(
+            createEntryAlloca(m_objectData->getPointerTo(), "this_slot"));
+    argSlots.push_back(this_slot);
+    m_currentFunctionArguments.push_back(this_slot);
+    m_currentThis = m_builder->CreateLoad(this_slot, "this");
+  }
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    auto const arg_slot = llvm::cast<llvm::AllocaInst>(
+            createEntryAlloca(m_typedValue, loc_name(finfo, i)));
+    argSlots.push_back(arg_slot);
+    m_currentFunctionArguments.push_back(arg_slot);
+  }
+  m_firstParamArgument = hasThis ? 2 : 1;
+  
+  m_builder->SetInsertPoint(startBlock);
+  llvm::Value* stack_p = insertInstructionStackAllocInit(1024);
+  insertInstructionProbe(m_currentFunctionName + "@entry");
+  allocLocals(finfo);
+  allocIters(finfo);
+  
+  appendFuncBody(stack_p, finfo, true);
+  if (!m_builder->GetInsertBlock()->getTerminator()) {
+    insertInstructionRetC(stack_p);
+  }
+  
+  // State 0 starts the body, state k resumes after the k-th Yield.
+  m_builder->SetInsertPoint(entryBlock);
+  llvm::Value* state = m_builder->CreateLoad(m_builder->CreateStructGEP(gen_p, 2), "state");
+  llvm::SwitchInst* dispatch = m_builder->CreateSwitch(state, startBlock, m_resumeBlocks.size());
+  for (auto i = size_t{0}; i < m_resumeBlocks.size(); ++i) {
+    dispatch->addCase(
+            llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), i + 1), 
+            m_resumeBlocks[i]);
+  }
+  applyProfile(resume);
+  annotateTBAA(resume);
+  
+  // Everything the body allocated lives across resumes, so every
+  // entry alloca moves into the frame; the argument slots go first
+  // where the ramp can find them.
+  std::vector<llvm::AllocaInst*> slots(argSlots);
+  for (auto& inst : *entryBlock) {
+    auto const alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+    if (alloca && std::find(argSlots.begin(), argSlots.end(), alloca) == argSlots.end()) {
+      slots.push_back(alloca);
+    }
+  }
+  std::vector<llvm::Type*> frameElems;
+  for (auto slot : slots) {
+    frameElems.push_back(slot->getAllocatedType());
+  }
+  llvm::StructType* frameType = llvm::StructType::create(
+          m_ctx, frameElems, "frame." + m_currentFunctionName);
+  llvm::IRBuilder<> frameBuilder(
+          entryBlock, 
+          std::next(llvm::BasicBlock::iterator(llvm::cast<llvm::Instruction>(frame_raw))));
+  llvm::Value* frame_p = frameBuilder.CreateBitCast(frame_raw, frameType->getPointerTo(), "frame");
+  for (auto i = size_t{0}; i < slots.size(); ++i) {
+    llvm::Value* field_p = frameBuilder.CreateStructGEP(frame_p, i);
+    field_p->takeName(slots[i]);
+    slots[i]->replaceAllUsesWith(field_p);
+    slots[i]->eraseFromParent();
+  }
+  
+  // The ramp keeps the function's own signature: it allocates the
+  // generator, copies the arguments into its frame and returns it.
+  m_currentGenerator = nullptr;
+  m_currentFunction = generateFunction(finfo);
+  m_builder->SetInsertPoint(llvm::BasicBlock::Create(m_ctx, "entry", m_currentFunction));
+  llvm::Value* new_gen_p = m_builder->CreateCall2(
+          m_CFunctionGeneratorCreate, 
+          llvm::ConstantExpr::getSizeOf(frameType),
+          m_builder->CreateBitCast(resume, int8PtrTy));
+  llvm::Value* new_frame_p = m_builder->CreateBitCast(
+          m_builder->CreateGEP(
+                  m_builder->CreateBitCast(new_gen_p, int8PtrTy), 
+                  llvm::ConstantExpr::getSizeOf(m_generatorData)),
+          frameType->getPointerTo());
+  unsigned field = 0;
+  if (hasThis) {
+    m_builder->CreateStore(m_currentThis, m_builder->CreateStructGEP(new_frame_p, field++));
+  }
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i, ++field) {
+    insertInstructionCopyTypedValue(
+            m_builder->CreateStructGEP(new_frame_p, field), 
+            m_currentFunctionArguments[i + m_firstParamArgument]);
+  }
+  insertInstructionCopyTypedValue(
+          m_currentFunctionArguments[0],
+          createTypedValueObject(m_builder->CreateBitCast(
+                  new_gen_p, m_objectData->getPointerTo())));
+  m_builder->CreateRetVoid();
+  annotateTBAA(m_currentFunction);
+}
+
 void Translator::appendFuncBody(
   llvm::Value* stack_p, 
   const FuncInfo& finfo,
@@ -330,9 +1923,11 @@ void Translator::appendFuncBody(
   auto       ehIter  = begin(finfo.ehStarts);
   auto const ehStop  = end(finfo.ehStarts);
   auto       bcIter  = func->unit()->at(func->base());
-  auto const bcStop  = func->unit()->at(func->past());
+  auto const bcStop  = func->unit()->at(funclets_base(func));
 
   min_priority_queue<Offset> ehEnds;
+  
+  attachDebugInfo(finfo, m_currentFunction);
 
   while (bcIter != bcStop) {
     auto const off = func->unit()->offsetOf(bcIter);
@@ -376,37 +1971,79 @@ void Translator::appendFuncBody(
 //      out.dec_indent();
 //      out.fmtln("{}:", lblIter->second);
 //      out.inc_indent();
+      llvm::BasicBlock* block = getBlock(finfo, off);
+      if (!m_builder->GetInsertBlock()->getTerminator()) {
+        m_builder->CreateBr(block);
+      }
+      m_builder->SetInsertPoint(block);
+      m_currentOffset = off - func->base();
+      m_blockProbeKeys[block] = probeKey("block");
+      insertInstructionProbe(m_blockProbeKeys[block]);
+      // Nothing is known about values flowing in from other edges.
+      m_stackKnown.clear();
+      m_localKnown.clear();
+      m_reservedAppends.clear();
+    } else if (m_builder->GetInsertBlock()->getTerminator()) {
+      // Code following a jump which no label makes reachable.
+      m_builder->SetInsertPoint(
+              llvm::BasicBlock::Create(m_ctx, "dead", m_currentFunction));
     }
 
+    m_currentOffset = off - func->base();
+    auto const line = finfo.unit->getLineNumber(off);
+    m_builder->SetCurrentDebugLocation(
+            llvm::DebugLoc::get(line > 0 ? line : 0, 0, m_currentSubprogram));
     appendInstruction(stack_p, finfo, bcIter);
 
     bcIter += instrLen(reinterpret_cast<const Op*>(bcIter));
   }
+  m_builder->SetCurrentDebugLocation(llvm::DebugLoc());
 }
 
 void Translator::appendFunc(const Func* func) {
-  auto const finfo = find_func_info(func);
+  m_arena.reset();
+  auto const finfo = find_func_info(m_arena, func);
+  m_currentFunctionName = func->isPseudoMain() ? m_pseudoMainName : functionName(func);
+  m_currentClass = func->preClass() ? findClass(func->preClass()->name()) : nullptr;
+  m_currentThis = nullptr;
+  m_currentOffset = 0;
+  m_blockProbeKeys.clear();
+  m_blocks.clear();
+  m_stackKnown.clear();
+  m_staticTypedValues.clear();
+  m_localKnown.clear();
+  m_globalLocals.clear();
+  m_iterLayouts.clear();
+  m_reservedAppends.clear();
   
-  if (func->isPseudoMain()) {
+  m_currentGenerator = nullptr;
+  m_currentFunctionIsAsync = func->isAsync();
+  m_builder->SetCurrentDebugLocation(llvm::DebugLoc());
+  
+  auto const translatable = isTranslatable(finfo);
+  if (!translatable) {
+    appendTrampoline(finfo);
+  } else if (func->isGenerator()) {
+    appendGenerator(finfo);
+  } else if (func->isPseudoMain()) {
     m_currentFunctionIsPseudoMain = true;
-    llvm::Type*               resultType = llvm::Type::getInt64Ty(m_ctx);
-    std::vector<llvm::Type*>  paramTypes(0, llvm::Type::getVoidTy(m_ctx));
-    std::string               functionName = "main";
-    llvm::FunctionType*       functionType = llvm::FunctionType::get(resultType, paramTypes, false);
-    m_currentFunction = llvm::Function::Create(
-                                          functionType, 
-                                          llvm::Function::ExternalLinkage, 
-                                          functionName, 
-                                          m_mod);
+    m_currentFunction = declarePseudoMain(m_currentFunctionName);
 
     llvm::BasicBlock* basicBlock = llvm::BasicBlock::Create(m_ctx, "entry", m_currentFunction);
     m_builder->SetInsertPoint(basicBlock);
     llvm::Value* stack_p = insertInstructionStackAllocInit(1024);
+    insertInstructionProbe(m_currentFunctionName + "@entry");
+    insertInstructionMarkIncluded();
+    allocLocals(finfo);
+    allocIters(finfo);
     
     appendFuncBody(stack_p, finfo, true);
 
-    llvm::Value* retval = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0);
-    m_builder->CreateRet(retval);
+    if (!m_builder->GetInsertBlock()->getTerminator()) {
+      insertInstructionRetPseudoMain(stack_p);
+    }
+    applyProfile(m_currentFunction);
+    annotateTBAA(m_currentFunction);
     m_currentFunctionIsPseudoMain = false;
   } else {
     m_currentFunctionIsPseudoMain = false;
@@ -415,15 +2052,156 @@ void Translator::appendFunc(const Func* func) {
     llvm::BasicBlock* basicBlock = llvm::BasicBlock::Create(m_ctx, "entry", m_currentFunction);
     m_builder->SetInsertPoint(basicBlock);
     llvm::Value* stack_p = insertInstructionStackAllocInit(1024);
+    insertInstructionProbe(m_currentFunctionName + "@entry");
+    allocLocals(finfo);
+    allocIters(finfo);
     
     appendFuncBody(stack_p, finfo, true);
-    if (!basicBlock->getTerminator()) {
+    if (!m_builder->GetInsertBlock()->getTerminator()) {
       insertInstructionRetC(stack_p);
     }
+    applyProfile(m_currentFunction);
+    annotateTBAA(m_currentFunction);
+    specialiseParams(finfo, m_currentFunction);
+  }
+  
+  for (auto& kv : declareDVEntries(func)) {
+    appendDVEntry(finfo, kv.first, kv.second, translatable);
+  }
+}
+
+const std::map<uint32_t, llvm::Function*>& Translator::declareDVEntries(const Func* func) {
+  llvm::Function* target = declareFunction(func);
+  auto it = m_dvEntries.find(target);
+  if (it != end(m_dvEntries)) return it->second;
+  
+  // One entry per arity from which every remaining parameter has a
+  // default, each running just the initialisers of the parameters it
+  // lacks before calling the full function.
+  auto& entries = m_dvEntries[target];
+  if (func->isPseudoMain()) return entries;
+  llvm::FunctionType* targetType = target->getFunctionType();
+  auto const firstParam = targetType->getNumParams() - func->numParams();
+  for (auto arity = func->numParams(); arity-- > 0; ) {
+    if (!func->params()[arity].hasDefaultValue()) break;
+    std::vector<llvm::Type*> paramTypes(
+            targetType->param_begin(), 
+            targetType->param_begin() + firstParam + arity);
+    entries[arity] = llvm::Function::Create(
+            llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), paramTypes, false),
+            llvm::Function::InternalLinkage,
+            functionName(func) + "$arity" + std::to_string(arity), 
+            m_mod);
+  }
+  return entries;
+}
+
+void Translator::appendDVEntry(
+  const FuncInfo& finfo, 
+  uint32_t arity, 
+  llvm::Function* entry, 
+  bool translatable) 
+{
+  auto const func = finfo.func;
+  llvm::Function* target = declareFunction(func);
+  auto const hasThis = func->preClass() && !func->isStatic();
+  
+  m_currentFunction = entry;
+  m_currentFunctionName = entry->getName();
+  m_currentFunctionArguments.clear();
+  m_currentFunctionIsPseudoMain = false;
+  m_currentGenerator = nullptr;
+  m_currentThis = nullptr;
+  m_firstParamArgument = hasThis ? 2 : 1;
+  llvm::Function::arg_iterator ai = entry->arg_begin();
+  for (int i = 0; ai != entry->arg_end(); i++, ai++) {
+    m_currentFunctionArguments.push_back(ai);
+    if (i == 0) {
+      ai->setName("retval");
+    } else if (hasThis && i == 1) {
+      ai->setName("this");
+      m_currentThis = ai;
+    } else {
+      ai->setName(loc_name(finfo, i - m_firstParamArgument));
+    }
+  }
+  m_stackKnown.clear();
+  m_localKnown.clear();
+  m_globalLocals.clear();
+  
+  m_builder->SetInsertPoint(llvm::BasicBlock::Create(m_ctx, "entry", entry));
+  std::vector<llvm::Value*> params;
+  params.push_back(m_currentFunctionArguments[0]);
+  if (hasThis) {
+    params.push_back(m_currentThis);
+  }
+  
+  if (!translatable) {
+    // The trampoline leaves the defaults to the VM, which it doesn't
+    // pass the Uninit parameters to.
+    for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+      params.push_back(i < arity 
+              ? m_currentFunctionArguments[i + m_firstParamArgument] 
+              : createTypedValueUninit());
+    }
+    m_builder->CreateCall(target, params);
+    m_builder->CreateRetVoid();
+    return;
+  }
+  
+  llvm::Value* stack_p = insertInstructionStackAllocInit(func->maxStackCells());
+  allocLocals(finfo);
+  
+  // The funclets of the missing parameters follow each other and end
+  // with a jump to the body; see is_straight_line_funclet().
+  auto       pc   = finfo.unit->at(func->params()[arity].funcletOff());
+  auto const stop = finfo.unit->at(func->past());
+  for (; pc != stop; pc += instrLen(reinterpret_cast<const Op*>(pc))) {
+    auto const op = *reinterpret_cast<const Op*>(pc);
+    if (op == Op::Jmp || op == Op::JmpNS) break;
+    m_currentOffset = finfo.unit->offsetOf(pc) - func->base();
+    appendInstruction(stack_p, finfo, pc);
   }
+  
+  for (auto i = uint32_t{0}; i < func->numParams(); ++i) {
+    params.push_back(insertInstructionGetLocal(i));
+  }
+  m_builder->CreateCall(target, params);
+  m_builder->CreateRetVoid();
+  annotateTBAA(entry);
 }
 
 llvm::Module* Translator::translateUnit(HPHP::Unit* unit) {
+  beginDebugInfo(unit);
+  defineClasses(unit);
+  declareUnitFuncs(unit);
+  appendUnit(unit);
+  finishModule();
+  return m_mod;
+};
+
+void Translator::declareUnitFuncs(const Unit* unit) {
+  // Declared up front so calls bind directly whatever the order of
+  // definition.
+  for (Func* func : unit->funcs()) {
+    if (func->isPseudoMain()) continue;
+    declareDVEntries(func);
+    m_userFuncs[lower_name(func->name())] = func;
+  }
+}
+
+llvm::Function* Translator::appendUnit(const Unit* unit) {
+  for (auto& pcls : unit->preclasses()) {
+    // A trait's methods are shared by the classes it is flattened into.
+    auto const cls = findClass(pcls->name());
+    if (!(pcls->attrs() & AttrTrait) && (!cls || cls->preClass != pcls.get())) continue;
+    for (auto i = size_t{0}; i < pcls->numMethods(); ++i) {
+      if (pcls->methods()[i]->attrs() & AttrAbstract) continue;
+      appendFunc(pcls->methods()[i]);
+      endFunction();
+    }
+  }
+  
   UnitMergeInfo::FuncRange funcRange = unit->funcs();
   Func* pseudoMain = nullptr;
   for (Func* func : funcRange) {
@@ -432,34 +2210,258 @@ llvm::Module* Translator::translateUnit(HPHP::Unit* unit) {
       continue;
     }
     appendFunc(func);
+    // Entry point for ijk_call_native().
+    getDispatchThunk(func)->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    endFunction();
+  }
+  
+  if (!pseudoMain) return nullptr;
+  appendFunc(pseudoMain);
+  return m_mod->getFunction(m_pseudoMainName);
+}
+
+void Translator::finishModule() {
+  if (m_profileMode == ProfileMode::Instrument) {
+    emitProfileWriter();
+  }
+  emitGlobalTable();
+  if (m_diBuilder) {
+    m_diBuilder->finalize();
+  }
+}
+
+void Translator::endFunction() {
+  m_parStack.clear();
+  m_arena.reset();
+  if (m_streamer && m_streamer->pendingInstructions() >= kStreamFlushInstructions) {
+    m_streamer->flush();
   }
+}
+
+llvm::Module* Translator::translateProgram(
+  const HPHP::String& entryFilePath, 
+  const std::vector<std::string>& filePaths) 
+{
+  defineTypes();
+  declareFuncs();
+  initGlobals();
+  m_wholeProgram = true;
+  
+  std::vector<std::unique_ptr<Unit>> ownedUnits;
+  std::vector<std::pair<std::string, Unit*>> units;
+  // However each file is spelled, it is compiled once, and the entry
+  // file last.
+  std::set<std::string> seen = { canonical_path(entryFilePath.toCppString()) };
+  for (auto& path : filePaths) {
+    auto const canonical = canonical_path(path);
+    if (!canonical.empty() && !seen.insert(canonical).second) continue;
+    Unit* unit = compileFile(path);
+    if (!unit) return nullptr;
+    ownedUnits.emplace_back(unit);
+    units.emplace_back(path, unit);
+  }
+  Unit* entry = compileFile(entryFilePath);
+  if (!entry) return nullptr;
+  ownedUnits.emplace_back(entry);
+  units.emplace_back(entryFilePath.toCppString(), entry);
   
-  if (pseudoMain) {
-    appendFunc(pseudoMain);
+  // Every class and function of the program is known before any body
+  // is translated, so calls, includes and inheritance work across files.
+  for (auto& kv : units) {
+    m_programUnits.push_back(kv.second);
   }
+  for (auto i = size_t{0}; i < units.size(); ++i) {
+    auto const isEntry = i + 1 == units.size();
+    m_pseudoMains[canonical_path(units[i].first)] = 
+      declarePseudoMain(isEntry ? "main" : "main$" + std::to_string(i));
+  }
+  for (auto& kv : units) {
+    for (auto& pcls : kv.second->preclasses()) {
+      defineClass(pcls.get(), kv.second);
+    }
+  }
+  for (auto& kv : m_classes) {
+    emitClassGlobal(kv.second);
+  }
+  for (auto& kv : units) {
+    declareUnitFuncs(kv.second);
+  }
+  
+  // The other files' top-level code runs where the entry file, or one
+  // it includes, includes them.
+  for (auto i = size_t{0}; i < units.size(); ++i) {
+    auto const isEntry = i + 1 == units.size();
+    m_sourceFilePath = units[i].first;
+    m_pseudoMainName = isEntry ? "main" : "main$" + std::to_string(i);
+    beginDebugInfo(units[i].second);
+    appendUnit(units[i].second);
+  }
+  m_pseudoMainName = "main";
+  finishModule();
+  forgetUnits();
   
+  optimizeProgram();
   return m_mod;
-};
+}
+
+void Translator::optimizeProgram() {
+  // Nothing outside the program calls in, so all but main is internal
+  // and interprocedural passes may change or delete it at will.
+  const char* exports[] = { "main" };
+  llvm::PassManager passManager;
+  passManager.add(llvm::createInternalizePass(exports));
+  passManager.add(llvm::createTypeBasedAliasAnalysisPass());
+  passManager.add(llvm::createBasicAliasAnalysisPass());
+  passManager.add(llvm::createGlobalDCEPass());
+  passManager.add(llvm::createIPConstantPropagationPass());
+  passManager.add(llvm::createPromoteMemoryToRegisterPass());
+  passManager.add(llvm::createArgumentPromotionPass());
+  passManager.add(llvm::createFunctionInliningPass());
+  passManager.add(llvm::createGlobalDCEPass());
+  passManager.run(*m_mod);
+}
+
+void Translator::beginDebugInfo(const Unit* unit) {
+  // Debug info is only complete once the module is, which a streaming
+  // translator never waits for.
+  if (m_streamer) return;
+  
+  // Translated code is described as C so that gdb and perf, which know
+  // nothing of PHP, still map addresses to PHP source lines.
+  std::string path = m_sourceFilePath.empty() 
+    ? unit->filepath()->toCppString() 
+    : m_sourceFilePath;
+  llvm::StringRef fileName = llvm::sys::path::filename(path);
+  llvm::StringRef directory = llvm::sys::path::parent_path(path);
+  
+  if (!m_diBuilder) {
+    m_mod->addModuleFlag(llvm::Module::Warning, "Debug Info Version", 
+                         llvm::DEBUG_METADATA_VERSION);
+    m_diBuilder = new llvm::DIBuilder(*m_mod);
+    m_diBuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, fileName, directory, 
+                                   "ijk", true, "", 0);
+  }
+  m_diFile = m_diBuilder->createFile(fileName, directory);
+}
+
+void Translator::attachDebugInfo(const FuncInfo& finfo, llvm::Function* function) {
+  if (!m_diBuilder) {
+    m_currentSubprogram = llvm::DISubprogram();
+    return;
+  }
+  auto const func = finfo.func;
+  auto const line = func->line1() > 0 ? func->line1() : 0;
+  std::string name = func->isPseudoMain() 
+    ? "{main}" 
+    : func->fullName()->toCppString();
+  llvm::DICompositeType type = m_diBuilder->createSubroutineType(
+          m_diFile, m_diBuilder->getOrCreateArray(llvm::ArrayRef<llvm::Value*>()));
+  m_currentSubprogram = m_diBuilder->createFunction(
+          m_diFile, name, function->getName(), m_diFile, line, type, 
+          function->hasInternalLinkage(), true, line, 0, true, function);
+}
 
 void Translator::defineStringData() {
   m_stringData = llvm::StructType::create(m_ctx, "string_data");
   std::vector<llvm::Type*> elems;
   elems.push_back(llvm::Type::getInt32Ty(m_ctx));
   elems.push_back(llvm::Type::getInt8Ty(m_ctx)->getPointerTo());
+  elems.push_back(llvm::Type::getInt32Ty(m_ctx)); // refcount
+  elems.push_back(llvm::Type::getInt32Ty(m_ctx)); // capacity, 0 unless data is owned
   m_stringData->setBody(elems);
 }
 
 void Translator::defineTypedValue() {
+  // array_data, class_t and typed_value_t refer to each other; their
+  // bodies are filled in by defineArrayData() and defineObjectTypes().
+  m_arrayData = llvm::StructType::create(m_ctx, "array_data");
+  m_class = llvm::StructType::create(m_ctx, "class_t");
+  m_objectData = llvm::StructType::create(m_ctx, "object_data");
   m_typedValue = llvm::StructType::create(m_ctx, "typed_value_t");
   std::vector<llvm::Type*> typedValueElems;
   typedValueElems.push_back(llvm::Type::getInt8Ty(m_ctx)); // HPHP::TypedValue.m_type
   typedValueElems.push_back(llvm::Type::getInt64Ty(m_ctx)); // HPHP::TypedValue.m_data.num
   typedValueElems.push_back(llvm::Type::getDoubleTy(m_ctx)); // HPHP::TypedValue.m_data.dbl
   typedValueElems.push_back(m_stringData->getPointerTo()); // HPHP::TypedValue.m_data.pstr
+  typedValueElems.push_back(m_arrayData->getPointerTo()); // HPHP::TypedValue.m_data.parr
+  typedValueElems.push_back(m_objectData->getPointerTo()); // HPHP::TypedValue.m_data.pobj
   m_typedValue->setBody(typedValueElems);
 }
 
-void Translator::defineStack() {
+void Translator::defineArrayData() {
+  std::vector<llvm::Type*> elems;
+  elems.push_back(llvm::Type::getInt8Ty(m_ctx)); // ArrayDataKind
+  elems.push_back(llvm::Type::getInt8Ty(m_ctx)); // is_static
+  elems.push_back(llvm::Type::getInt64Ty(m_ctx)); // size
+  elems.push_back(llvm::Type::getInt64Ty(m_ctx)); // used slots, including tombstones
+  elems.push_back(m_typedValue->getPointerTo()); // elems
+  elems.push_back(m_typedValue->getPointerTo()); // keys, null when packed
+  elems.push_back(llvm::Type::getInt32Ty(m_ctx)); // refcount
+  m_arrayData->setBody(elems);
+}
+
+void Translator::defineObjectTypes() {
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  
+  std::vector<llvm::Type*> objectElems;
+  objectElems.push_back(m_class->getPointerTo()); // cls
+  objectElems.push_back(llvm::Type::getInt32Ty(m_ctx)); // refcount
+  m_objectData->setBody(objectElems);
+  
+  std::vector<llvm::Type*> methodElems;
+  methodElems.push_back(int8PtrTy); // lowercased name
+  methodElems.push_back(int8PtrTy); // dispatch thunk
+  m_methodEntry = llvm::StructType::create(m_ctx, methodElems, "method_entry");
+  
+  std::vector<llvm::Type*> classElems;
+  classElems.push_back(int8PtrTy); // name
+  classElems.push_back(m_class->getPointerTo()); // parent
+  classElems.push_back(int8PtrTy->getPointerTo()); // vtable of dispatch thunks
+  classElems.push_back(m_methodEntry->getPointerTo()); // methods, inherited ones included
+  classElems.push_back(int64Ty); // num_methods
+  classElems.push_back(int64Ty); // size of an instance
+  classElems.push_back(m_typedValue->getPointerTo()); // prop_defaults
+  classElems.push_back(int8PtrTy->getPointerTo()); // prop_names
+  classElems.push_back(int64Ty); // num_props
+  m_class->setBody(classElems);
+  
+  std::vector<llvm::Type*> methodCacheElems;
+  methodCacheElems.push_back(m_class->getPointerTo());
+  methodCacheElems.push_back(int8PtrTy);
+  m_methodCache = llvm::StructType::create(m_ctx, methodCacheElems, "method_cache");
+  
+  std::vector<llvm::Type*> propCacheElems;
+  propCacheElems.push_back(m_class->getPointerTo());
+  propCacheElems.push_back(int64Ty);
+  m_propCache = llvm::StructType::create(m_ctx, propCacheElems, "prop_cache");
+  
+  std::vector<llvm::Type*> dispatchParams;
+  dispatchParams.push_back(m_typedValue->getPointerTo()); // retval
+  dispatchParams.push_back(m_objectData->getPointerTo()); // this
+  dispatchParams.push_back(int64Ty); // numArgs
+  dispatchParams.push_back(m_typedValue->getPointerTo()->getPointerTo()); // args
+  m_dispatchFunctionType = llvm::FunctionType::get(
+          llvm::Type::getVoidTy(m_ctx), dispatchParams, false);
+  
+  std::vector<llvm::Type*> generatorElems;
+  generatorElems.push_back(m_objectData); // header
+  generatorElems.push_back(int8PtrTy); // resume
+  generatorElems.push_back(int64Ty); // state
+  generatorElems.push_back(int64Ty); // next_key
+  generatorElems.push_back(m_typedValue); // key
+  generatorElems.push_back(m_typedValue); // current
+  generatorElems.push_back(m_arrayData); // iter_window
+  m_generatorData = llvm::StructType::create(m_ctx, generatorElems, "generator_data");
+  
+  std::vector<llvm::Type*> resumeParams;
+  resumeParams.push_back(m_generatorData->getPointerTo()); // gen
+  resumeParams.push_back(m_typedValue->getPointerTo()); // sent
+  m_resumeFunctionType = llvm::FunctionType::get(
+          llvm::Type::getVoidTy(m_ctx), resumeParams, false);
+}
+
+void Translator::defineStack() {
   m_stack = llvm::StructType::create(m_ctx, "stack_t");
   std::vector<llvm::Type*> elems;
   elems.push_back(llvm::Type::getInt64Ty(m_ctx));
@@ -468,14 +2470,91 @@ void Translator::defineStack() {
   m_stack->setBody(elems);
 }
 
+void Translator::defineTBAA() {
+  // One scalar type descriptor per runtime struct field.  A store to a
+  // typed_value_t's type tag can then never clobber a string pointer or
+  // the stack size as far as GVN and LICM are concerned.
+  llvm::MDBuilder mdBuilder(m_ctx);
+  llvm::MDNode* root = mdBuilder.createTBAARoot("ijk tbaa");
+  
+  auto defineFields = [&] (llvm::StructType* type, 
+                           std::initializer_list<const char*> fieldNames) {
+    assert(fieldNames.size() == type->getNumElements());
+    unsigned i = 0;
+    for (auto fieldName : fieldNames) {
+      std::string name = type->getName().str() + "." + fieldName;
+      llvm::MDNode* scalar = mdBuilder.createTBAAScalarTypeNode(name, root);
+      m_tbaaFieldTags[std::make_pair(type, i++)] = 
+              mdBuilder.createTBAAStructTagNode(scalar, scalar, 0);
+    }
+  };
+  defineFields(m_stringData, {"size", "data", "count", "capacity"});
+  defineFields(m_typedValue, {"type", "num", "dbl", "pstr", "parr", "pobj"});
+  defineFields(m_arrayData, {"kind", "is_static", "size", "used", "elems", "keys", "count"});
+  defineFields(m_objectData, {"cls", "count"});
+  defineFields(m_class, {"name", "parent", "vtable", "methods", "num_methods", 
+                         "size", "prop_defaults", "prop_names", "num_props"});
+  defineFields(m_methodEntry, {"name", "fn"});
+  defineFields(m_methodCache, {"cls", "fn"});
+  defineFields(m_propCache, {"cls", "index"});
+  defineFields(m_generatorData, {"header", "resume", "state", "next_key", 
+                                 "key", "current", "iter_window"});
+  defineFields(m_stack, {"size", "max_size", "frames"});
+  
+  llvm::MDNode* slot = mdBuilder.createTBAAScalarTypeNode("stack_t.frame", root);
+  m_tbaaStackSlotTag = mdBuilder.createTBAAStructTagNode(slot, slot, 0);
+}
+
+llvm::MDNode* Translator::tbaaTagFor(llvm::Value* ptr) {
+  auto gep = llvm::dyn_cast<llvm::GEPOperator>(ptr);
+  if (!gep) return nullptr;
+  
+  llvm::Type* baseType = gep->getPointerOperandType()->getPointerElementType();
+  if (gep->getNumIndices() == 2) {
+    // CreateStructGEP(base_p, field)
+    auto structType = llvm::dyn_cast<llvm::StructType>(baseType);
+    auto field = llvm::dyn_cast<llvm::ConstantInt>(gep->getOperand(2));
+    if (!structType || !field) return nullptr;
+    auto it = m_tbaaFieldTags.find(
+            std::make_pair(structType, unsigned(field->getZExtValue())));
+    return it != end(m_tbaaFieldTags) ? it->second : nullptr;
+  }
+  if (gep->getNumIndices() == 1 && baseType == m_typedValue->getPointerTo()) {
+    // A frame of stack_t.frames.
+    return m_tbaaStackSlotTag;
+  }
+  return nullptr;
+}
+
+void Translator::annotateTBAA(llvm::Function* function) {
+  for (auto& block : *function) {
+    for (auto& inst : block) {
+      llvm::Value* ptr;
+      if (auto load = llvm::dyn_cast<llvm::LoadInst>(&inst)) {
+        ptr = load->getPointerOperand();
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&inst)) {
+        ptr = store->getPointerOperand();
+      } else {
+        continue;
+      }
+      if (llvm::MDNode* tag = tbaaTagFor(ptr)) {
+        inst.setMetadata(llvm::LLVMContext::MD_tbaa, tag);
+      }
+    }
+  }
+}
+
 void Translator::defineTypes() {
   defineStringData();
   defineTypedValue();
+  defineArrayData();
+  defineObjectTypes();
   defineStack();
+  defineTBAA();
 }
 
 llvm::Value* Translator::createTypedValueNull() {
-  llvm::Value* typed_value_p = m_builder->CreateAlloca(m_typedValue);
+  llvm::Value* typed_value_p = createEntryAlloca(m_typedValue);
   llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
   llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfNull);
   m_builder->CreateStore(type, type_p);
@@ -484,15 +2563,21 @@ llvm::Value* Translator::createTypedValueNull() {
   llvm::Value* num_p = m_builder->CreateStructGEP(typed_value_p, 1);
   m_builder->CreateStore(numValue, num_p);
   
-  llvm::Value* string_data_p = m_builder->CreateAlloca(m_stringData);
-  llvm::Value* size_p = m_builder->CreateStructGEP(string_data_p, 0);
-  llvm::Value* size = llvm::ConstantInt::get(llvm::Type::getInt32Ty(m_ctx), 1);
-  m_builder->CreateStore(size, size_p);
-  llvm::Value* str_pp = m_builder->CreateStructGEP(string_data_p, 1);
-  llvm::Value* str_p  = m_builder->CreateConstGEP2_64(m_emptyString, 0, 0);
-  m_builder->CreateStore(str_p, str_pp);
+  // The module's empty string, never counted.  A value may be stored
+  // somewhere that outlives this frame, so its string_data must not
+  // live in the frame.
   llvm::Value* string_data_pp = m_builder->CreateStructGEP(typed_value_p, 3);
-  m_builder->CreateStore(string_data_p, string_data_pp);
+  m_builder->CreateStore(m_emptyStringData, string_data_pp);
+  
+  llvm::Value* array_data_pp = m_builder->CreateStructGEP(typed_value_p, 4);
+  m_builder->CreateStore(
+          llvm::ConstantPointerNull::get(m_arrayData->getPointerTo()), 
+          array_data_pp);
+  
+  llvm::Value* object_data_pp = m_builder->CreateStructGEP(typed_value_p, 5);
+  m_builder->CreateStore(
+          llvm::ConstantPointerNull::get(m_objectData->getPointerTo()), 
+          object_data_pp);
   
   return typed_value_p;
 }
@@ -511,84 +2596,1154 @@ llvm::Value* Translator::createTypedValueInt(int64_t num) {
   return typed_value_p;
 }
 
+llvm::Value* Translator::createTypedValueDouble(double dbl) {
+  llvm::Value* typed_value_p = createTypedValueNull();
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfDouble);
+  m_builder->CreateStore(type, type_p);
+  
+  llvm::Value* dbl_p = m_builder->CreateStructGEP(typed_value_p, 2);
+  m_builder->CreateStore(llvm::ConstantFP::get(llvm::Type::getDoubleTy(m_ctx), dbl), dbl_p);
+  
+  return typed_value_p;
+}
+
 llvm::Value* Translator::createTypedValueString(std::string str) {
-  llvm::StringRef strRef(str);
-  llvm::Constant* constStrVal = llvm::ConstantDataArray::getString(m_ctx, strRef);
+  llvm::Value* typed_value_p = createTypedValueNull();
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfString);
+  m_builder->CreateStore(type, type_p);
+  
+  // Interned like createConstantTypedValue()'s, so the literal stays
+  // valid wherever it is stored.
+  llvm::Value* string_data_pp = m_builder->CreateStructGEP(typed_value_p, 3);
+  m_builder->CreateStore(createConstantStringData(str), string_data_pp);
+  
+  return typed_value_p;
+}
+
+llvm::Value* Translator::createTypedValueArray(const ArrayData* arr) {
+  llvm::Value* typed_value_p = createTypedValueNull();
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfArray);
+  m_builder->CreateStore(type, type_p);
+  
+  llvm::Value* array_data_pp = m_builder->CreateStructGEP(typed_value_p, 4);
+  m_builder->CreateStore(createConstantArrayData(arr), array_data_pp);
+  
+  return typed_value_p;
+}
+
+llvm::Value* Translator::createTypedValueObject(llvm::Value* object_p) {
+  llvm::Value* typed_value_p = createTypedValueNull();
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfObject);
+  m_builder->CreateStore(type, type_p);
+  
+  llvm::Value* object_data_pp = m_builder->CreateStructGEP(typed_value_p, 5);
+  m_builder->CreateStore(object_p, object_data_pp);
+  
+  return typed_value_p;
+}
+
+llvm::Value* Translator::createTypedValueUninit() {
+  llvm::Value* typed_value_p = createTypedValueNull();
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  m_builder->CreateStore(
+          llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfUninit), type_p);
+  return typed_value_p;
+}
+
+llvm::Value* Translator::createTypedValueBool(llvm::Value* flag) {
+  llvm::Value* typed_value_p = createTypedValueNull();
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfBoolean);
+  m_builder->CreateStore(type, type_p);
+  
+  llvm::Value* num_p = m_builder->CreateStructGEP(typed_value_p, 1);
+  m_builder->CreateStore(m_builder->CreateZExt(flag, llvm::Type::getInt64Ty(m_ctx)), num_p);
+  
+  return typed_value_p;
+}
+
+llvm::GlobalVariable* Translator::getGlobalSlot(const std::string& name) {
+  auto it = m_globalSlots.find(name);
+  if (it != end(m_globalSlots)) return it->second;
+  
+  // A pointer to the runtime's slot for the global, set by the module's
+  // constructor; see emitGlobalTable().  Weak, so that the modules of a
+  // program linked together share it.
+  llvm::PointerType* slotType = m_typedValue->getPointerTo();
+  llvm::GlobalVariable* slot = new llvm::GlobalVariable(
+          *m_mod, slotType, false,
+          llvm::GlobalValue::WeakAnyLinkage, 
+          llvm::ConstantPointerNull::get(slotType),
+          "ijk.global." + name);
+  m_globalSlots[name] = slot;
+  return slot;
+}
+
+llvm::Value* Translator::insertInstructionLoadGlobalSlot(const std::string& name) {
+  return m_builder->CreateLoad(getGlobalSlot(name), name);
+}
+
+void Translator::emitGlobalTable() {
+  if (m_globalSlots.empty()) return;
+  
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  std::vector<llvm::Constant*> entries;
+  for (auto& kv : m_globalSlots) {
+    std::vector<llvm::Constant*> fields;
+    fields.push_back(createConstantCString(kv.first));
+    fields.push_back(kv.second);
+    entries.push_back(llvm::ConstantStruct::get(m_globalEntry, fields));
+  }
+  std::vector<llvm::Constant*> terminator;
+  terminator.push_back(llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(int8PtrTy)));
+  terminator.push_back(llvm::ConstantPointerNull::get(m_typedValue->getPointerTo()));
+  entries.push_back(llvm::ConstantStruct::get(m_globalEntry, terminator));
+  
+  llvm::ArrayType* tableType = llvm::ArrayType::get(m_globalEntry, entries.size());
+  llvm::GlobalVariable* table = new llvm::GlobalVariable(
+          *m_mod, tableType, true,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantArray::get(tableType, entries),
+          "ijk.globals");
+  
+  // Point the slots at the runtime's before any code of the module runs,
+  // however it is entered.
+  llvm::Function* init = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), false),
+          llvm::Function::InternalLinkage, 
+          "ijk_globals_init", 
+          m_mod);
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(m_ctx, "entry", init));
+  llvm::Constant* zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0);
+  llvm::Constant* indices[] = { zero, zero };
+  builder.CreateCall(m_CFunctionGlobalsRegister, 
+                     llvm::ConstantExpr::getGetElementPtr(table, indices));
+  builder.CreateRetVoid();
+  llvm::appendToGlobalCtors(*m_mod, init, 0);
+}
+
+std::pair<llvm::GlobalVariable*, llvm::GlobalVariable*> Translator::getStaticLocal(
+  const std::string& name, 
+  const KnownValue& init) 
+{
+  auto const key = m_currentFunctionName + "::" + name;
+  auto it = m_staticLocals.find(key);
+  if (it != end(m_staticLocals)) return it->second;
+  
+  // A literal initialiser goes straight into the global, leaving
+  // nothing to run on the first call.
+  TypedValue value;
+  value.m_type = KindOfNull;
+  auto const constant = init.isConstant && 
+    (init.constant.isNull() || init.constant.isBoolean() || init.constant.isInteger() ||
+     init.constant.isDouble() || init.constant.isString() || init.constant.isArray());
+  if (constant) {
+    value = *init.constant.asTypedValue();
+  }
+  llvm::GlobalVariable* slot = new llvm::GlobalVariable(
+          *m_mod, m_typedValue, false,
+          llvm::GlobalValue::InternalLinkage, 
+          createConstantTypedValue(value),
+          "ijk.static." + key);
+  llvm::GlobalVariable* guard = new llvm::GlobalVariable(
+          *m_mod, llvm::Type::getInt1Ty(m_ctx), false,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantInt::get(llvm::Type::getInt1Ty(m_ctx), constant),
+          "ijk.static." + key + ".init");
+  return m_staticLocals[key] = std::make_pair(slot, guard);
+}
+
+void Translator::forgetGlobalLocals() {
+  for (auto localId : m_globalLocals) {
+    m_localKnown.erase(localId);
+  }
+}
+
+llvm::Constant* Translator::createConstantCString(const std::string& str) {
+  llvm::Constant* constStrVal = llvm::ConstantDataArray::getString(m_ctx, str);
   llvm::GlobalVariable* global_str = new llvm::GlobalVariable(
           *m_mod, constStrVal->getType(), true,
           llvm::GlobalValue::InternalLinkage, constStrVal);
+  
+  llvm::Constant* zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0);
+  llvm::Constant* indices[] = { zero, zero };
+  return llvm::ConstantExpr::getGetElementPtr(global_str, indices);
+}
+
+llvm::Constant* Translator::createConstantStringData(const std::string& str) {
+  // Interned, so equal literals and folded results share one constant.
+  auto it = m_internedStrings.find(str);
+  if (it != end(m_internedStrings)) return it->second;
+  
+  std::vector<llvm::Constant*> elems;
+  elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(m_ctx), str.size()+1));
+  elems.push_back(createConstantCString(str));
+  elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(m_ctx), kStaticRefCount));
+  elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(m_ctx), 0));
+  llvm::Constant* global = new llvm::GlobalVariable(
+          *m_mod, m_stringData, true,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantStruct::get(m_stringData, elems));
+  m_internedStrings[str] = global;
+  return global;
+}
+
+llvm::Constant* Translator::createConstantTypedValue(const TypedValue& tv) {
+  DataType type = tv.m_type;
+  int64_t num = 0;
+  double dbl = 0.0;
+  llvm::Constant* pstr = m_emptyStringData;
+  llvm::Constant* parr = llvm::ConstantPointerNull::get(m_arrayData->getPointerTo());
+  
+  switch (tv.m_type) {
+    case KindOfUninit:
+    case KindOfNull:
+      type = KindOfNull;
+      break;
+    case KindOfBoolean:
+    case KindOfInt64:
+      num = tv.m_data.num;
+      break;
+    case KindOfDouble:
+      dbl = tv.m_data.dbl;
+      break;
+    case KindOfStaticString:
+    case KindOfString:
+      type = KindOfString;
+      pstr = createConstantStringData(tv.m_data.pstr->toCppString());
+      break;
+    case KindOfArray:
+      parr = createConstantArrayData(tv.m_data.parr);
+      break;
+    default:
+      always_assert(!"unsupported static array element");
+  }
+  
+  std::vector<llvm::Constant*> elems;
+  elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), type));
+  elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), num));
+  elems.push_back(llvm::ConstantFP::get(llvm::Type::getDoubleTy(m_ctx), dbl));
+  elems.push_back(pstr);
+  elems.push_back(parr);
+  elems.push_back(llvm::ConstantPointerNull::get(m_objectData->getPointerTo()));
+  return llvm::ConstantStruct::get(m_typedValue, elems);
+}
+
+llvm::Constant* Translator::createConstantArrayData(const ArrayData* arr) {
+  // Static arrays are interned by HHVM, so one global per ArrayData.
+  auto it = m_staticArrays.find(arr);
+  if (it != end(m_staticArrays)) return it->second;
+  
+  auto const packed = arr->isPacked();
+  std::vector<llvm::Constant*> elems;
+  std::vector<llvm::Constant*> keys;
+  for (ArrayIter iter(arr); iter; ++iter) {
+    elems.push_back(createConstantTypedValue(*iter.secondRef().asTypedValue()));
+    if (!packed) {
+      Variant key = iter.first();
+      keys.push_back(createConstantTypedValue(*key.asTypedValue()));
+    }
+  }
+  
+  auto globalTypedValues = [&] (const std::vector<llvm::Constant*>& values) -> llvm::Constant* {
+    if (values.empty()) {
+      return llvm::ConstantPointerNull::get(m_typedValue->getPointerTo());
+    }
+    llvm::ArrayType* type = llvm::ArrayType::get(m_typedValue, values.size());
+    llvm::GlobalVariable* global = new llvm::GlobalVariable(
+            *m_mod, type, true,
+            llvm::GlobalValue::InternalLinkage, 
+            llvm::ConstantArray::get(type, values));
+    llvm::Constant* zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0);
+    llvm::Constant* indices[] = { zero, zero };
+    return llvm::ConstantExpr::getGetElementPtr(global, indices);
+  };
+  
+  auto const kind = packed ? ArrayDataKind::Packed : ArrayDataKind::Mixed;
+  std::vector<llvm::Constant*> fields;
+  fields.push_back(llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), static_cast<uint8_t>(kind)));
+  fields.push_back(llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), 1));
+  fields.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), elems.size()));
+  fields.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), elems.size()));
+  fields.push_back(globalTypedValues(elems));
+  fields.push_back(packed 
+          ? llvm::ConstantPointerNull::get(m_typedValue->getPointerTo())
+          : globalTypedValues(keys));
+  fields.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(m_ctx), kStaticRefCount));
+  llvm::Constant* array_data_p = new llvm::GlobalVariable(
+          *m_mod, m_arrayData, true,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantStruct::get(m_arrayData, fields));
+  m_staticArrays[arr] = array_data_p;
+  return array_data_p;
+}
+
+void Translator::insertInstructionFPushFuncD(
+  llvm::Value* stack_p, 
+  uint32_t numArgs, 
+  const StringData* funcName) 
+{
+  PseudoActRec* par = m_arena.make<PseudoActRec>(funcName, numArgs);
+  auto it = s_mathBuiltins.find(lower_name(funcName));
+  if (it != end(s_mathBuiltins) && it->second.second == numArgs) {
+    par->m_builtin = it->second.first;
+  }
+  pushPAR(par);
+}
+
+void Translator::insertInstructionFPassCE(llvm::Value* stack_p, uint32_t paramId) {
+//  llvm::Value* top_p = insertInstructionGetTopOfStack(stack_p);
+//  PseudoActRec* par = currentPAR();
+//  par->setParam(top_p);
+}
+
+void Translator::insertInstructionFPushCtorD(
+  llvm::Value* stack_p, 
+  uint32_t numArgs, 
+  const StringData* className) 
+{
+  const ClassInfo* cls = findClass(className);
+  if (!cls) {
+    // isTranslatable() falls back for these, save where it can't.
+    insertInstructionFatal(folly::format(
+            "Class {} is not defined in the translated unit", className->data()).str());
+    insertInstructionNull(stack_p);
+    pushPAR(m_arena.make<PseudoActRec>(nullptr, numArgs));
+    return;
+  }
+  if (cls->preClass->attrs() & AttrAbstract) {
+    insertInstructionFatal(folly::format(
+            "Cannot instantiate abstract class {}", className->data()).str());
+  }
+  
+  llvm::Value* object_p = m_builder->CreateCall(m_CFunctionObjectAlloc, cls->classGlobal);
+  insertInstructionStackPush(stack_p, createTypedValueObject(object_p));
+  m_stackKnown.back().cls = cls;
+  m_stackKnown.back().exactClass = true;
+  
+  auto ctor = cls->methods.find("__construct");
+  if (ctor == end(cls->methods)) {
+    pushPAR(m_arena.make<PseudoActRec>(nullptr, numArgs));
+    return;
+  }
+  PseudoActRec* par = m_arena.make<PseudoActRec>(ctor->second->name(), numArgs);
+  par->m_callee = declareFunction(ctor->second);
+  par->m_this = object_p;
+  pushPAR(par);
+}
+
+void Translator::insertInstructionFPushObjMethodD(
+  llvm::Value* stack_p, 
+  uint32_t numArgs, 
+  const StringData* methodName) 
+{
+  KnownValue base = topStackKnown();
+  llvm::Value* base_p = insertInstructionStackPop(stack_p);
+  if (!base.cls) {
+    insertInstructionCheckObject(base_p, folly::format(
+            "Call to a member function {}() on a non-object", methodName->data()).str());
+  }
+  llvm::Value* object_p = m_builder->CreateLoad(m_builder->CreateStructGEP(base_p, 5));
+  PseudoActRec* par = m_arena.make<PseudoActRec>(methodName, numArgs);
+  par->m_this = object_p;
+  par->m_receiver = base_p;
+  
+  auto const name = lower_name(methodName);
+  const Func* method = nullptr;
+  if (base.cls) {
+    auto it = base.cls->methods.find(name);
+    if (it != end(base.cls->methods)) method = it->second;
+  }
+  
+  if (method && (base.exactClass || base.cls->isFinal() || method->isStatic() ||
+                 (method->attrs() & (AttrPrivate | AttrFinal)))) {
+    // No subclass can override what gets called here.
+    par->m_callee = declareFunction(method);
+    if (method->isStatic()) par->m_this = nullptr;
+  } else if (method && base.cls->vtableSlots.count(name)) {
+    // The receiver is base.cls or a subclass, which share vtable slots.
+    llvm::Value* cls_p = m_builder->CreateLoad(m_builder->CreateStructGEP(object_p, 0));
+    llvm::Value* vtable_p = m_builder->CreateLoad(m_builder->CreateStructGEP(cls_p, 2));
+    llvm::Value* slot = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 
+                                               base.cls->vtableSlots.at(name));
+    llvm::Value* fn = m_builder->CreateLoad(m_builder->CreateGEP(vtable_p, slot));
+    par->m_callee = m_builder->CreateBitCast(fn, m_dispatchFunctionType->getPointerTo());
+    par->m_dynamic = true;
+  } else {
+    // Nothing is known about the receiver: use a per-call-site inline
+    // cache keyed on its class, filled in by the runtime on a miss.
+    llvm::GlobalVariable* cache = new llvm::GlobalVariable(
+            *m_mod, m_methodCache, false,
+            llvm::GlobalValue::InternalLinkage, 
+            llvm::ConstantAggregateZero::get(m_methodCache),
+            "method_cache");
+    llvm::Value* cls_p = m_builder->CreateLoad(m_builder->CreateStructGEP(object_p, 0));
+    llvm::Value* cached_cls_p = m_builder->CreateLoad(m_builder->CreateStructGEP(cache, 0));
+    llvm::Value* hit = m_builder->CreateICmpEQ(cls_p, cached_cls_p);
+    llvm::BasicBlock* hitBlock = llvm::BasicBlock::Create(m_ctx, "method_cache_hit", m_currentFunction);
+    llvm::BasicBlock* missBlock = llvm::BasicBlock::Create(m_ctx, "method_cache_miss", m_currentFunction);
+    llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "method_cache_join", m_currentFunction);
+    createProfiledCondBr(hit, hitBlock, missBlock, probeKey("method_cache"));
+    
+    m_builder->SetInsertPoint(hitBlock);
+    llvm::Value* cached_fn = m_builder->CreateLoad(m_builder->CreateStructGEP(cache, 1));
+    m_builder->CreateBr(joinBlock);
+    
+    m_builder->SetInsertPoint(missBlock);
+    llvm::Value* looked_up_fn = m_builder->CreateCall3(
+            m_CFunctionMethodLookup, cls_p, createConstantCString(name), cache);
+    m_builder->CreateBr(joinBlock);
+    
+    m_builder->SetInsertPoint(joinBlock);
+    llvm::PHINode* fn = m_builder->CreatePHI(llvm::Type::getInt8Ty(m_ctx)->getPointerTo(), 2);
+    fn->addIncoming(cached_fn, hitBlock);
+    fn->addIncoming(looked_up_fn, missBlock);
+    par->m_callee = m_builder->CreateBitCast(fn, m_dispatchFunctionType->getPointerTo());
+    par->m_dynamic = true;
+  }
+  pushPAR(par);
+}
+
+void Translator::insertInstructionFPushClsMethodD(
+  llvm::Value* stack_p, 
+  uint32_t numArgs, 
+  const StringData* methodName, 
+  const StringData* className) 
+{
+  const ClassInfo* cls = findClass(className);
+  const Func* method = nullptr;
+  if (cls) {
+    auto it = cls->methods.find(lower_name(methodName));
+    if (it != end(cls->methods)) method = it->second;
+  }
+  if (!method) {
+    // isTranslatable() falls back for these, save where it can't.
+    insertInstructionFatal(folly::format(
+            "Method {}::{}() is not defined in the translated unit", 
+            className->data(), methodName->data()).str());
+    pushPAR(m_arena.make<PseudoActRec>(nullptr, numArgs));
+    return;
+  }
+  
+  if (!method->isStatic() && !m_currentThis) {
+    // isTranslatable() falls back for these too.
+    insertInstructionFatal(folly::format(
+            "Non-static method {}::{}() cannot be called statically", 
+            className->data(), methodName->data()).str());
+    pushPAR(m_arena.make<PseudoActRec>(nullptr, numArgs));
+    return;
+  }
+  
+  // The class is named, so this is always a direct call.
+  PseudoActRec* par = m_arena.make<PseudoActRec>(methodName, numArgs);
+  par->m_callee = declareFunction(method);
+  if (!method->isStatic()) {
+    // parent::foo() and friends forward $this.
+    par->m_this = m_currentThis;
+  }
+  pushPAR(par);
+}
+
+llvm::Value* Translator::insertInstructionFCall(llvm::Value* stack_p, uint32_t numArgs) {
+  forgetGlobalLocals();
+  PseudoActRec* par = popPAR();
+  std::vector<KnownValue> argKnown;
+  if (m_stackKnown.size() >= numArgs) {
+    argKnown.assign(m_stackKnown.end() - numArgs, m_stackKnown.end());
+  }
+  std::vector<llvm::Value*> args(numArgs);
+  for (int i = numArgs-1; i >= 0; --i) {
+    args[i] = insertInstructionStackPop(stack_p);
+  }
+  if (llvm::Value* folded = insertInstructionFoldedCall(stack_p, par, args, argKnown)) {
+    return folded;
+  }
+  llvm::Value* retval = createTypedValueNull();
+  if (par->m_builtin != MathBuiltin::None) {
+    return insertInstructionMathBuiltin(stack_p, par, args);
+  }
+  
+  auto packArgs = [&] () -> llvm::Value* {
+    if (numArgs == 0) {
+      return llvm::ConstantPointerNull::get(
+              m_typedValue->getPointerTo()->getPointerTo());
+    }
+    llvm::Value* argv = createEntryAlloca(
+            llvm::ArrayType::get(m_typedValue->getPointerTo(), numArgs), "argv");
+    for (auto i = uint32_t{0}; i < numArgs; ++i) {
+      m_builder->CreateStore(args[i], m_builder->CreateConstGEP2_64(argv, 0, i));
+    }
+    return m_builder->CreateConstGEP2_64(argv, 0, 0);
+  };
+  
+  llvm::Value* callee = par->m_callee;
+  if (!callee && par->m_funcName) {
+    // Function names are case-insensitive, and only user functions bind
+    // here, not the runtime's symbols.
+    auto it = m_userFuncs.find(lower_name(par->m_funcName));
+    if (it != end(m_userFuncs)) callee = declareFunction(it->second);
+  }
+  
+  insertInstructionProbe(probeKey("call"));
+  if (!callee) {
+    if (par->m_funcName) {
+      // Not in the unit: a builtin or a function the VM knows about.
+      m_builder->CreateCall4(
+              m_CFunctionVMCall, 
+              createConstantCString(par->m_funcName->toCppString()),
+              retval,
+              llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), numArgs), 
+              packArgs());
+    }
+    // Otherwise e.g. new on a class without a constructor.  Either way
+    // nothing took over the arguments.
+    for (llvm::Value* arg : args) {
+      insertInstructionDecRef(arg);
+    }
+    insertInstructionStackPush(stack_p, retval);
+    return retval;
+  }
+  
+  llvm::CallInst* call;
+  if (par->m_dynamic) {
+    llvm::Value* argv_p = packArgs();
+    call = m_builder->CreateCall4(
+            callee, retval, par->m_this, 
+            llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), numArgs), 
+            argv_p);
+  } else {
+    // A call leaving out defaulted parameters binds to the entry that
+    // fills in just those.
+    auto entries = m_dvEntries.find(llvm::dyn_cast<llvm::Function>(callee));
+    if (entries != end(m_dvEntries) && entries->second.count(numArgs)) {
+      callee = entries->second[numArgs];
+    }
+    llvm::FunctionType* functionType = llvm::cast<llvm::FunctionType>(
+            callee->getType()->getPointerElementType());
+    std::vector<llvm::Value*> params;
+    params.push_back(retval);
+    if (par->m_this) {
+      params.push_back(par->m_this);
+    }
+    // Missing arguments are Uninit, which a trampoline reads as not
+    // passed.  A translated callee only sees them for parameters without
+    // a default, which PHP leaves null; leaving out defaulted ones binds
+    // to a DV entry above.  Surplus arguments are dropped.
+    for (auto i = uint32_t{0}; params.size() < functionType->getNumParams(); ++i) {
+      params.push_back(i < numArgs ? args[i] : createTypedValueUninit());
+    }
+    call = m_builder->CreateCall(callee, params);
+  }
+  if (m_profileMode == ProfileMode::Use && !m_profile.empty() &&
+      m_profile.count(probeKey("call")) == 0) {
+    // Never reached while profiling; don't spend code size inlining it.
+    call->addAttribute(llvm::AttributeSet::FunctionIndex, llvm::Attribute::NoInline);
+  }
+  if (par->m_receiver) {
+    // Held until now so that $this outlives the call.
+    insertInstructionDecRef(par->m_receiver);
+  }
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
+}
+
+void Translator::insertInstructionCreateCont(llvm::Value* stack_p) {
+  // The ramp has already created the generator, so this only pushes
+  // what the first resume was sent.
+  llvm::Value* sent_p = createTypedValueNull();
+  insertInstructionCopyTypedValue(sent_p, m_generatorSent);
+  insertInstructionStackPush(stack_p, sent_p);
+}
+
+void Translator::insertInstructionYield(llvm::Value* stack_p, bool withKey) {
+  llvm::Value* value_p = insertInstructionStackPop(stack_p);
+  llvm::Value* key_p = withKey 
+    ? insertInstructionStackPop(stack_p) 
+    : llvm::ConstantPointerNull::get(m_typedValue->getPointerTo());
+  m_builder->CreateCall3(m_CFunctionGeneratorYield, m_currentGenerator, value_p, key_p);
+  
+  m_resumeBlocks.push_back(llvm::BasicBlock::Create(m_ctx, "resume", m_currentFunction));
+  llvm::Value* state_p = m_builder->CreateStructGEP(m_currentGenerator, 2);
+  m_builder->CreateStore(
+          llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), m_resumeBlocks.size()), 
+          state_p);
+  m_builder->CreateRetVoid();
+  
+  m_builder->SetInsertPoint(m_resumeBlocks.back());
+  llvm::Value* sent_p = createTypedValueNull();
+  insertInstructionCopyTypedValue(sent_p, m_generatorSent);
+  insertInstructionStackPush(stack_p, sent_p);
+}
+
+void Translator::insertInstructionAwait(llvm::Value* stack_p) {
+  llvm::Value* awaitable_p = insertInstructionStackPop(stack_p);
+  llvm::Value* result_p = createTypedValueNull();
+  m_builder->CreateCall2(m_CFunctionAwait, awaitable_p, result_p);
+  insertInstructionStackPush(stack_p, result_p);
+}
+
+llvm::Value* Translator::insertInstructionThis(llvm::Value* stack_p) {
+  if (!m_currentThis) {
+    return insertInstructionNull(stack_p);
+  }
+  llvm::Value* retval = createTypedValueObject(m_currentThis);
+  insertInstructionStackPush(stack_p, retval);
+  m_stackKnown.back().cls = m_currentClass;
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionPropAddress(
+  const KnownValue& base, 
+  llvm::Value* object_p, 
+  const StringData* propName) 
+{
+  if (base.cls) {
+    // Declared properties sit at the same offset in every subclass.
+    auto it = base.cls->propIndex.find(propName->toCppString());
+    if (it != end(base.cls->propIndex)) {
+      llvm::Value* obj_p = m_builder->CreateBitCast(
+              object_p, base.cls->objectType->getPointerTo());
+      return m_builder->CreateStructGEP(obj_p, it->second + 1);
+    }
+  }
+  llvm::GlobalVariable* cache = new llvm::GlobalVariable(
+          *m_mod, m_propCache, false,
+          llvm::GlobalValue::InternalLinkage, 
+          llvm::ConstantAggregateZero::get(m_propCache),
+          "prop_cache");
+  return m_builder->CreateCall3(m_CFunctionObjectProp, object_p, 
+                                createConstantCString(propName->toCppString()), 
+                                cache);
+}
+
+llvm::Value* Translator::insertInstructionCGetProp(
+  llvm::Value* stack_p, 
+  const KnownValue& base,
+  llvm::Value* object_p, 
+  const StringData* propName) 
+{
+  llvm::Value* prop_p = insertInstructionPropAddress(base, object_p, propName);
+  llvm::Value* retval = createTypedValueNull();
+  insertInstructionCopyTypedValue(retval, prop_p);
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionSetProp(
+  llvm::Value* stack_p, 
+  const KnownValue& base,
+  llvm::Value* object_p, 
+  const StringData* propName,
+  llvm::Value* value_p) 
+{
+  llvm::Value* prop_p = insertInstructionPropAddress(base, object_p, propName);
+  insertInstructionAssign(prop_p, value_p);
+  insertInstructionStackPush(stack_p, value_p);
+  insertInstructionDecRef(value_p);
+  return value_p;
+}
+
+llvm::Value* Translator::insertInstructionNull(llvm::Value* stack_p) {
+  llvm::Value* retval = createTypedValueNull();
+  m_staticTypedValues.insert(retval);
+  insertInstructionStackPush(stack_p, retval);
+  m_stackKnown.back().isConstant = true;
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionInt(llvm::Value* stack_p, int64_t num) {
+  llvm::Value* retval = createTypedValueInt(num);
+  m_staticTypedValues.insert(retval);
+  insertInstructionStackPush(stack_p, retval);
+  m_stackKnown.back().isConstant = true;
+  m_stackKnown.back().constant = num;
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionDouble(llvm::Value* stack_p, double dbl) {
+  llvm::Value* retval = createTypedValueDouble(dbl);
+  m_staticTypedValues.insert(retval);
+  insertInstructionStackPush(stack_p, retval);
+  m_stackKnown.back().isConstant = true;
+  m_stackKnown.back().constant = dbl;
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionArith(llvm::Value* stack_p, ArithOp op) {
+  llvm::Value* b_p = insertInstructionStackPop(stack_p);
+  llvm::Value* a_p = insertInstructionStackPop(stack_p);
+  llvm::Value* retval = createTypedValueNull();
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  
+  // Ints and doubles are handled inline: ints first, moving to doubles
+  // on overflow or an inexact quotient as PHP does.  Anything else is
+  // converted by the runtime.  Once the operand types are known the
+  // checks fold away.
+  llvm::BasicBlock* intBlock = llvm::BasicBlock::Create(m_ctx, "arith_int", m_currentFunction);
+  llvm::BasicBlock* checkBlock = llvm::BasicBlock::Create(m_ctx, "arith_check", m_currentFunction);
+  llvm::BasicBlock* doubleBlock = llvm::BasicBlock::Create(m_ctx, "arith_double", m_currentFunction);
+  llvm::BasicBlock* slowBlock = llvm::BasicBlock::Create(m_ctx, "arith_slow", m_currentFunction);
+  llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "arith_join", m_currentFunction);
+  
+  llvm::Value* aInt = insertInstructionIsType(a_p, KindOfInt64);
+  llvm::Value* bInt = insertInstructionIsType(b_p, KindOfInt64);
+  llvm::Value* aNumeric = m_builder->CreateOr(aInt, insertInstructionIsType(a_p, KindOfDouble));
+  llvm::Value* bNumeric = m_builder->CreateOr(bInt, insertInstructionIsType(b_p, KindOfDouble));
+  m_builder->CreateCondBr(m_builder->CreateAnd(aInt, bInt), intBlock, checkBlock);
+  m_builder->SetInsertPoint(checkBlock);
+  m_builder->CreateCondBr(m_builder->CreateAnd(aNumeric, bNumeric), doubleBlock, slowBlock);
+  
+  m_builder->SetInsertPoint(intBlock);
+  llvm::Value* a = m_builder->CreateLoad(m_builder->CreateStructGEP(a_p, 1));
+  llvm::Value* b = m_builder->CreateLoad(m_builder->CreateStructGEP(b_p, 1));
+  if (op == ArithOp::Div) {
+    llvm::BasicBlock* remBlock = llvm::BasicBlock::Create(m_ctx, "arith_rem", m_currentFunction);
+    llvm::BasicBlock* exactBlock = llvm::BasicBlock::Create(m_ctx, "arith_exact", m_currentFunction);
+    llvm::Value* trapping = m_builder->CreateOr(
+            m_builder->CreateICmpEQ(b, llvm::ConstantInt::get(int64Ty, 0)),
+            m_builder->CreateAnd(
+                    m_builder->CreateICmpEQ(
+                            a, llvm::ConstantInt::get(int64Ty, std::numeric_limits<int64_t>::min())),
+                    m_builder->CreateICmpEQ(b, llvm::ConstantInt::get(int64Ty, -1))));
+    m_builder->CreateCondBr(trapping, doubleBlock, remBlock);
+    m_builder->SetInsertPoint(remBlock);
+    llvm::Value* exact = m_builder->CreateICmpEQ(
+            m_builder->CreateSRem(a, b), llvm::ConstantInt::get(int64Ty, 0));
+    m_builder->CreateCondBr(exact, exactBlock, doubleBlock);
+    m_builder->SetInsertPoint(exactBlock);
+    insertInstructionStoreNumber(retval, m_builder->CreateSDiv(a, b));
+  } else {
+    llvm::Intrinsic::ID id = op == ArithOp::Add ? llvm::Intrinsic::sadd_with_overflow
+                           : op == ArithOp::Sub ? llvm::Intrinsic::ssub_with_overflow
+                           :                      llvm::Intrinsic::smul_with_overflow;
+    llvm::Value* result = m_builder->CreateCall2(
+            llvm::Intrinsic::getDeclaration(m_mod, id, int64Ty), a, b);
+    llvm::BasicBlock* noOverflowBlock = llvm::BasicBlock::Create(m_ctx, "arith_no_overflow", m_currentFunction);
+    llvm::BranchInst* br = m_builder->CreateCondBr(
+            m_builder->CreateExtractValue(result, 1), doubleBlock, noOverflowBlock);
+    llvm::MDBuilder mdBuilder(m_ctx);
+    br->setMetadata(llvm::LLVMContext::MD_prof, 
+                    mdBuilder.createBranchWeights(1, ProfileData::kHotRatio));
+    m_builder->SetInsertPoint(noOverflowBlock);
+    insertInstructionStoreNumber(retval, m_builder->CreateExtractValue(result, 0));
+  }
+  m_builder->CreateBr(joinBlock);
+  
+  m_builder->SetInsertPoint(doubleBlock);
+  llvm::Value* da = insertInstructionToDouble(a_p);
+  llvm::Value* db = insertInstructionToDouble(b_p);
+  switch (op) {
+    case ArithOp::Add:
+      insertInstructionStoreNumber(retval, m_builder->CreateFAdd(da, db));
+      break;
+    case ArithOp::Sub:
+      insertInstructionStoreNumber(retval, m_builder->CreateFSub(da, db));
+      break;
+    case ArithOp::Mul:
+      insertInstructionStoreNumber(retval, m_builder->CreateFMul(da, db));
+      break;
+    case ArithOp::Div:
+      {
+        // Division by zero is false, after a warning from the runtime.
+        llvm::BasicBlock* quotientBlock = llvm::BasicBlock::Create(m_ctx, "arith_quotient", m_currentFunction);
+        llvm::Value* isZero = m_builder->CreateFCmpOEQ(
+                db, llvm::ConstantFP::get(llvm::Type::getDoubleTy(m_ctx), 0.0));
+        m_builder->CreateCondBr(isZero, slowBlock, quotientBlock);
+        m_builder->SetInsertPoint(quotientBlock);
+        insertInstructionStoreNumber(retval, m_builder->CreateFDiv(da, db));
+      }
+      break;
+  }
+  m_builder->CreateBr(joinBlock);
+  
+  m_builder->SetInsertPoint(slowBlock);
+  m_builder->CreateCall4(
+          m_CFunctionArith, 
+          llvm::ConstantInt::get(int64Ty, static_cast<int64_t>(op)), 
+          retval, a_p, b_p);
+  m_builder->CreateBr(joinBlock);
+  
+  m_builder->SetInsertPoint(joinBlock);
+  insertInstructionDecRef(a_p);
+  insertInstructionDecRef(b_p);
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionMathBuiltin(
+  llvm::Value* stack_p, 
+  PseudoActRec* par,
+  const std::vector<llvm::Value*>& args) 
+{
+  llvm::Value* retval = createTypedValueNull();
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  llvm::Type* doubleTy = llvm::Type::getDoubleTy(m_ctx);
+  auto intrinsic = [&] (llvm::Intrinsic::ID id) {
+    return llvm::Intrinsic::getDeclaration(m_mod, id, doubleTy);
+  };
+  
+  // Numeric arguments are handled inline; anything else, and the
+  // cases whose result type PHP decides at run time, call the builtin
+  // through the VM.
+  llvm::BasicBlock* fastBlock = llvm::BasicBlock::Create(m_ctx, "math_fast", m_currentFunction);
+  llvm::BasicBlock* slowBlock = llvm::BasicBlock::Create(m_ctx, "math_slow", m_currentFunction);
+  llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "math_join", m_currentFunction);
+  llvm::Value* allNumeric = llvm::ConstantInt::getTrue(m_ctx);
+  llvm::Value* allInt = llvm::ConstantInt::getTrue(m_ctx);
+  for (auto arg : args) {
+    llvm::Value* isInt = insertInstructionIsType(arg, KindOfInt64);
+    allInt = m_builder->CreateAnd(allInt, isInt);
+    allNumeric = m_builder->CreateAnd(
+            allNumeric, m_builder->CreateOr(isInt, insertInstructionIsType(arg, KindOfDouble)));
+  }
+  llvm::Value* fast = allNumeric;
+  if (par->m_builtin == MathBuiltin::Pow) {
+    // An int result depends on whether it overflows.
+    fast = m_builder->CreateAnd(allNumeric, m_builder->CreateNot(allInt));
+  } else if (par->m_builtin == MathBuiltin::Abs) {
+    // abs(PHP_INT_MIN) is a double.
+    llvm::Value* isMin = m_builder->CreateICmpEQ(
+            m_builder->CreateLoad(m_builder->CreateStructGEP(args[0], 1)),
+            llvm::ConstantInt::get(int64Ty, std::numeric_limits<int64_t>::min()));
+    fast = m_builder->CreateAnd(allNumeric, m_builder->CreateNot(m_builder->CreateAnd(allInt, isMin)));
+  }
+  m_builder->CreateCondBr(fast, fastBlock, slowBlock);
+  
+  m_builder->SetInsertPoint(fastBlock);
+  switch (par->m_builtin) {
+    case MathBuiltin::Sqrt:
+      insertInstructionStoreNumber(retval, m_builder->CreateCall(
+              intrinsic(llvm::Intrinsic::sqrt), insertInstructionToDouble(args[0])));
+      break;
+    case MathBuiltin::Floor:
+      insertInstructionStoreNumber(retval, m_builder->CreateCall(
+              intrinsic(llvm::Intrinsic::floor), insertInstructionToDouble(args[0])));
+      break;
+    case MathBuiltin::Ceil:
+      insertInstructionStoreNumber(retval, m_builder->CreateCall(
+              intrinsic(llvm::Intrinsic::ceil), insertInstructionToDouble(args[0])));
+      break;
+    case MathBuiltin::Round:
+      // Halves round away from zero, as in PHP.
+      insertInstructionStoreNumber(retval, m_builder->CreateCall(
+              intrinsic(llvm::Intrinsic::round), insertInstructionToDouble(args[0])));
+      break;
+    case MathBuiltin::Pow:
+      insertInstructionStoreNumber(retval, m_builder->CreateCall2(
+              intrinsic(llvm::Intrinsic::pow), 
+              insertInstructionToDouble(args[0]), 
+              insertInstructionToDouble(args[1])));
+      break;
+    case MathBuiltin::Abs:
+      {
+        // Ints stay ints.
+        llvm::Value* num = m_builder->CreateLoad(m_builder->CreateStructGEP(args[0], 1));
+        llvm::Value* absNum = m_builder->CreateSelect(
+                m_builder->CreateICmpSLT(num, llvm::ConstantInt::get(int64Ty, 0)),
+                m_builder->CreateNeg(num), num);
+        llvm::Value* absDbl = m_builder->CreateCall(
+                intrinsic(llvm::Intrinsic::fabs), insertInstructionToDouble(args[0]));
+        llvm::Value* type = m_builder->CreateLoad(m_builder->CreateStructGEP(args[0], 0));
+        m_builder->CreateStore(type, m_builder->CreateStructGEP(retval, 0));
+        m_builder->CreateStore(absNum, m_builder->CreateStructGEP(retval, 1));
+        m_builder->CreateStore(absDbl, m_builder->CreateStructGEP(retval, 2));
+      }
+      break;
+    case MathBuiltin::Min:
+    case MathBuiltin::Max:
+      {
+        // The result is whichever argument wins, type and all; ties go
+        // to the first.
+        llvm::Value* a = m_builder->CreateLoad(m_builder->CreateStructGEP(args[0], 1));
+        llvm::Value* b = m_builder->CreateLoad(m_builder->CreateStructGEP(args[1], 1));
+        llvm::Value* da = insertInstructionToDouble(args[0]);
+        llvm::Value* db = insertInstructionToDouble(args[1]);
+        auto const isMin = par->m_builtin == MathBuiltin::Min;
+        llvm::Value* pickB = m_builder->CreateSelect(
+                allInt,
+                isMin ? m_builder->CreateICmpSLT(b, a) : m_builder->CreateICmpSGT(b, a),
+                isMin ? m_builder->CreateFCmpOLT(db, da) : m_builder->CreateFCmpOGT(db, da));
+        insertInstructionCopyTypedValue(
+                retval, m_builder->CreateSelect(pickB, args[1], args[0]));
+      }
+      break;
+    case MathBuiltin::None:
+      break;
+  }
+  m_builder->CreateBr(joinBlock);
+  
+  m_builder->SetInsertPoint(slowBlock);
+  llvm::Value* argv = createEntryAlloca(
+          llvm::ArrayType::get(m_typedValue->getPointerTo(), args.size()), "argv");
+  for (auto i = size_t{0}; i < args.size(); ++i) {
+    m_builder->CreateStore(args[i], m_builder->CreateConstGEP2_64(argv, 0, i));
+  }
+  m_builder->CreateCall4(
+          m_CFunctionVMCall, 
+          createConstantCString(par->m_funcName->toCppString()),
+          retval,
+          llvm::ConstantInt::get(int64Ty, args.size()), 
+          m_builder->CreateConstGEP2_64(argv, 0, 0));
+  m_builder->CreateBr(joinBlock);
+  
+  m_builder->SetInsertPoint(joinBlock);
+  for (auto arg : args) {
+    insertInstructionDecRef(arg);
+  }
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionString(llvm::Value* stack_p, const StringData* stringData) {
+  std::string str = stringData->toCppString();
+  llvm::Value* type_value_p = createTypedValueString(str);
+  m_staticTypedValues.insert(type_value_p);
+  insertInstructionStackPush(stack_p, type_value_p);
+  m_stackKnown.back().isConstant = true;
+  m_stackKnown.back().constant = String(str);
+  return type_value_p;
+}
+
+llvm::Value* Translator::insertInstructionArray(llvm::Value* stack_p, const ArrayData* arr) {
+  llvm::Value* retval = createTypedValueArray(arr);
+  m_staticTypedValues.insert(retval);
+  insertInstructionStackPush(stack_p, retval);
+  m_stackKnown.back().layout = arr->isPacked() ? ArrayLayout::Packed : ArrayLayout::Mixed;
+  m_stackKnown.back().isConstant = true;
+  m_stackKnown.back().constant = Array(const_cast<ArrayData*>(arr));
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionConstant(llvm::Value* stack_p, const Variant& value) {
+  llvm::GlobalVariable* global = new llvm::GlobalVariable(
+          *m_mod, m_typedValue, true,
+          llvm::GlobalValue::InternalLinkage, 
+          createConstantTypedValue(*value.asTypedValue()));
+  llvm::Value* retval = createTypedValueNull();
+  insertInstructionCopyTypedValue(retval, global);
+  m_staticTypedValues.insert(retval);
+  insertInstructionStackPush(stack_p, retval);
+  if (value.isArray()) {
+    m_stackKnown.back().layout = value.getArrayData()->isPacked() 
+      ? ArrayLayout::Packed 
+      : ArrayLayout::Mixed;
+  }
+  m_stackKnown.back().isConstant = true;
+  m_stackKnown.back().constant = value;
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionFoldedCall(
+  llvm::Value* stack_p, 
+  PseudoActRec* par,
+  const std::vector<llvm::Value*>& args,
+  const std::vector<KnownValue>& argKnown) 
+{
+  if (!par->m_funcName || par->m_this || par->m_callee || 
+      argKnown.size() != args.size()) {
+    return nullptr;
+  }
+  Array params = Array::Create();
+  for (auto& known : argKnown) {
+    if (!known.isConstant) return nullptr;
+    params.append(known.constant);
+  }
+  
+  const Func* func = nullptr;
+  auto it = m_userFuncs.find(lower_name(par->m_funcName));
+  if (it != end(m_userFuncs)) {
+    func = it->second;
+    auto pure = m_pureFuncs.find(func);
+    if (pure == end(m_pureFuncs)) {
+      pure = m_pureFuncs.emplace(func, infer_purity(func)).first;
+    }
+    if (!pure->second) return nullptr;
+  } else if (!is_pure_builtin(par->m_funcName->toCppString())) {
+    return nullptr;
+  }
+  
+  Variant result;
+  if (!evaluate_pure_call(func, par->m_funcName, params, result)) {
+    return nullptr;
+  }
+  for (auto arg : args) {
+    insertInstructionDecRef(arg);
+  }
+  return insertInstructionConstant(stack_p, result);
+}
+
+llvm::Value* Translator::insertInstructionCGetL(llvm::Value* stack_p, uint32_t localId) {
+  llvm::Value* retval = createTypedValueNull();
+  insertInstructionCopyTypedValue(retval, insertInstructionGetLocal(localId));
+  insertInstructionStackPush(stack_p, retval);
+  auto it = m_localKnown.find(localId);
+  if (it != end(m_localKnown)) {
+    m_stackKnown.back() = it->second;
+  }
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionVGetL(llvm::Value* stack_p, uint32_t localId) {
+  // A reference is the local's storage itself.
+  llvm::Value* retval = insertInstructionGetLocal(localId);
+  insertInstructionStackPush(stack_p, retval);
+  m_localKnown.erase(localId);
+  return retval;
+}
 
-  llvm::Value* typed_value_p = createTypedValueNull();
-  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
-  llvm::Value* type = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfString);
-  m_builder->CreateStore(type, type_p);
-  
-  llvm::Value* string_data_pp = m_builder->CreateStructGEP(typed_value_p, 3);
-  llvm::Value* string_data_p = m_builder->CreateLoad(string_data_pp);
-  llvm::Value* size_p = m_builder->CreateStructGEP(string_data_p, 0);
-  llvm::Value* size = llvm::ConstantInt::get(llvm::Type::getInt32Ty(m_ctx), str.size()+1);
-  m_builder->CreateStore(size, size_p);
-  
-  llvm::Value* str_pp = m_builder->CreateStructGEP(string_data_p, 1);
-  llvm::Value* str_p  = m_builder->CreateConstGEP2_64(global_str, 0, 0);
-  m_builder->CreateStore(str_p, str_pp);
-  
-  return typed_value_p;
+llvm::Value* Translator::insertInstructionBindL(llvm::Value* stack_p, uint32_t localId) {
+  llvm::Value* ref_p = insertInstructionStackPop(stack_p);
+  insertInstructionBindLocal(localId, ref_p);
+  insertInstructionStackPush(stack_p, ref_p);
+  insertInstructionDecRef(ref_p);
+  return ref_p;
 }
 
-void Translator::insertInstructionFPushFuncD(
-  llvm::Value* stack_p, 
-  uint32_t numArgs, 
-  const StringData* funcName) 
-{
-  PseudoActRec* par = new PseudoActRec(funcName, numArgs);
-  pushPAR(par);
+llvm::Value* Translator::insertInstructionPopV(llvm::Value* stack_p) {
+  return insertInstructionPopC(stack_p);
 }
 
-void Translator::insertInstructionFPassCE(llvm::Value* stack_p, uint32_t paramId) {
-//  llvm::Value* top_p = insertInstructionGetTopOfStack(stack_p);
-//  PseudoActRec* par = currentPAR();
-//  par->setParam(top_p);
+void Translator::insertInstructionBindLocal(uint32_t localId, llvm::Value* storage_p) {
+  insertInstructionReleaseLocal(localId);
+  m_builder->CreateStore(storage_p, m_locals[localId]);
+  m_localKnown.erase(localId);
+  m_globalLocals.insert(localId);
 }
 
-llvm::Value* Translator::insertInstructionFCall(llvm::Value* stack_p, uint32_t numArgs) {
-  PseudoActRec* par = popPAR();
-  llvm::Function* function = m_mod->getFunction(par->m_funcName->toCppString());
-  llvm::Value* retval = createTypedValueNull();
-  std::vector<llvm::Value*> params;
-  params.push_back(retval);
-  for (int i = numArgs-1; i >= 0; --i) {
-//    params.push_back(insertInstructionStackPop(stack_p));
-    llvm::Value* typed_value_p = insertInstructionStackPop(stack_p);
-    params.push_back(typed_value_p);
-//    params[i] = typed_value_p;
+llvm::Value* Translator::insertInstructionGlobalSlot(
+  llvm::Value* name_p, 
+  const KnownValue& name, 
+  bool create) 
+{
+  if (name.isConstant && name.constant.isString()) {
+    return insertInstructionLoadGlobalSlot(name.constant.toString().toCppString());
   }
-  m_builder->CreateCall(function, params);
-  insertInstructionStackPush(stack_p, retval);
-  return retval;
+  // Names only known at run time go through the runtime's hash table,
+  // which holds the fixed slots as well.
+  return m_builder->CreateCall(create ? m_CFunctionGlobalLookup : m_CFunctionGlobalFind, 
+                               name_p);
 }
 
-llvm::Value* Translator::insertInstructionNull(llvm::Value* stack_p) {
+llvm::Value* Translator::insertInstructionCGetG(llvm::Value* stack_p) {
+  auto const name = topStackKnown();
+  llvm::Value* name_p = insertInstructionStackPop(stack_p);
+  llvm::Value* slot_p = insertInstructionGlobalSlot(name_p, name, true);
   llvm::Value* retval = createTypedValueNull();
+  insertInstructionCopyTypedValue(retval, slot_p);
   insertInstructionStackPush(stack_p, retval);
+  insertInstructionDecRef(name_p);
   return retval;
 }
 
-llvm::Value* Translator::insertInstructionInt(llvm::Value* stack_p, int64_t num) {
-  llvm::Value* retval = createTypedValueInt(num);
+llvm::Value* Translator::insertInstructionVGetG(llvm::Value* stack_p) {
+  auto const name = topStackKnown();
+  llvm::Value* name_p = insertInstructionStackPop(stack_p);
+  // As with VGetL, a reference is the global's storage itself.
+  llvm::Value* slot_p = insertInstructionGlobalSlot(name_p, name, true);
+  insertInstructionStackPush(stack_p, slot_p);
+  insertInstructionDecRef(name_p);
+  return slot_p;
+}
+
+llvm::Value* Translator::insertInstructionSetG(llvm::Value* stack_p) {
+  auto const value = topStackKnown();
+  llvm::Value* value_p = insertInstructionStackPop(stack_p);
+  auto const name = topStackKnown();
+  llvm::Value* name_p = insertInstructionStackPop(stack_p);
+  insertInstructionAssign(insertInstructionGlobalSlot(name_p, name, true), value_p);
+  forgetGlobalLocals();
+  insertInstructionStackPush(stack_p, value_p);
+  insertInstructionDecRef(value_p);
+  m_stackKnown.back() = value;
+  insertInstructionDecRef(name_p);
+  return value_p;
+}
+
+llvm::Value* Translator::insertInstructionIssetG(llvm::Value* stack_p) {
+  auto const name = topStackKnown();
+  llvm::Value* name_p = insertInstructionStackPop(stack_p);
+  llvm::Value* slot_p = insertInstructionGlobalSlot(name_p, name, false);
+  llvm::Constant* null = llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfNull);
+  
+  llvm::Value* isset;
+  if (llvm::isa<llvm::Constant>(slot_p)) {
+    isset = m_builder->CreateICmpUGT(
+            m_builder->CreateLoad(m_builder->CreateStructGEP(slot_p, 0)), null);
+  } else {
+    llvm::BasicBlock* fromBlock = m_builder->GetInsertBlock();
+    llvm::BasicBlock* foundBlock = llvm::BasicBlock::Create(m_ctx, "global_found", m_currentFunction);
+    llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "global_join", m_currentFunction);
+    m_builder->CreateCondBr(m_builder->CreateIsNull(slot_p), joinBlock, foundBlock);
+    
+    m_builder->SetInsertPoint(foundBlock);
+    llvm::Value* isNonNull = m_builder->CreateICmpUGT(
+            m_builder->CreateLoad(m_builder->CreateStructGEP(slot_p, 0)), null);
+    m_builder->CreateBr(joinBlock);
+    
+    m_builder->SetInsertPoint(joinBlock);
+    llvm::PHINode* phi = m_builder->CreatePHI(llvm::Type::getInt1Ty(m_ctx), 2);
+    phi->addIncoming(m_builder->getFalse(), fromBlock);
+    phi->addIncoming(isNonNull, foundBlock);
+    isset = phi;
+  }
+  llvm::Value* retval = createTypedValueBool(isset);
   insertInstructionStackPush(stack_p, retval);
+  insertInstructionDecRef(name_p);
   return retval;
 }
 
-llvm::Value* Translator::insertInstructionString(llvm::Value* stack_p, const StringData* stringData) {
-  std::string str = stringData->toCppString();
-  llvm::Value* type_value_p = createTypedValueString(str);
-  insertInstructionStackPush(stack_p, type_value_p);
-  return type_value_p;
+llvm::Value* Translator::insertInstructionStaticLoc(
+  llvm::Value* stack_p, 
+  uint32_t localId, 
+  const StringData* name) 
+{
+  // Pushes whether the static was already initialised; the code that
+  // initialises it follows, guarded by a JmpNZ on that.
+  auto const statics = getStaticLocal(name->toCppString(), KnownValue());
+  llvm::Value* inited = m_builder->CreateLoad(statics.second);
+  m_builder->CreateStore(m_builder->getTrue(), statics.second);
+  insertInstructionBindLocal(localId, statics.first);
+  llvm::Value* retval = createTypedValueBool(inited);
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
 }
 
-llvm::Value* Translator::insertInstructionSetL(llvm::Value* stack_p, std::string varName) {
+llvm::Value* Translator::insertInstructionStaticLocInit(
+  llvm::Value* stack_p, 
+  uint32_t localId, 
+  const StringData* name) 
+{
+  auto const init = topStackKnown();
+  llvm::Value* value_p = insertInstructionStackPop(stack_p);
+  auto const statics = getStaticLocal(name->toCppString(), init);
   
+  if (!llvm::cast<llvm::ConstantInt>(statics.second->getInitializer())->isOne()) {
+    // Not a literal, so the first run through initialises it.
+    llvm::BasicBlock* initBlock = llvm::BasicBlock::Create(m_ctx, "static_init", m_currentFunction);
+    llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "static_join", m_currentFunction);
+    m_builder->CreateCondBr(m_builder->CreateLoad(statics.second), joinBlock, initBlock);
+    
+    m_builder->SetInsertPoint(initBlock);
+    insertInstructionAssign(statics.first, value_p);
+    m_builder->CreateStore(m_builder->getTrue(), statics.second);
+    m_builder->CreateBr(joinBlock);
+    
+    m_builder->SetInsertPoint(joinBlock);
+  }
+  insertInstructionDecRef(value_p);
+  insertInstructionBindLocal(localId, statics.first);
+  return statics.first;
+}
+
+llvm::Value* Translator::insertInstructionSetL(llvm::Value* stack_p, uint32_t localId) {
+  llvm::Value* top_p = insertInstructionGetTopOfStack(stack_p);
+  insertInstructionAssign(insertInstructionGetLocal(localId), top_p);
+  m_localKnown[localId] = topStackKnown();
+  return top_p;
 }
 
 llvm::Value* Translator::insertInstructionPrint(llvm::Value* stack_p) {
@@ -603,72 +3758,398 @@ llvm::Value* Translator::insertInstructionPrint(llvm::Value* stack_p) {
 }
 
 llvm::Value* Translator::insertInstructionPopC(llvm::Value* stack_p) {
-  return insertInstructionStackPop(stack_p);
+  llvm::Value* typed_value_p = insertInstructionStackPop(stack_p);
+  insertInstructionDecRef(typed_value_p);
+  return typed_value_p;
 }
 
 llvm::Value* Translator::insertInstructionPopR(llvm::Value* stack_p) {
-  return insertInstructionStackPop(stack_p);
+  return insertInstructionPopC(stack_p);
+}
+
+llvm::Value* Translator::insertInstructionConcatN(llvm::Value* stack_p, uint32_t n) {
+  std::vector<llvm::Value*> parts(n);
+  for (int i = n-1; i >= 0; --i) {
+    parts[i] = insertInstructionStackPop(stack_p);
+  }
+  llvm::Value* parts_p = createEntryAlloca(
+          llvm::ArrayType::get(m_typedValue->getPointerTo(), n), "parts");
+  for (auto i = uint32_t{0}; i < n; ++i) {
+    m_builder->CreateStore(parts[i], m_builder->CreateConstGEP2_64(parts_p, 0, i));
+  }
+  llvm::Value* retval = createTypedValueNull();
+  m_builder->CreateCall3(
+          m_CFunctionConcatN, 
+          retval, 
+          m_builder->CreateConstGEP2_64(parts_p, 0, 0),
+          llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), n));
+  for (auto part : parts) {
+    insertInstructionDecRef(part);
+  }
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
+}
+
+llvm::Value* Translator::insertInstructionConcatAppendL(
+  llvm::Value* stack_p, 
+  uint32_t localId, 
+  int64_t reserve) 
+{
+  llvm::Value* value_p = insertInstructionStackPop(stack_p);
+  llvm::Value* local_p = insertInstructionGetLocal(localId);
+  m_builder->CreateCall3(
+          m_CFunctionConcatAppend, 
+          local_p, 
+          value_p,
+          llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), reserve));
+  insertInstructionDecRef(value_p);
+  m_localKnown.erase(localId);
+  
+  llvm::Value* retval = createTypedValueNull();
+  insertInstructionCopyTypedValue(retval, local_p);
+  insertInstructionStackPush(stack_p, retval);
+  return retval;
+}
+
+int64_t Translator::pendingAppendBytes(const FuncInfo& finfo, PC pc, uint32_t localId) {
+  // Literal bytes appended to the local by the straight run of
+  // "String; SetOpL .=; PopC" following pc, e.g. a block building HTML.
+  auto const stop = finfo.unit->at(finfo.func->past());
+  int64_t total = 0;
+  int64_t literal = 0;
+  for (; pc < stop; pc += instrLen(reinterpret_cast<const Op*>(pc))) {
+    if (finfo.labels.count(finfo.unit->offsetOf(pc))) break;
+    auto const op = *reinterpret_cast<const Op*>(pc);
+    PC imm = pc + 1;
+    if (op == Op::PopC) continue;
+    if (op == Op::String) {
+      literal = finfo.unit->lookupLitstrId(decode<Id>(imm))->size();
+      continue;
+    }
+    if (op == Op::CGetL) {
+      literal = 0;
+      continue;
+    }
+    if (op != Op::SetOpL || decodeVariableSizeImm(&imm) != localId ||
+        static_cast<SetOpOp>(*imm) != SetOpOp::ConcatEqual) {
+      break;
+    }
+    total += literal;
+    literal = 0;
+  }
+  return total;
+}
+
+void Translator::insertInstructionJmp(llvm::BasicBlock* target) {
+  m_builder->CreateBr(target);
+}
+
+void Translator::insertInstructionIterInit(
+  llvm::Value* stack_p, 
+  uint32_t iterId, 
+  llvm::BasicBlock* doneBlock, 
+  uint32_t valLocal, 
+  int64_t keyLocal, 
+  bool byRef) 
+{
+  ArrayLayout layout = topStackKnown().layout;
+  const IterSlots& iter = m_iters[iterId];
+  llvm::Value* base_p = insertInstructionStackPop(stack_p);
+  
+  // foreach over anything but an array or a generator runs zero times.
+  llvm::Value* type_p = m_builder->CreateStructGEP(base_p, 0);
+  llvm::Value* type = m_builder->CreateLoad(type_p);
+  llvm::Value* isArray = m_builder->CreateICmpEQ(type, 
+          llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfArray));
+  llvm::BasicBlock* arrayBlock = llvm::BasicBlock::Create(m_ctx, "iter_array", m_currentFunction);
+  llvm::BasicBlock* notArrayBlock = llvm::BasicBlock::Create(m_ctx, "iter_not_array", m_currentFunction);
+  llvm::BasicBlock* initBlock = llvm::BasicBlock::Create(m_ctx, "iter_init", m_currentFunction);
+  createProfiledCondBr(isArray, arrayBlock, notArrayBlock, probeKey("iter_array"));
+  
+  m_builder->SetInsertPoint(arrayBlock);
+  llvm::Value* array_arr_p;
+  if (byRef) {
+    // Elements are about to be bound by reference, so the base needs
+    // its own writable copy.
+    array_arr_p = m_builder->CreateCall(m_CFunctionArraySeparate, base_p);
+  } else {
+    llvm::Value* arr_pp = m_builder->CreateStructGEP(base_p, 4);
+    array_arr_p = m_builder->CreateLoad(arr_pp);
+  }
+  m_builder->CreateBr(initBlock);
+  
+  // A generator is walked through a one-slot mixed array that the
+  // runtime refills on every advance.
+  m_builder->SetInsertPoint(notArrayBlock);
+  llvm::Value* isObject = m_builder->CreateICmpEQ(type, 
+          llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfObject));
+  llvm::BasicBlock* objectBlock = llvm::BasicBlock::Create(m_ctx, "iter_object", m_currentFunction);
+  m_builder->CreateCondBr(isObject, objectBlock, doneBlock);
+  m_builder->SetInsertPoint(objectBlock);
+  llvm::Value* object_arr_p = m_builder->CreateCall(m_CFunctionObjectIterArray, base_p);
+  m_builder->CreateCondBr(m_builder->CreateIsNull(object_arr_p), doneBlock, initBlock);
+  
+  m_builder->SetInsertPoint(initBlock);
+  llvm::PHINode* arr_p = m_builder->CreatePHI(m_arrayData->getPointerTo(), 2);
+  arr_p->addIncoming(array_arr_p, arrayBlock);
+  arr_p->addIncoming(object_arr_p, objectBlock);
+  m_builder->CreateStore(arr_p, iter.arr_p);
+  
+  llvm::Value* kind_p = m_builder->CreateStructGEP(arr_p, 0);
+  m_builder->CreateStore(m_builder->CreateLoad(kind_p), iter.kind_p);
+  llvm::Value* used_p = m_builder->CreateStructGEP(arr_p, 3);
+  llvm::Value* used = m_builder->CreateLoad(used_p);
+  m_builder->CreateStore(used, iter.end_p);
+  
+  // IterInit and the matching IterNext of a foreach are emitted in
+  // bytecode order, so the layout seen here holds for the whole loop.
+  m_iterLayouts[iterId] = layout;
+  
+  llvm::Value* pos = insertInstructionIterAdvance(iter, layout, true);
+  llvm::Value* hasMore = m_builder->CreateICmpSLT(pos, used);
+  llvm::BasicBlock* fetchBlock = llvm::BasicBlock::Create(m_ctx, "iter_fetch", m_currentFunction);
+  createProfiledCondBr(hasMore, fetchBlock, doneBlock, probeKey("iter_init"));
+  m_builder->SetInsertPoint(fetchBlock);
+  insertInstructionIterFetch(iter, layout, valLocal, keyLocal, byRef);
+}
+
+void Translator::insertInstructionIterNext(
+  uint32_t iterId, 
+  llvm::BasicBlock* bodyBlock, 
+  uint32_t valLocal, 
+  int64_t keyLocal, 
+  bool byRef) 
+{
+  ArrayLayout layout = ArrayLayout::Unknown;
+  auto it = m_iterLayouts.find(iterId);
+  if (it != end(m_iterLayouts)) layout = it->second;
+  const IterSlots& iter = m_iters[iterId];
+  
+  llvm::Value* pos = insertInstructionIterAdvance(iter, layout, false);
+  llvm::Value* used = m_builder->CreateLoad(iter.end_p);
+  llvm::Value* hasMore = m_builder->CreateICmpSLT(pos, used);
+  llvm::BasicBlock* fetchBlock = llvm::BasicBlock::Create(m_ctx, "iter_fetch", m_currentFunction);
+  llvm::BasicBlock* exitBlock = llvm::BasicBlock::Create(m_ctx, "iter_exit", m_currentFunction);
+  createProfiledCondBr(hasMore, fetchBlock, exitBlock, probeKey("iter_next"));
+  
+  m_builder->SetInsertPoint(fetchBlock);
+  insertInstructionIterFetch(iter, layout, valLocal, keyLocal, byRef);
+  m_builder->CreateBr(bodyBlock);
+  
+  // Running off the end frees the iterator.
+  m_builder->SetInsertPoint(exitBlock);
+  insertInstructionIterFree(iterId);
+}
+
+void Translator::insertInstructionIterFree(uint32_t iterId) {
+  m_builder->CreateStore(
+          llvm::ConstantPointerNull::get(m_arrayData->getPointerTo()),
+          m_iters[iterId].arr_p);
+}
+
+llvm::Value* Translator::insertInstructionIterAdvance(
+  const IterSlots& iter, 
+  ArrayLayout layout, 
+  bool first) 
+{
+  llvm::Value* arr_p = m_builder->CreateLoad(iter.arr_p);
+  llvm::Value* pos = first ? nullptr : m_builder->CreateLoad(iter.pos_p);
+  
+  // Packed arrays have no holes, so their iterator is a plain counter.
+  auto packedPos = [&] () -> llvm::Value* {
+    llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+    if (first) return llvm::ConstantInt::get(int64Ty, 0);
+    return m_builder->CreateAdd(pos, llvm::ConstantInt::get(int64Ty, 1));
+  };
+  // Mixed arrays may contain tombstones which the runtime skips.
+  auto mixedPos = [&] () -> llvm::Value* {
+    if (first) return m_builder->CreateCall(m_CFunctionArrayIterBegin, arr_p);
+    return m_builder->CreateCall2(m_CFunctionArrayIterAdvance, arr_p, pos);
+  };
+  
+  llvm::Value* newPos;
+  switch (layout) {
+    case ArrayLayout::Packed:
+      newPos = packedPos();
+      break;
+    case ArrayLayout::Mixed:
+      newPos = mixedPos();
+      break;
+    case ArrayLayout::Unknown:
+      {
+        // The kind is loop invariant, so LLVM can unswitch this branch
+        // and still get a counted loop for the packed case.
+        llvm::Value* kind = m_builder->CreateLoad(iter.kind_p);
+        llvm::Value* isPacked = m_builder->CreateICmpEQ(kind, 
+                llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), 
+                                       static_cast<uint8_t>(ArrayDataKind::Packed)));
+        llvm::BasicBlock* packedBlock = llvm::BasicBlock::Create(m_ctx, "iter_packed", m_currentFunction);
+        llvm::BasicBlock* mixedBlock = llvm::BasicBlock::Create(m_ctx, "iter_mixed", m_currentFunction);
+        llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "iter_join", m_currentFunction);
+        createProfiledCondBr(isPacked, packedBlock, mixedBlock, probeKey("iter_packed"));
+        
+        m_builder->SetInsertPoint(packedBlock);
+        llvm::Value* pos1 = packedPos();
+        m_builder->CreateBr(joinBlock);
+        m_builder->SetInsertPoint(mixedBlock);
+        llvm::Value* pos2 = mixedPos();
+        m_builder->CreateBr(joinBlock);
+        
+        m_builder->SetInsertPoint(joinBlock);
+        llvm::PHINode* phi = m_builder->CreatePHI(llvm::Type::getInt64Ty(m_ctx), 2);
+        phi->addIncoming(pos1, packedBlock);
+        phi->addIncoming(pos2, mixedBlock);
+        newPos = phi;
+      }
+      break;
+  }
+  m_builder->CreateStore(newPos, iter.pos_p);
+  return newPos;
+}
+
+void Translator::insertInstructionIterFetch(
+  const IterSlots& iter, 
+  ArrayLayout layout,
+  uint32_t valLocal, 
+  int64_t keyLocal, 
+  bool byRef) 
+{
+  llvm::Value* arr_p = m_builder->CreateLoad(iter.arr_p);
+  llvm::Value* pos = m_builder->CreateLoad(iter.pos_p);
+  
+  llvm::Value* elems_pp = m_builder->CreateStructGEP(arr_p, 4);
+  llvm::Value* elems_p = m_builder->CreateLoad(elems_pp);
+  llvm::Value* elem_p = m_builder->CreateGEP(elems_p, pos);
+  if (byRef) {
+    insertInstructionReleaseLocal(valLocal);
+    m_builder->CreateStore(elem_p, m_locals[valLocal]);
+  } else {
+    insertInstructionAssign(insertInstructionGetLocal(valLocal), elem_p);
+  }
+  m_localKnown.erase(valLocal);
+  
+  if (keyLocal < 0) return;
+  
+  llvm::Value* key_p = insertInstructionGetLocal(keyLocal);
+  m_localKnown.erase(keyLocal);
+  insertInstructionDecRef(key_p);
+  auto packedKey = [&] {
+    llvm::Value* type_p = m_builder->CreateStructGEP(key_p, 0);
+    m_builder->CreateStore(
+            llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfInt64), 
+            type_p);
+    llvm::Value* num_p = m_builder->CreateStructGEP(key_p, 1);
+    m_builder->CreateStore(pos, num_p);
+  };
+  auto mixedKey = [&] {
+    llvm::Value* keys_pp = m_builder->CreateStructGEP(arr_p, 5);
+    llvm::Value* keys_p = m_builder->CreateLoad(keys_pp);
+    insertInstructionCopyTypedValue(key_p, m_builder->CreateGEP(keys_p, pos));
+    insertInstructionIncRef(key_p);
+  };
+  
+  switch (layout) {
+    case ArrayLayout::Packed:
+      packedKey();
+      break;
+    case ArrayLayout::Mixed:
+      mixedKey();
+      break;
+    case ArrayLayout::Unknown:
+      {
+        llvm::Value* kind = m_builder->CreateLoad(iter.kind_p);
+        llvm::Value* isPacked = m_builder->CreateICmpEQ(kind, 
+                llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), 
+                                       static_cast<uint8_t>(ArrayDataKind::Packed)));
+        llvm::BasicBlock* packedBlock = llvm::BasicBlock::Create(m_ctx, "iter_key_packed", m_currentFunction);
+        llvm::BasicBlock* mixedBlock = llvm::BasicBlock::Create(m_ctx, "iter_key_mixed", m_currentFunction);
+        llvm::BasicBlock* joinBlock = llvm::BasicBlock::Create(m_ctx, "iter_key_join", m_currentFunction);
+        createProfiledCondBr(isPacked, packedBlock, mixedBlock, probeKey("iter_key_packed"));
+        
+        m_builder->SetInsertPoint(packedBlock);
+        packedKey();
+        m_builder->CreateBr(joinBlock);
+        m_builder->SetInsertPoint(mixedBlock);
+        mixedKey();
+        m_builder->CreateBr(joinBlock);
+        
+        m_builder->SetInsertPoint(joinBlock);
+      }
+      break;
+  }
 }
 
 void Translator::insertInstructionRetC(llvm::Value* stack_p) {
+  if (m_currentGenerator) {
+    // Generators return nothing; finishing one just marks it done.
+    insertInstructionPopC(stack_p);
+    insertInstructionReleaseLocals();
+    m_builder->CreateCall(m_CFunctionGeneratorFinish, m_currentGenerator);
+    m_builder->CreateRetVoid();
+    return;
+  }
   if (!m_currentFunctionIsPseudoMain) {
     llvm::ValueSymbolTable& vst = m_currentFunction->getValueSymbolTable();
     llvm::Value* retval_p = vst.lookup("retval");
 //    llvm::Value* retval_p = m_currentFunctionArguments[0];
-    llvm::Value* top_p = insertInstructionPopC(stack_p);
-    
-    llvm::Value* top_type_p = m_builder->CreateStructGEP(top_p, 0);
-    llvm::Value* top_type = m_builder->CreateLoad(top_type_p);
-    llvm::Value* retval_type_p = m_builder->CreateStructGEP(retval_p, 0);
-    m_builder->CreateStore(top_type, retval_type_p);
-    
-    llvm::Value* top_num_p = m_builder->CreateStructGEP(top_p, 1);
-    llvm::Value* top_num = m_builder->CreateLoad(top_num_p);
-    llvm::Value* retval_num_p = m_builder->CreateStructGEP(retval_p, 1);
-    m_builder->CreateStore(top_num, retval_num_p);
-    
-    llvm::Value* top_dbl_p = m_builder->CreateStructGEP(top_p, 2);
-    llvm::Value* top_dbl = m_builder->CreateLoad(top_dbl_p);
-    llvm::Value* retval_dbl_p = m_builder->CreateStructGEP(retval_p, 2);
-    m_builder->CreateStore(top_dbl, retval_dbl_p);
-    
-    llvm::Value* top_str_data_pp = m_builder->CreateStructGEP(top_p, 3);
-    llvm::Value* top_str_data_p = m_builder->CreateLoad(top_str_data_pp);
-    llvm::Value* top_str_data_size_p = m_builder->CreateStructGEP(top_str_data_p, 0);
-    llvm::Value* top_str_data_size = m_builder->CreateLoad(top_str_data_size_p);
-    llvm::Value* top_str_data_str_pp = m_builder->CreateStructGEP(top_str_data_p, 1);
-    llvm::Value* top_str_data_str_p = m_builder->CreateLoad(top_str_data_str_pp);
-    
-    llvm::Value* retval_str_data_pp = m_builder->CreateStructGEP(retval_p, 3);
-    llvm::Value* retval_str_data_p = m_builder->CreateLoad(retval_str_data_pp);
-    llvm::Value* retval_str_data_size_p = m_builder->CreateStructGEP(retval_str_data_p, 0);
-    llvm::Value* retval_str_data_str_pp = m_builder->CreateStructGEP(retval_str_data_p, 1);
+    llvm::Value* top_p = insertInstructionStackPop(stack_p);
+    if (m_currentFunctionIsAsync) {
+      // Async functions run to completion, so they return a finished
+      // wait handle and never need a frame of their own.
+      top_p = createTypedValueObject(
+              m_builder->CreateCall(m_CFunctionWaitHandleCreate, top_p));
+    }
     
-    m_builder->CreateStore(top_str_data_size, retval_str_data_size_p);
-    m_builder->CreateStore(top_str_data_str_p, retval_str_data_str_pp);
+    // The popped reference moves into retval, string_data and all; the
+    // caller's retval holds nothing to release.
+    insertInstructionCopyTypedValue(retval_p, top_p);
     
+    insertInstructionReleaseLocals();
     m_builder->CreateRetVoid();
+  } else {
+    insertInstructionRetPseudoMain(stack_p);
   }
 }
 
 void Translator::insertInstructionRetPseudoMain(llvm::Value* stack_p) {
   if (m_currentFunctionIsPseudoMain) {
 //    llvm::Value* retval_p = insertInstructionPopC(stack_p);
+    insertInstructionReleaseLocals();
     llvm::Value* retval = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0);
     m_builder->CreateRet(retval);
   }
 }
 
 
+void Translator::insertInstructionProbe(const std::string& key) {
+  if (m_profileMode != ProfileMode::Instrument) return;
+  llvm::Value* counter_p = m_builder->CreateConstGEP2_64(getProbe(key, 1), 0, 0);
+  llvm::Value* counter = m_builder->CreateLoad(counter_p);
+  llvm::Constant* one = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 1);
+  m_builder->CreateStore(m_builder->CreateAdd(counter, one), counter_p);
+}
+
+void Translator::insertInstructionTypeProbe(const std::string& key, llvm::Value* type) {
+  if (m_profileMode != ProfileMode::Instrument) return;
+  // One counter per possible DataType byte.
+  llvm::Value* probe = getProbe(key, 256);
+  llvm::Value* index = m_builder->CreateZExt(type, llvm::Type::getInt64Ty(m_ctx));
+  llvm::Constant* zero = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 0);
+  llvm::Value* indices[] = { zero, index };
+  llvm::Value* counter_p = m_builder->CreateGEP(probe, indices);
+  llvm::Value* counter = m_builder->CreateLoad(counter_p);
+  llvm::Constant* one = llvm::ConstantInt::get(llvm::Type::getInt64Ty(m_ctx), 1);
+  m_builder->CreateStore(m_builder->CreateAdd(counter, one), counter_p);
+}
+
 llvm::Value* Translator::insertInstructionStackAllocInit(uint32_t stackSize) {
-  llvm::Value* stack_p = m_builder->CreateAlloca(m_stack, nullptr, "stack_p");
-  
-  llvm::Value* arraySize = llvm::ConstantInt::get(
-          llvm::Type::getInt32Ty(m_ctx), stackSize);
-  llvm::Value* typed_value_pp = m_builder->CreateAlloca(
-          m_typedValue->getPointerTo(), 
-          arraySize, 
-          "typed_value_pp");
+  llvm::Value* stack_p = createEntryAlloca(m_stack, "stack_p");
+  
+  llvm::Value* frames_p = createEntryAlloca(
+          llvm::ArrayType::get(m_typedValue->getPointerTo(), stackSize), 
+          "frames_p");
+  llvm::Value* typed_value_pp = m_builder->CreateConstGEP2_64(
+          frames_p, 0, 0, "typed_value_pp");
   llvm::Value* typed_value_ppp = m_builder->CreateStructGEP(stack_p, 2, "typed_value_ppp");
   m_builder->CreateStore(typed_value_pp, typed_value_ppp);
   
@@ -683,6 +4164,81 @@ llvm::Value* Translator::insertInstructionStackAllocInit(uint32_t stackSize) {
   return stack_p;
 }
 
+llvm::Value* Translator::insertInstructionGetLocal(uint32_t localId) {
+  return m_builder->CreateLoad(m_locals[localId]);
+}
+
+void Translator::insertInstructionReleaseLocal(uint32_t localId) {
+  // Once the local is bound elsewhere its own storage is dead, so it
+  // is released now and left null for insertInstructionReleaseLocals().
+  llvm::Value* storage_p = m_localStorage[localId];
+  if (!storage_p) return;
+  insertInstructionDecRef(storage_p);
+  m_builder->CreateStore(llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), KindOfNull),
+                         m_builder->CreateStructGEP(storage_p, 0));
+}
+
+void Translator::insertInstructionReleaseLocals() {
+  for (auto storage_p : m_localStorage) {
+    if (storage_p) insertInstructionDecRef(storage_p);
+  }
+}
+
+void Translator::insertInstructionCopyTypedValue(llvm::Value* dst_p, llvm::Value* src_p) {
+  for (unsigned i = 0; i < m_typedValue->getNumElements(); ++i) {
+    llvm::Value* src_field_p = m_builder->CreateStructGEP(src_p, i);
+    llvm::Value* dst_field_p = m_builder->CreateStructGEP(dst_p, i);
+    m_builder->CreateStore(m_builder->CreateLoad(src_field_p), dst_field_p);
+  }
+}
+
+llvm::Value* Translator::insertInstructionIsType(llvm::Value* typed_value_p, DataType type) {
+  llvm::Value* type_p = m_builder->CreateStructGEP(typed_value_p, 0);
+  return m_builder->CreateICmpEQ(
+          m_builder->CreateLoad(type_p), 
+          llvm::ConstantInt::get(llvm::Type::getInt8Ty(m_ctx), type));
+}
+
+llvm::Value* Translator::insertInstructionToDouble(llvm::Value* typed_value_p) {
+  // For ints and doubles only.
+  llvm::Value* dbl = m_builder->CreateLoad(m_builder->CreateStructGEP(typed_value_p, 2));
+  llvm::Value* num = m_builder->CreateLoad(m_builder->CreateStructGEP(typed_value_p, 1));
+  return m_builder->CreateSelect(
+          insertInstructionIsType(typed_value_p, KindOfDouble), 
+          dbl, 
+          m_builder->CreateSIToFP(num, llvm::Type::getDoubleTy(m_ctx)));
+}
+
+void Translator::insertInstructionStoreNumber(llvm::Value* typed_value_p, llvm::Value* value) {
+  auto const isDouble = value->getType()->isDoubleTy();
+  llvm::Value* type = llvm::ConstantInt::get(
+          llvm::Type::getInt8Ty(m_ctx), isDouble ? KindOfDouble : KindOfInt64);
+  m_builder->CreateStore(type, m_builder->CreateStructGEP(typed_value_p, 0));
+  m_builder->CreateStore(value, m_builder->CreateStructGEP(typed_value_p, isDouble ? 2 : 1));
+}
+
+void Translator::insertInstructionIncRef(llvm::Value* typed_value_p) {
+  llvm::CallInst* call = m_builder->CreateCall(m_CFunctionIncRef, typed_value_p);
+  if (m_staticTypedValues.count(typed_value_p)) {
+    call->setMetadata(kStaticMDName, llvm::MDNode::get(m_ctx, llvm::ArrayRef<llvm::Value*>()));
+  }
+}
+
+void Translator::insertInstructionDecRef(llvm::Value* typed_value_p) {
+  llvm::CallInst* call = m_builder->CreateCall(m_CFunctionDecRef, typed_value_p);
+  if (m_staticTypedValues.count(typed_value_p)) {
+    call->setMetadata(kStaticMDName, llvm::MDNode::get(m_ctx, llvm::ArrayRef<llvm::Value*>()));
+  }
+}
+
+void Translator::insertInstructionAssign(llvm::Value* dst_p, llvm::Value* src_p) {
+  // Count the new value first so that assigning a value to itself
+  // can't free it.
+  insertInstructionIncRef(src_p);
+  insertInstructionDecRef(dst_p);
+  insertInstructionCopyTypedValue(dst_p, src_p);
+}
+
 llvm::Value* Translator::insertInstructionGetTopOfStack(llvm::Value* stack_p) {
   llvm::Value* size_p = m_builder->CreateStructGEP(stack_p, 0);
   llvm::Value* size_orig = m_builder->CreateLoad(size_p);
@@ -703,6 +4259,7 @@ llvm::Value* Translator::insertInstructionStackPop  (llvm::Value* stack_p) {
   llvm::Value* typed_value_pp = m_builder->CreateLoad(typed_value_ppp);
   llvm::Value* frame_pp = m_builder->CreateGEP(typed_value_pp, size_orig);
   
+  if (!m_stackKnown.empty()) m_stackKnown.pop_back();
   return m_builder->CreateLoad(frame_pp);
 }
 
@@ -718,6 +4275,8 @@ void Translator::insertInstructionStackPush(llvm::Value* stack_p, llvm::Value* t
   llvm::Value* frame_pp = m_builder->CreateGEP(typed_value_pp, new_size);
   
   m_builder->CreateStore(typed_value_p, frame_pp);
+  insertInstructionIncRef(typed_value_p);
+  m_stackKnown.push_back(KnownValue());
 }
 
 void Translator::declarePuts() {
@@ -735,8 +4294,274 @@ void Translator::declarePuts() {
   m_CFunctionPuts->setCallingConv(llvm::CallingConv::C);
 }
 
+void Translator::declareArithFuncs() {
+  // Implemented in ijk-runtime.c.
+  std::vector<llvm::Type*> paramTypes;
+  paramTypes.push_back(llvm::Type::getInt64Ty(m_ctx));
+  paramTypes.push_back(m_typedValue->getPointerTo());
+  paramTypes.push_back(m_typedValue->getPointerTo());
+  paramTypes.push_back(m_typedValue->getPointerTo());
+  m_CFunctionArith = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), paramTypes, false), 
+          llvm::Function::ExternalLinkage, "ijk_arith", m_mod);
+  m_CFunctionArith->setDoesNotCapture(2);
+  m_CFunctionArith->setDoesNotCapture(3);
+  m_CFunctionArith->setDoesNotCapture(4);
+  m_CFunctionArith->setDoesNotThrow();
+}
+
+void Translator::declareStringFuncs() {
+  // Implemented in ijk-runtime.c.
+  std::vector<llvm::Type*> concatParams;
+  concatParams.push_back(m_typedValue->getPointerTo());
+  concatParams.push_back(m_typedValue->getPointerTo()->getPointerTo());
+  concatParams.push_back(llvm::Type::getInt64Ty(m_ctx));
+  m_CFunctionConcatN = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), concatParams, false), 
+          llvm::Function::ExternalLinkage, "ijk_concat_n", m_mod);
+  m_CFunctionConcatN->setDoesNotCapture(1);
+  m_CFunctionConcatN->setDoesNotCapture(2);
+  m_CFunctionConcatN->setDoesNotThrow();
+  
+  std::vector<llvm::Type*> appendParams;
+  appendParams.push_back(m_typedValue->getPointerTo());
+  appendParams.push_back(m_typedValue->getPointerTo());
+  appendParams.push_back(llvm::Type::getInt64Ty(m_ctx));
+  m_CFunctionConcatAppend = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), appendParams, false), 
+          llvm::Function::ExternalLinkage, "ijk_concat_append", m_mod);
+  m_CFunctionConcatAppend->setDoesNotCapture(1);
+  m_CFunctionConcatAppend->setDoesNotCapture(2);
+  m_CFunctionConcatAppend->setDoesNotThrow();
+}
+
+void Translator::declareArrayFuncs() {
+  // Implemented in ijk-runtime.c.
+  llvm::Type* int64Ty = llvm::Type::getInt64Ty(m_ctx);
+  llvm::Type* arrayDataPtrTy = m_arrayData->getPointerTo();
+  
+  std::vector<llvm::Type*> beginParams;
+  beginParams.push_back(arrayDataPtrTy);
+  m_CFunctionArrayIterBegin = llvm::Function::Create(
+          llvm::FunctionType::get(int64Ty, beginParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_array_iter_begin", 
+          m_mod);
+  
+  std::vector<llvm::Type*> advanceParams;
+  advanceParams.push_back(arrayDataPtrTy);
+  advanceParams.push_back(int64Ty);
+  m_CFunctionArrayIterAdvance = llvm::Function::Create(
+          llvm::FunctionType::get(int64Ty, advanceParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_array_iter_advance", 
+          m_mod);
+  
+  std::vector<llvm::Type*> separateParams;
+  separateParams.push_back(m_typedValue->getPointerTo());
+  m_CFunctionArraySeparate = llvm::Function::Create(
+          llvm::FunctionType::get(arrayDataPtrTy, separateParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_array_separate", 
+          m_mod);
+  
+  m_CFunctionArrayIterBegin->setOnlyReadsMemory();
+  m_CFunctionArrayIterAdvance->setOnlyReadsMemory();
+}
+
+void Translator::declareObjectFuncs() {
+  // Implemented in ijk-runtime.c.
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  
+  std::vector<llvm::Type*> allocParams;
+  allocParams.push_back(m_class->getPointerTo());
+  m_CFunctionObjectAlloc = llvm::Function::Create(
+          llvm::FunctionType::get(m_objectData->getPointerTo(), allocParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_object_alloc", 
+          m_mod);
+  m_CFunctionObjectAlloc->setDoesNotAlias(0);
+  
+  std::vector<llvm::Type*> lookupParams;
+  lookupParams.push_back(m_class->getPointerTo());
+  lookupParams.push_back(int8PtrTy);
+  lookupParams.push_back(m_methodCache->getPointerTo());
+  m_CFunctionMethodLookup = llvm::Function::Create(
+          llvm::FunctionType::get(int8PtrTy, lookupParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_method_lookup", 
+          m_mod);
+  
+  std::vector<llvm::Type*> propParams;
+  propParams.push_back(m_objectData->getPointerTo());
+  propParams.push_back(int8PtrTy);
+  propParams.push_back(m_propCache->getPointerTo());
+  m_CFunctionObjectProp = llvm::Function::Create(
+          llvm::FunctionType::get(m_typedValue->getPointerTo(), propParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_object_prop", 
+          m_mod);
+}
+
+void Translator::declareRefcountFuncs() {
+  // Implemented in ijk-runtime.c and recognised by RefcountElision.
+  std::vector<llvm::Type*> paramTypes;
+  paramTypes.push_back(m_typedValue->getPointerTo());
+  llvm::FunctionType* functionType = llvm::FunctionType::get(
+          llvm::Type::getVoidTy(m_ctx), paramTypes, false);
+  
+  m_CFunctionIncRef = llvm::Function::Create(
+          functionType, llvm::Function::ExternalLinkage, kIncRefName, m_mod);
+  m_CFunctionIncRef->setDoesNotCapture(1);
+  m_CFunctionIncRef->setDoesNotThrow();
+  
+  m_CFunctionDecRef = llvm::Function::Create(
+          functionType, llvm::Function::ExternalLinkage, kDecRefName, m_mod);
+  m_CFunctionDecRef->setDoesNotCapture(1);
+  m_CFunctionDecRef->setDoesNotThrow();
+}
+
+void Translator::declareVMFuncs() {
+  // Implemented in vm-bridge.cpp when the module runs inside HHVM.
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  
+  std::vector<llvm::Type*> callParams;
+  callParams.push_back(int8PtrTy); // name
+  callParams.push_back(m_typedValue->getPointerTo()); // retval
+  callParams.push_back(llvm::Type::getInt64Ty(m_ctx)); // numArgs
+  callParams.push_back(m_typedValue->getPointerTo()->getPointerTo()); // args
+  m_CFunctionVMCall = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), callParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_vm_call", 
+          m_mod);
+  
+  std::vector<llvm::Type*> includeParams;
+  includeParams.push_back(int8PtrTy); // path
+  m_CFunctionVMInclude = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), includeParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_vm_include", 
+          m_mod);
+  m_CFunctionVMLoad = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), includeParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_vm_load", 
+          m_mod);
+  
+  std::vector<llvm::Type*> callMethodParams;
+  callMethodParams.push_back(int8PtrTy); // class
+  callMethodParams.insert(callMethodParams.end(), callParams.begin(), callParams.end());
+  m_CFunctionVMCallMethod = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), callMethodParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_vm_call_method", 
+          m_mod);
+  
+  // In ijk-runtime.c.
+  m_CFunctionFatal = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), includeParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_fatal", 
+          m_mod);
+  m_CFunctionFatal->setDoesNotReturn();
+}
+
+void Translator::declareGlobalFuncs() {
+  // Implemented in ijk-runtime.c.
+  std::vector<llvm::Type*> entryElems;
+  entryElems.push_back(llvm::Type::getInt8Ty(m_ctx)->getPointerTo()); // name
+  entryElems.push_back(m_typedValue->getPointerTo()->getPointerTo()); // slot
+  m_globalEntry = llvm::StructType::create(m_ctx, entryElems, "global_entry");
+  
+  std::vector<llvm::Type*> registerParams;
+  registerParams.push_back(m_globalEntry->getPointerTo());
+  m_CFunctionGlobalsRegister = llvm::Function::Create(
+          llvm::FunctionType::get(llvm::Type::getVoidTy(m_ctx), registerParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_globals_register", 
+          m_mod);
+  
+  std::vector<llvm::Type*> lookupParams;
+  lookupParams.push_back(m_typedValue->getPointerTo()); // name
+  llvm::FunctionType* lookupType = llvm::FunctionType::get(
+          m_typedValue->getPointerTo(), lookupParams, false);
+  m_CFunctionGlobalLookup = llvm::Function::Create(
+          lookupType, llvm::Function::ExternalLinkage, "ijk_global_lookup", m_mod);
+  m_CFunctionGlobalFind = llvm::Function::Create(
+          lookupType, llvm::Function::ExternalLinkage, "ijk_global_find", m_mod);
+  m_CFunctionGlobalFind->setOnlyReadsMemory();
+}
+
+void Translator::declareCoroutineFuncs() {
+  // Implemented in ijk-runtime.c.
+  llvm::Type* int8PtrTy = llvm::Type::getInt8Ty(m_ctx)->getPointerTo();
+  llvm::Type* voidTy = llvm::Type::getVoidTy(m_ctx);
+  
+  std::vector<llvm::Type*> createParams;
+  createParams.push_back(llvm::Type::getInt64Ty(m_ctx)); // frame size
+  createParams.push_back(int8PtrTy); // resume
+  m_CFunctionGeneratorCreate = llvm::Function::Create(
+          llvm::FunctionType::get(m_generatorData->getPointerTo(), createParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_generator_create", 
+          m_mod);
+  m_CFunctionGeneratorCreate->setDoesNotAlias(0);
+  
+  std::vector<llvm::Type*> yieldParams;
+  yieldParams.push_back(m_generatorData->getPointerTo());
+  yieldParams.push_back(m_typedValue->getPointerTo()); // value
+  yieldParams.push_back(m_typedValue->getPointerTo()); // key, null for the next integer
+  m_CFunctionGeneratorYield = llvm::Function::Create(
+          llvm::FunctionType::get(voidTy, yieldParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_generator_yield", 
+          m_mod);
+  
+  std::vector<llvm::Type*> finishParams;
+  finishParams.push_back(m_generatorData->getPointerTo());
+  m_CFunctionGeneratorFinish = llvm::Function::Create(
+          llvm::FunctionType::get(voidTy, finishParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_generator_finish", 
+          m_mod);
+  
+  std::vector<llvm::Type*> iterParams;
+  iterParams.push_back(m_typedValue->getPointerTo());
+  m_CFunctionObjectIterArray = llvm::Function::Create(
+          llvm::FunctionType::get(m_arrayData->getPointerTo(), iterParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_object_iter_array", 
+          m_mod);
+  
+  std::vector<llvm::Type*> waitHandleParams;
+  waitHandleParams.push_back(m_typedValue->getPointerTo()); // result
+  m_CFunctionWaitHandleCreate = llvm::Function::Create(
+          llvm::FunctionType::get(m_objectData->getPointerTo(), waitHandleParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_wait_handle_create", 
+          m_mod);
+  
+  std::vector<llvm::Type*> awaitParams;
+  awaitParams.push_back(m_typedValue->getPointerTo()); // awaitable
+  awaitParams.push_back(m_typedValue->getPointerTo()); // result
+  m_CFunctionAwait = llvm::Function::Create(
+          llvm::FunctionType::get(voidTy, awaitParams, false),
+          llvm::Function::ExternalLinkage, 
+          "ijk_await", 
+          m_mod);
+}
+
 void Translator::declareFuncs() {
   declarePuts();
+  declareStringFuncs();
+  declareArithFuncs();
+  declareArrayFuncs();
+  declareObjectFuncs();
+  declareRefcountFuncs();
+  declareVMFuncs();
+  declareCoroutineFuncs();
+  declareGlobalFuncs();
 }
 
 void Translator::initGlobals() {
@@ -746,24 +4571,49 @@ void Translator::initGlobals() {
     m_emptyString = new llvm::GlobalVariable(
             *m_mod, constStrVal->getType(), true,
             llvm::GlobalValue::InternalLinkage, constStrVal);
+    m_emptyStringData = llvm::cast<llvm::GlobalVariable>(
+            createConstantStringData(str));
 }
 
 llvm::Module* Translator::translateFile(const HPHP::String& sourceFilePath) {
+  defineTypes();
+  declareFuncs();
+  initGlobals();
+  
+  std::unique_ptr<Unit> unit(compileFile(sourceFilePath));
+  if (unit == nullptr) {
+    return nullptr;
+  }
+  llvm::Module* module = translateUnit(unit.get());
+  forgetUnits();
+  return module;
+};
+
+void Translator::forgetUnits() {
+  // The module no longer needs the units it was built from, and what
+  // is left of them here would dangle once they are freed.
+  m_userFuncs.clear();
+  m_pureFuncs.clear();
+  m_eagerFuncs.clear();
+  m_dispatchThunks.clear();
+  m_classes.clear();
+  m_programUnits.clear();
+  m_includePaths.clear();
+}
+
+Unit* Translator::compileFile(const HPHP::String& sourceFilePath) {
 #ifndef PHP_PATHINFO_BASENAME
 #define DEFINE_PHP_PATHINFO_BASENAME
 #define PHP_PATHINFO_BASENAME (2)
 #endif
   
-  declareFuncs();
-  defineTypes();
-  initGlobals();
-  
   String basename = f_pathinfo(sourceFilePath, PHP_PATHINFO_BASENAME);
   Variant contentsVariant = f_file_get_contents(sourceFilePath);
   String contentsString = contentsVariant.toString();
   const char* contents = contentsString.c_str();
   size_t contentsSize = contentsString.size();
   MD5 md5(string_md5(contents, contentsSize).c_str());
+  m_sourceFilePath = sourceFilePath.toCppString();
   Unit* unit = compile_file(contents, contentsSize, md5, basename.c_str());
   
 #ifdef DEFINE_PHP_PATHINFO_BASENAME
@@ -771,27 +4621,77 @@ llvm::Module* Translator::translateFile(const HPHP::String& sourceFilePath) {
 #undef PHP_PATHINFO_BASENAME
 #endif
   
-  if (unit == nullptr) {
-    return false;
-  } else {
-    return translateUnit(unit);
-  }
+  return unit;
 };
 
 bool Translator::loadSourceFile(const HPHP::String& sourceFilePath) {
   return true;
 };
 
+bool Translator::setProfile(ProfileMode mode, const std::string& profilePath) {
+  m_profileMode = mode;
+  m_profilePath = profilePath;
+  if (mode == ProfileMode::Use) {
+    return m_profile.load(profilePath);
+  }
+  return true;
+}
+
+void Translator::addOptimizationPasses(llvm::PassManager& passManager) {
+  passManager.add(llvm::createTypeBasedAliasAnalysisPass());
+  passManager.add(llvm::createBasicAliasAnalysisPass());
+  passManager.add(llvm::createPromoteMemoryToRegisterPass());
+  passManager.add(llvm::createFunctionInliningPass());
+  passManager.add(llvm::createEarlyCSEPass());
+  passManager.add(llvm::createLICMPass());
+  passManager.add(llvm::createGVNPass());
+  passManager.add(new RefcountElision());
+}
+
 bool Translator::print() {
   llvm::PassManager passManager;
   std::string error;
   llvm::raw_fd_ostream rawStream(m_modId.str().c_str(), error, llvm::sys::fs::F_RW);
-  passManager.add(llvm::createPromoteMemoryToRegisterPass());
+  addOptimizationPasses(passManager);
   passManager.add(llvm::createPrintModulePass(rawStream));
   passManager.run(*m_mod);
   rawStream.close();
+  printf("refcount: %llu of %llu operations elided (%llu static, %llu paired)\n",
+         (unsigned long long)(RefcountElision::numStatic() + RefcountElision::numPaired()),
+         (unsigned long long)RefcountElision::numSeen(),
+         (unsigned long long)RefcountElision::numStatic(),
+         (unsigned long long)RefcountElision::numPaired());
   return true;
 };
 
+int64_t Translator::run() {
+  llvm::PassManager passManager;
+  addOptimizationPasses(passManager);
+  passManager.run(*m_mod);
+  
+  // The execution engine owns the module from here on.
+  llvm::Module* module = m_mod;
+  m_mod = nullptr;
+  enter_native();
+  auto const ret = run_jit(module);
+  leave_native();
+  return ret;
+}
+
+bool Translator::compile(const std::string& objectPath, unsigned jobs) {
+  return compile_module(m_mod, objectPath, jobs, &Translator::addOptimizationPasses);
+}
+
+bool Translator::beginStreaming(const std::string& objectPath) {
+  m_streamer.reset(new StreamingCompiler(m_mod, objectPath, &Translator::addOptimizationPasses));
+  return true;
+}
+
+bool Translator::finishStreaming() {
+  auto const ok = m_streamer->finish();
+  m_streamer.reset();
+  return ok;
+}
+
 } // namespace IJK
 } // namespace HPHP
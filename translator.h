@@ -8,8 +8,15 @@
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/ValueSymbolTable.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include "hphp/runtime/base/base-includes.h"
 #include "hphp/runtime/vm/runtime.h"
@@ -18,6 +25,12 @@
 #include "hphp/runtime/ext/ext_file.h"
 #include "hphp/zend/zend-string.h"
 
+#include "arena.h"
+#include "codegen.h"
+#include "profile.h"
+#include "purity.h"
+#include "refcount.h"
+
 //using namespace llvm;
 
 namespace HPHP {
@@ -30,32 +43,148 @@ using EHInfo = boost::variant< EHFault
                              , EHCatch
                              >;
 
+template<class K, class V>
+using ArenaMap = std::map<K, V, std::less<K>, ArenaAllocator<std::pair<const K, V>>>;
+
+// Lives in the translator's per-function arena; see Translator::m_arena.
 struct FuncInfo {
-  FuncInfo(const Unit* u, const Func* f) : unit(u), func(f) {}
+  FuncInfo(Arena& arena, const Unit* u, const Func* f)
+    : unit(u)
+    , func(f)
+    , labels(std::less<Offset>(), ArenaAllocator<std::pair<const Offset,std::string>>(arena))
+    , ehInfo(0, std::hash<const EHEnt*>(), std::equal_to<const EHEnt*>(),
+             ArenaAllocator<std::pair<const EHEnt* const,EHInfo>>(arena))
+    , ehStarts(ArenaAllocator<std::pair<Offset,const EHEnt*>>(arena))
+    , iterKinds(std::less<Id>(), ArenaAllocator<std::pair<const Id,IterKind>>(arena))
+  {}
 
   const Unit* unit;
   const Func* func;
 
   // Map from offset to label names we should use for that offset.
-  std::map<Offset,std::string> labels;
+  ArenaMap<Offset,std::string> labels;
 
   // Information for each EHEnt in the func (basically which label
   // names we chose for its handlers).
-  std::unordered_map<const EHEnt*,EHInfo> ehInfo;
+  std::unordered_map<const EHEnt*,EHInfo,
+                     std::hash<const EHEnt*>,std::equal_to<const EHEnt*>,
+                     ArenaAllocator<std::pair<const EHEnt* const,EHInfo>>> ehInfo;
 
   // Fault and catch protected region starts in order.
-  std::vector<std::pair<Offset,const EHEnt*>> ehStarts;
+  std::vector<std::pair<Offset,const EHEnt*>,
+              ArenaAllocator<std::pair<Offset,const EHEnt*>>> ehStarts;
+
+  // Kind of every iterator the func's Iter* instructions refer to.
+  ArenaMap<Id,IterKind> iterKinds;
+};
+
+// What the translator knows about an array value at compile time.
+enum class ArrayLayout {
+  Unknown,
+  Packed,
+  Mixed,
+};
+
+// Refcount of strings, arrays and objects that are never counted;
+// mirrors IJK_STATIC_REFCOUNT in ijk-runtime.h.
+const int32_t kStaticRefCount = -1;
+
+// Runtime values of array_data.kind.
+enum class ArrayDataKind : uint8_t {
+  Packed = 0,
+  Mixed = 1,
+  // A generator's one-slot window; see ijk_object_iter_array().
+  Generator = 2,
+};
+
+// Operand of ijk_arith(); mirrors IJK_ARITH_* in ijk-runtime.h.
+enum class ArithOp : int64_t {
+  Add = 0,
+  Sub = 1,
+  Mul = 2,
+  Div = 3,
+};
+
+// Math builtins lowered to LLVM intrinsics instead of called.
+enum class MathBuiltin {
+  None,
+  Sqrt,
+  Floor,
+  Ceil,
+  Round,
+  Abs,
+  Min,
+  Max,
+  Pow,
+};
+
+// Translator-side state of a foreach iterator.  Each field is its own
+// alloca so that mem2reg turns a packed-array loop into a plain counted
+// loop.
+struct IterSlots {
+  llvm::Value* arr_p;
+  llvm::Value* pos_p;
+  llvm::Value* end_p;
+  llvm::Value* kind_p;
+};
+
+// Native layout and dispatch tables of a class defined in the unit.
+struct ClassInfo {
+  const PreClass* preClass;
+  const ClassInfo* parent;
+  // obj.<name>: the object_data header followed by one typed_value_t
+  // per declared property, parent's properties first, so that a
+  // subclass object can be used wherever its parent's layout is.
+  llvm::StructType* objectType;
+  llvm::GlobalVariable* classGlobal;
+  std::vector<const PreClass::Prop*> props;
+  std::map<std::string, unsigned> propIndex;
+  // Methods by lowercased name, inherited ones included.
+  std::map<std::string, const Func*> methods;
+  // Overridable methods in vtable order; a subclass keeps its parent's
+  // slots and appends its own.
+  std::vector<const Func*> vtable;
+  std::map<std::string, unsigned> vtableSlots;
+  
+  bool isFinal() const { return preClass->attrs() & AttrFinal; }
+};
+
+// What the translator knows about a value at compile time.
+struct KnownValue {
+  KnownValue() : layout(ArrayLayout::Unknown), cls(nullptr), exactClass(false), 
+                 isConstant(false) {}
+  
+  ArrayLayout layout;
+  // The value is an object of cls, or of a subclass unless exactClass.
+  const ClassInfo* cls;
+  bool exactClass;
+  // The value is constant, e.g. a literal, and equal to constant.
+  bool isConstant;
+  Variant constant;
 };
 
 struct PseudoActRec {
   const StringData* m_funcName;
   uint32_t m_numArgs;
   std::vector<llvm::Value*> m_params;
+  // Set for method calls.  A dynamic callee uses the dispatch
+  // convention (retval, this, numArgs, args) of the method thunks.
+  llvm::Value* m_callee;
+  llvm::Value* m_this;
+  // The popped stack value m_this came from, released after the call.
+  llvm::Value* m_receiver;
+  bool m_dynamic;
+  MathBuiltin m_builtin;
   
   PseudoActRec(const StringData* funcName, uint32_t numArgs) {
     m_funcName = funcName;
     m_numArgs = numArgs;
     m_params.resize(numArgs);
+    m_callee = nullptr;
+    m_this = nullptr;
+    m_receiver = nullptr;
+    m_dynamic = false;
+    m_builtin = MathBuiltin::None;
   };
   ~PseudoActRec() {
     
@@ -75,24 +204,145 @@ class Translator {
     llvm::StructType* m_stringData;
     llvm::StructType* m_typedValue;
     llvm::StructType* m_stack;
+    llvm::StructType* m_arrayData;
+    llvm::StructType* m_objectData;
+    llvm::StructType* m_class;
+    llvm::StructType* m_methodEntry;
+    llvm::StructType* m_methodCache;
+    llvm::StructType* m_propCache;
+    llvm::FunctionType* m_dispatchFunctionType;
+    llvm::StructType* m_generatorData;
+    llvm::FunctionType* m_resumeFunctionType;
     bool m_currentFunctionIsPseudoMain;
     llvm::Function* m_currentFunction;
     std::vector<llvm::Value*> m_currentFunctionArguments;
     llvm::Function* m_CFunctionPuts;
+    llvm::Function* m_CFunctionArith;
+    llvm::Function* m_CFunctionConcatN;
+    llvm::Function* m_CFunctionConcatAppend;
+    llvm::Function* m_CFunctionArrayIterBegin;
+    llvm::Function* m_CFunctionArrayIterAdvance;
+    llvm::Function* m_CFunctionArraySeparate;
+    llvm::Function* m_CFunctionObjectAlloc;
+    llvm::Function* m_CFunctionMethodLookup;
+    llvm::Function* m_CFunctionObjectProp;
+    llvm::Function* m_CFunctionIncRef;
+    llvm::Function* m_CFunctionDecRef;
+    llvm::Function* m_CFunctionVMCall;
+    llvm::Function* m_CFunctionVMInclude;
+    llvm::Function* m_CFunctionVMLoad;
+    llvm::Function* m_CFunctionVMCallMethod;
+    llvm::Function* m_CFunctionFatal;
+    // Whether each source file's unit is loaded in the VM yet.
+    std::map<std::string, llvm::GlobalVariable*> m_vmLoaded;
+    // For a whole program: its units, the pseudo-main of each file by
+    // canonical path, and whether each has run, for include_once.
+    std::vector<const Unit*> m_programUnits;
+    std::map<std::string, llvm::Function*> m_pseudoMains;
+    std::map<std::string, llvm::GlobalVariable*> m_includedFlags;
+    // The file each include of the current function loads, by offset;
+    // filled in by isTranslatable().
+    std::map<Offset, std::string> m_includePaths;
+    llvm::Function* m_CFunctionGeneratorCreate;
+    llvm::Function* m_CFunctionGeneratorYield;
+    llvm::Function* m_CFunctionGeneratorFinish;
+    llvm::Function* m_CFunctionObjectIterArray;
+    llvm::Function* m_CFunctionWaitHandleCreate;
+    llvm::Function* m_CFunctionAwait;
+    llvm::Function* m_CFunctionGlobalsRegister;
+    llvm::Function* m_CFunctionGlobalLookup;
+    llvm::Function* m_CFunctionGlobalFind;
     llvm::GlobalVariable* m_emptyString;
+    llvm::GlobalVariable* m_emptyStringData;
+    std::vector<llvm::Value*> m_locals;
+    // The storage each local owns, which it starts out bound to; null
+    // for the pseudo-main's globals.
+    std::vector<llvm::Value*> m_localStorage;
+    std::vector<IterSlots> m_iters;
+    std::map<Offset, llvm::BasicBlock*> m_blocks;
+    std::map<const ArrayData*, llvm::Constant*> m_staticArrays;
+    std::vector<KnownValue> m_stackKnown;
+    // Typed values built from literals in the current function.
+    std::set<llvm::Value*> m_staticTypedValues;
+    std::map<uint32_t, KnownValue> m_localKnown;
+    // Locals whose run of .= appends in this block has been sized.
+    std::set<uint32_t> m_reservedAppends;
+    std::map<uint32_t, ArrayLayout> m_iterLayouts;
+    std::map<std::pair<llvm::StructType*, unsigned>, llvm::MDNode*> m_tbaaFieldTags;
+    llvm::MDNode* m_tbaaStackSlotTag;
+    ProfileMode m_profileMode;
+    std::string m_profilePath;
+    ProfileData m_profile;
+    std::string m_currentFunctionName;
+    Offset m_currentOffset;
+    std::map<std::string, llvm::GlobalVariable*> m_probes;
+    std::map<llvm::BasicBlock*, std::string> m_blockProbeKeys;
+    std::map<std::string, ClassInfo> m_classes;
+    // User functions by lowercased name, and which of them are pure.
+    std::map<std::string, const Func*> m_userFuncs;
+    std::map<const Func*, bool> m_pureFuncs;
+    // Async user functions by whether they finish without suspending.
+    std::map<const Func*, bool> m_eagerFuncs;
+    std::map<std::string, llvm::Constant*> m_internedStrings;
+    std::map<const Func*, llvm::Function*> m_dispatchThunks;
+    // Default value entries of each function, by arity.
+    std::map<llvm::Function*, std::map<uint32_t, llvm::Function*>> m_dvEntries;
+    const ClassInfo* m_currentClass;
+    llvm::Value* m_currentThis;
+    unsigned m_firstParamArgument;
+    bool m_currentFunctionIsAsync;
+    // Set while translating the resume function of a generator.
+    llvm::Value* m_currentGenerator;
+    llvm::Value* m_generatorSent;
+    std::vector<llvm::BasicBlock*> m_resumeBlocks;
     std::vector<PseudoActRec*> m_parStack;
     std::map<std::string, llvm::Function*>m_functions;
+    std::string m_sourceFilePath;
+    bool m_wholeProgram;
+    std::string m_pseudoMainName;
+    llvm::DIBuilder* m_diBuilder;
+    llvm::DIFile m_diFile;
+    llvm::DISubprogram m_currentSubprogram;
+    // Fixed slots of globals named at compile time, each a pointer to
+    // the runtime's storage; see emitGlobalTable().
+    std::map<std::string, llvm::GlobalVariable*> m_globalSlots;
+    llvm::StructType* m_globalEntry;
+    // Storage and init guard of each function static, by function and name.
+    std::map<std::string, std::pair<llvm::GlobalVariable*, llvm::GlobalVariable*>> m_staticLocals;
+    // Locals of the current function bound to global or static storage,
+    // which calls may change behind its back.
+    std::set<uint32_t> m_globalLocals;
+    // Metadata of the function being translated, such as its FuncInfo
+    // and PseudoActRecs; reset as each function starts.
+    Arena m_arena;
+    // Set in streaming mode; see beginStreaming().
+    std::unique_ptr<StreamingCompiler> m_streamer;
+    
+    // Instructions a streaming translator lets accumulate before
+    // compiling them.
+    static const size_t kStreamFlushInstructions = 16 * 1024;
     
     Translator(
       const HPHP::String& modId, 
       llvm::LLVMContext& ctx = llvm::getGlobalContext()): m_ctx(ctx) 
     {
       m_currentFunctionIsPseudoMain = false;
+      m_profileMode = ProfileMode::None;
+      m_currentOffset = 0;
+      m_currentClass = nullptr;
+      m_currentThis = nullptr;
+      m_currentFunctionIsAsync = false;
+      m_currentGenerator = nullptr;
+      m_firstParamArgument = 1;
+      m_diBuilder = nullptr;
+      m_wholeProgram = false;
+      m_pseudoMainName = "main";
       m_modId = llvm::StringRef(modId.c_str());
       m_mod = new llvm::Module(m_modId, m_ctx);
       m_builder = new llvm::IRBuilder<>(m_ctx);
     };
     virtual ~Translator() {
+      delete m_diBuilder;
       delete m_mod;
       delete m_builder;
     };
@@ -116,54 +366,220 @@ class Translator {
     };
     
     bool print();
+    int64_t run();
+    bool compile(const std::string& objectPath, unsigned jobs);
+    bool beginStreaming(const std::string& objectPath);
+    bool finishStreaming();
+    bool setProfile(ProfileMode mode, const std::string& profilePath);
     bool loadSourceFile(const HPHP::String& sourceFilePath);
     llvm::Function* generateMainFunction(const FuncInfo& finfo, PC pc);
     llvm::Module* translateUnit(HPHP::Unit* unit);
     llvm::Module* translateFile(const HPHP::String& sourceFilePath);
+    llvm::Module* translateProgram(const HPHP::String& entryFilePath, 
+                                   const std::vector<std::string>& filePaths);
     llvm::FunctionType* generateFunctionType(const Func* func);
     PseudoActRec* getCurrentActRec() {
       
     };
   
   private:
+    HPHP::Unit* compileFile(const HPHP::String& sourceFilePath);
+    void forgetUnits();
+    void declareUnitFuncs(const Unit* unit);
+    llvm::Function* appendUnit(const Unit* unit);
+    void finishModule();
+    void endFunction();
+    void optimizeProgram();
+    
     void initGlobals();
     void declarePuts();
+    void declareStringFuncs();
+    void declareArithFuncs();
+    void declareArrayFuncs();
+    void declareObjectFuncs();
+    void declareRefcountFuncs();
+    void declareVMFuncs();
+    void declareCoroutineFuncs();
+    void declareGlobalFuncs();
     void declareFuncs();
     
     void defineTypes();
     void defineStringData();
     void defineTypedValue();
     void defineStack();
+    void defineArrayData();
+    void defineObjectTypes();
+    void defineTBAA();
+    llvm::MDNode* tbaaTagFor(llvm::Value* ptr);
+    void annotateTBAA(llvm::Function* function);
+    void addArgumentAttributes(llvm::Argument* arg, bool readOnly);
+    
+    std::string probeKey(const char* what);
+    std::string paramProbeKey(uint32_t paramId);
+    llvm::GlobalVariable* getProbe(const std::string& key, unsigned width);
+    void createProfiledCondBr(llvm::Value* cond, llvm::BasicBlock* trueBlock,
+                              llvm::BasicBlock* falseBlock, 
+                              const std::string& key);
+    void applyProfile(llvm::Function* function);
+    // Clones function for the parameter types the profile saw alone.
+    void specialiseParams(const FuncInfo& finfo, llvm::Function* function);
+    void emitProfileWriter();
+    
+    void beginDebugInfo(const Unit* unit);
+    void attachDebugInfo(const FuncInfo& finfo, llvm::Function* function);
+    static void addOptimizationPasses(llvm::PassManager& passManager);
     
     std::string loc_name(const FuncInfo& finfo, uint32_t id);
+    llvm::BasicBlock* getBlock(const FuncInfo& finfo, Offset off);
+    llvm::Value* createEntryAlloca(llvm::Type* type, const llvm::Twine& name = "");
+    void allocLocals(const FuncInfo& finfo);
+    void allocIters(const FuncInfo& finfo);
+    KnownValue topStackKnown();
+    
+    std::string functionName(const Func* func);
+    llvm::Function* declareFunction(const Func* func);
+    llvm::Function* getDispatchThunk(const Func* func);
+    const ClassInfo* findClass(const StringData* className);
+    const ClassInfo* defineClass(const PreClass* preClass, const Unit* unit);
+    const PreClass* findPreClass(const StringData* name, const Unit* unit, 
+                                 const Unit** owner);
+    void defineClasses(const Unit* unit);
+    void emitClassGlobal(ClassInfo& cls);
     
     llvm::Function* generateFunction(const FuncInfo& finfo);
+    bool isTranslatable(const FuncInfo& finfo);
+    // Whether func is async and only awaits calls of functions that are
+    // themselves, so that it returns a finished wait handle.
+    bool finishesEagerly(const Func* func);
+    void appendTrampoline(const FuncInfo& finfo);
+    void appendGenerator(const FuncInfo& finfo);
     void appendFunc(const Func* func);
+    const std::map<uint32_t, llvm::Function*>& declareDVEntries(const Func* func);
+    void appendDVEntry(const FuncInfo& finfo, uint32_t arity, llvm::Function* entry, 
+                       bool translatable);
     void appendFuncBody(llvm::Value* stack_p, const FuncInfo& finfo, bool isPseudoMain=false);
     void appendInstruction(llvm::Value* stack_p, const FuncInfo& finfo, PC pc);
     
     llvm::Value* createTypedValueNull();
     llvm::Value* createTypedValueInt(int64_t num);
+    llvm::Value* createTypedValueDouble(double dbl);
     llvm::Value* createTypedValueString(std::string str);
+    llvm::Value* createTypedValueArray(const ArrayData* arr);
+    llvm::Value* createTypedValueObject(llvm::Value* object_p);
+    llvm::Value* createTypedValueBool(llvm::Value* flag);
+    llvm::Value* createTypedValueUninit();
+    llvm::GlobalVariable* getGlobalSlot(const std::string& name);
+    llvm::Value* insertInstructionLoadGlobalSlot(const std::string& name);
+    void emitGlobalTable();
+    std::pair<llvm::GlobalVariable*, llvm::GlobalVariable*> getStaticLocal(
+            const std::string& name, const KnownValue& init);
+    void forgetGlobalLocals();
+    
+    llvm::Constant* createConstantCString(const std::string& str);
+    llvm::Constant* createConstantStringData(const std::string& str);
+    llvm::Constant* createConstantTypedValue(const TypedValue& tv);
+    llvm::Constant* createConstantArrayData(const ArrayData* arr);
     
     void insertInstructionRetPseudoMain(llvm::Value* stack_p);
     llvm::Value* insertInstructionNull(llvm::Value* stack_p);
     llvm::Value* insertInstructionInt(llvm::Value* stack_p, int64_t num);
+    llvm::Value* insertInstructionDouble(llvm::Value* stack_p, double dbl);
+    llvm::Value* insertInstructionArith(llvm::Value* stack_p, ArithOp op);
+    llvm::Value* insertInstructionConstant(llvm::Value* stack_p, const Variant& value);
+    llvm::Value* insertInstructionFoldedCall(llvm::Value* stack_p, PseudoActRec* par,
+                                             const std::vector<llvm::Value*>& args,
+                                             const std::vector<KnownValue>& argKnown);
+    llvm::Value* insertInstructionMathBuiltin(llvm::Value* stack_p, PseudoActRec* par,
+                                              const std::vector<llvm::Value*>& args);
     llvm::Value* insertInstructionString(llvm::Value* stack_p, const StringData* stringData);
-    llvm::Value* insertInstructionSetL(llvm::Value* stack_p, std::string varName);
+    llvm::Value* insertInstructionArray(llvm::Value* stack_p, const ArrayData* arr);
+    llvm::Value* insertInstructionCGetL(llvm::Value* stack_p, uint32_t localId);
+    llvm::Value* insertInstructionVGetL(llvm::Value* stack_p, uint32_t localId);
+    llvm::Value* insertInstructionBindL(llvm::Value* stack_p, uint32_t localId);
+    llvm::Value* insertInstructionPopV(llvm::Value* stack_p);
+    llvm::Value* insertInstructionGlobalSlot(llvm::Value* name_p, const KnownValue& name, 
+                                             bool create);
+    llvm::Value* insertInstructionCGetG(llvm::Value* stack_p);
+    llvm::Value* insertInstructionVGetG(llvm::Value* stack_p);
+    llvm::Value* insertInstructionSetG(llvm::Value* stack_p);
+    llvm::Value* insertInstructionIssetG(llvm::Value* stack_p);
+    llvm::Value* insertInstructionStaticLoc(llvm::Value* stack_p, uint32_t localId, 
+                                            const StringData* name);
+    llvm::Value* insertInstructionStaticLocInit(llvm::Value* stack_p, uint32_t localId, 
+                                                const StringData* name);
+    void insertInstructionBindLocal(uint32_t localId, llvm::Value* storage_p);
+    void insertInstructionVMLoad();
+    void insertInstructionIncl(llvm::Value* stack_p, const std::string& path, bool once);
+    void insertInstructionMarkIncluded();
+    llvm::Function* declarePseudoMain(const std::string& name);
+    llvm::GlobalVariable* getIncludedFlag(const std::string& path);
+    std::string resolveIncludePath(const std::string& path);
+    void insertInstructionFatal(const std::string& message);
+    void insertInstructionCheckObject(llvm::Value* typed_value_p, const std::string& message);
+    void insertInstructionReleaseLocal(uint32_t localId);
+    void insertInstructionReleaseLocals();
+    llvm::Value* insertInstructionSetL(llvm::Value* stack_p, uint32_t localId);
     llvm::Value* insertInstructionPrint(llvm::Value* stack_p);
     llvm::Value* insertInstructionPopC(llvm::Value* stack_p);
     llvm::Value* insertInstructionPopR(llvm::Value* stack_p);
+    llvm::Value* insertInstructionConcatN(llvm::Value* stack_p, uint32_t n);
+    llvm::Value* insertInstructionConcatAppendL(llvm::Value* stack_p, uint32_t localId, 
+                                                int64_t reserve);
+    int64_t pendingAppendBytes(const FuncInfo& finfo, PC pc, uint32_t localId);
     void insertInstructionRetC(llvm::Value* stack_p);
     void insertInstructionFPushFuncD(llvm::Value* stack_p, uint32_t numArgs, const StringData* funcName);
     void insertInstructionFPassCE(llvm::Value* stack_p, uint32_t paramId);
     llvm::Value* insertInstructionFCall(llvm::Value* stack_p, uint32_t numArgs);
+    void insertInstructionFPushCtorD(llvm::Value* stack_p, uint32_t numArgs, const StringData* className);
+    void insertInstructionFPushObjMethodD(llvm::Value* stack_p, uint32_t numArgs, const StringData* methodName);
+    void insertInstructionFPushClsMethodD(llvm::Value* stack_p, uint32_t numArgs, 
+                                          const StringData* methodName, 
+                                          const StringData* className);
+    llvm::Value* insertInstructionThis(llvm::Value* stack_p);
+    void insertInstructionCreateCont(llvm::Value* stack_p);
+    void insertInstructionYield(llvm::Value* stack_p, bool withKey);
+    void insertInstructionAwait(llvm::Value* stack_p);
+    llvm::Value* insertInstructionPropAddress(const KnownValue& base, 
+                                              llvm::Value* object_p, 
+                                              const StringData* propName);
+    llvm::Value* insertInstructionCGetProp(llvm::Value* stack_p, const KnownValue& base,
+                                           llvm::Value* object_p, 
+                                           const StringData* propName);
+    llvm::Value* insertInstructionSetProp(llvm::Value* stack_p, const KnownValue& base,
+                                          llvm::Value* object_p, 
+                                          const StringData* propName,
+                                          llvm::Value* value_p);
+    void insertInstructionJmp(llvm::BasicBlock* target);
+    void insertInstructionIterInit(llvm::Value* stack_p, uint32_t iterId, 
+                                   llvm::BasicBlock* doneBlock, 
+                                   uint32_t valLocal, int64_t keyLocal, 
+                                   bool byRef);
+    void insertInstructionIterNext(uint32_t iterId, llvm::BasicBlock* bodyBlock, 
+                                   uint32_t valLocal, int64_t keyLocal, 
+                                   bool byRef);
+    void insertInstructionIterFree(uint32_t iterId);
+    llvm::Value* insertInstructionIterAdvance(const IterSlots& iter, 
+                                              ArrayLayout layout, bool first);
+    void insertInstructionIterFetch(const IterSlots& iter, ArrayLayout layout,
+                                    uint32_t valLocal, int64_t keyLocal, 
+                                    bool byRef);
+    
+    void insertInstructionProbe(const std::string& key);
+    void insertInstructionTypeProbe(const std::string& key, llvm::Value* type);
     
     llvm::Value* insertInstructionMalloc(llvm::Type* type);
     llvm::Value* insertInstructionStackAllocInit(uint32_t stackSize);
     llvm::Value* insertInstructionStackPop(llvm::Value* stack_p);
     void insertInstructionStackPush(llvm::Value* stack_p, llvm::Value* typed_value_p);
     llvm::Value* insertInstructionGetTopOfStack(llvm::Value* stack_p);
+    llvm::Value* insertInstructionGetLocal(uint32_t localId);
+    void insertInstructionCopyTypedValue(llvm::Value* dst_p, llvm::Value* src_p);
+    llvm::Value* insertInstructionIsType(llvm::Value* typed_value_p, DataType type);
+    llvm::Value* insertInstructionToDouble(llvm::Value* typed_value_p);
+    void insertInstructionStoreNumber(llvm::Value* typed_value_p, llvm::Value* value);
+    void insertInstructionIncRef(llvm::Value* typed_value_p);
+    void insertInstructionDecRef(llvm::Value* typed_value_p);
+    void insertInstructionAssign(llvm::Value* dst_p, llvm::Value* src_p);
 };
 
 } // namespace IJK
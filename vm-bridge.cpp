@@ -0,0 +1,320 @@
+#include "vm-bridge.h"
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include "hphp/runtime/ext/asio/static_wait_handle.h"
+#include "hphp/runtime/ext/asio/wait_handle.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Never counted nor freed; see IJK_STATIC_REFCOUNT.
+static string_data s_emptyString = { 1, const_cast<char*>(""), IJK_STATIC_REFCOUNT, 0 };
+
+typedef void (*native_fn)(typed_value_t*, object_data*, int64_t, typed_value_t**);
+typedef void (*decref_fn)(typed_value_t*);
+
+Variant to_variant(const typed_value_t* tv) {
+  switch (static_cast<DataType>(tv->type)) {
+    case KindOfBoolean:
+      return static_cast<bool>(tv->num);
+    case KindOfInt64:
+      return tv->num;
+    case KindOfDouble:
+      return tv->dbl;
+    case KindOfStaticString:
+    case KindOfString:
+      // size counts the terminating NUL.
+      return String(tv->pstr->data, tv->pstr->size - 1, CopyString);
+    case KindOfArray:
+      {
+        Array ret = Array::Create();
+        auto const arr = tv->parr;
+        for (int64_t i = 0; i < arr->used; ++i) {
+          if (arr->elems[i].type == IJK_KIND_UNINIT) continue;
+          if (arr->keys) {
+            ret.set(to_variant(&arr->keys[i]), to_variant(&arr->elems[i]));
+          } else {
+            ret.append(to_variant(&arr->elems[i]));
+          }
+        }
+        return ret;
+      }
+    case KindOfObject:
+      if (tv->pobj->cls == &ijk_wait_handle_class) {
+        auto const wh = reinterpret_cast<const wait_handle_data*>(tv->pobj);
+        if (wh->vm_handle) return Object(static_cast<ObjectData*>(wh->vm_handle));
+        // A finished one of translated code becomes the VM's own.
+        Variant result = to_variant(&wh->result);
+        Cell cell = *result.asCell();
+        tvRefcountedIncRef(&cell);
+        return Object(c_StaticWaitHandle::CreateSucceeded(cell));
+      }
+      raise_warning("ijk: objects of translated code can't be passed to the VM");
+      return init_null();
+    default:
+      return init_null();
+  }
+}
+
+void from_variant(const Variant& value, typed_value_t* tv, int32_t count) {
+  tv->type = static_cast<int8_t>(value.getType());
+  tv->num = 0;
+  tv->dbl = 0.0;
+  tv->pstr = &s_emptyString;
+  tv->parr = nullptr;
+  tv->pobj = nullptr;
+  
+  switch (value.getType()) {
+    case KindOfUninit:
+    case KindOfNull:
+      tv->type = IJK_KIND_NULL;
+      break;
+    case KindOfBoolean:
+      tv->num = value.toBoolean();
+      break;
+    case KindOfInt64:
+      tv->num = value.toInt64();
+      break;
+    case KindOfDouble:
+      tv->dbl = value.toDouble();
+      break;
+    case KindOfStaticString:
+    case KindOfString:
+      {
+        const String str = value.toString();
+        auto const sd = static_cast<string_data*>(malloc(sizeof(string_data)));
+        sd->size = str.size() + 1;
+        sd->data = static_cast<char*>(malloc(sd->size));
+        memcpy(sd->data, str.data(), sd->size);
+        sd->count = count;
+        sd->capacity = sd->size;
+        tv->type = IJK_KIND_STRING;
+        tv->pstr = sd;
+      }
+      break;
+    case KindOfArray:
+      {
+        const Array arr = value.toArray();
+        auto const packed = arr->isVectorData();
+        auto const size = arr.size();
+        auto const ad = static_cast<array_data*>(malloc(sizeof(array_data)));
+        ad->kind = packed ? IJK_ARRAY_PACKED : IJK_ARRAY_MIXED;
+        ad->is_static = 0;
+        ad->size = size;
+        ad->used = size;
+        ad->elems = static_cast<typed_value_t*>(malloc(sizeof(typed_value_t) * size));
+        ad->keys = packed 
+          ? nullptr 
+          : static_cast<typed_value_t*>(malloc(sizeof(typed_value_t) * size));
+        ad->count = count;
+        int64_t i = 0;
+        for (ArrayIter iter(arr); iter; ++iter, ++i) {
+          from_variant(iter.secondRef(), &ad->elems[i], 1);
+          if (!packed) from_variant(iter.first(), &ad->keys[i], 1);
+        }
+        tv->parr = ad;
+      }
+      break;
+    default:
+      raise_warning("ijk: %s can't be passed to translated code", 
+                    getDataTypeString(value.getType()).c_str());
+      tv->type = IJK_KIND_NULL;
+      break;
+  }
+}
+
+// What a global held on each side when they were last synced.  The
+// references both hold make either side copy before changing a string
+// or array in place, so an unchanged pointer means an unchanged value.
+struct GlobalSync {
+  typed_value_t native;
+  Variant vm;
+};
+
+// By the slot, which is unique across the runtimes of several libraries.
+static std::map<typed_value_t*, GlobalSync> s_synced;
+// Values the VM replaced while translated code, which may still point
+// into them, was running; see leave_native().
+static std::vector<typed_value_t> s_retired;
+static int s_nativeDepth;
+
+static bool same_value(const typed_value_t* a, const typed_value_t* b) {
+  return a->type == b->type && a->num == b->num &&
+         memcmp(&a->dbl, &b->dbl, sizeof(a->dbl)) == 0 &&
+         a->pstr == b->pstr && a->parr == b->parr && a->pobj == b->pobj;
+}
+
+static void remember(typed_value_t* slot, const Variant& vm) {
+  auto it = s_synced.find(slot);
+  if (it == end(s_synced)) {
+    it = s_synced.emplace(slot, GlobalSync()).first;
+    from_variant(init_null(), &it->second.native, 0);
+  }
+  ijk_decref(&it->second.native);
+  it->second.native = *slot;
+  ijk_incref(&it->second.native);
+  it->second.vm = vm;
+}
+
+static void global_from_vm(const char* name, typed_value_t* slot, void*) {
+  auto const tv = g_context->m_globalVarEnv->lookup(makeStaticString(name));
+  if (!tv) return;
+  auto const cell = tvToCell(tv);
+  // Objects don't cross, so each side keeps its own.
+  if (cell->m_type == KindOfObject) return;
+  auto it = s_synced.find(slot);
+  if (it != end(s_synced) && cell->m_type == it->second.vm.asCell()->m_type &&
+      cell->m_data.num == it->second.vm.asCell()->m_data.num) {
+    return;
+  }
+  const Variant& value = tvAsCVarRef(cell);
+  s_retired.push_back(*slot);
+  from_variant(value, slot, 1);
+  remember(slot, value);
+}
+
+static void global_to_vm(const char* name, typed_value_t* slot, void*) {
+  if (slot->type == IJK_KIND_OBJECT) return;
+  auto it = s_synced.find(slot);
+  if (it != end(s_synced) && same_value(slot, &it->second.native)) return;
+  Variant value = to_variant(slot);
+  auto const tv = g_context->m_globalVarEnv->lookupAdd(makeStaticString(name));
+  cellSet(*value.asCell(), *tvToCell(tv));
+  remember(slot, value);
+}
+
+void globals_from_vm(globals_visit_fn visit) {
+  visit(global_from_vm, nullptr);
+}
+
+void globals_to_vm(globals_visit_fn visit) {
+  visit(global_to_vm, nullptr);
+}
+
+void enter_native(globals_visit_fn visit) {
+  globals_from_vm(visit);
+  ++s_nativeDepth;
+}
+
+void leave_native(globals_visit_fn visit) {
+  globals_to_vm(visit);
+  if (--s_nativeDepth > 0) return;
+  for (auto& value : s_retired) ijk_decref(&value);
+  s_retired.clear();
+}
+
+Variant call_native(const String& library, const String& function, const Array& args) {
+  void* handle = dlopen(library.c_str(), RTLD_NOW | RTLD_GLOBAL);
+  if (!handle) {
+    raise_warning("ijk: %s", dlerror());
+    return false;
+  }
+  auto const fn = reinterpret_cast<native_fn>(
+          dlsym(handle, (function.toCppString() + "$dispatch").c_str()));
+  auto const decref = reinterpret_cast<decref_fn>(dlsym(handle, "ijk_decref"));
+  // The library's runtime holds the slots of its globals.
+  auto const visit = reinterpret_cast<globals_visit_fn>(dlsym(handle, "ijk_globals_visit"));
+  if (!fn || !decref || !visit) {
+    raise_warning("ijk: %s() is not exported by %s", function.c_str(), library.c_str());
+    return false;
+  }
+  
+  // The references to the arguments go to the callee, as with FCall.
+  std::vector<typed_value_t> values(args.size());
+  std::vector<typed_value_t*> argv;
+  for (ArrayIter iter(args); iter; ++iter) {
+    from_variant(iter.secondRef(), &values[argv.size()], 1);
+    argv.push_back(&values[argv.size()]);
+  }
+  
+  typed_value_t retval;
+  from_variant(init_null(), &retval, 0);
+  enter_native(visit);
+  fn(&retval, nullptr, argv.size(), argv.data());
+  leave_native(visit);
+  Variant ret = to_variant(&retval);
+  decref(&retval);
+  return ret;
+}
+
+}
+}
+
+using namespace HPHP;
+
+static void vm_call(const Variant& callee, typed_value_t* retval,
+                    int64_t num_args, typed_value_t** args) {
+  PackedArrayInit params(num_args);
+  for (int64_t i = 0; i < num_args; ++i) {
+    params.append(IJK::to_variant(args[i]));
+  }
+  // Builtins may call back into PHP code, so every call is synced; only
+  // globals that changed are copied.
+  IJK::globals_to_vm();
+  Variant ret = vm_call_user_func(callee, params.toArray());
+  IJK::globals_from_vm();
+  if (ret.isObject() && ret.getObjectData()->instanceof(c_WaitHandle::classof())) {
+    // Async functions of the VM, e.g. I/O, hand back a handle that is
+    // only joined when translated code awaits it.
+    auto const handle = ret.getObjectData();
+    handle->incRefCount();
+    IJK::from_variant(init_null(), retval, 0);
+    retval->type = IJK_KIND_OBJECT;
+    retval->pobj = ijk_wait_handle_wrap(handle);
+    return;
+  }
+  IJK::from_variant(ret, retval, 0);
+}
+
+extern "C" void ijk_vm_call(const char* name, typed_value_t* retval,
+                            int64_t num_args, typed_value_t** args) {
+  vm_call(String(name, CopyString), retval, num_args, args);
+}
+
+extern "C" void ijk_vm_call_method(const char* cls, const char* name, typed_value_t* retval,
+                                   int64_t num_args, typed_value_t** args) {
+  vm_call(make_packed_array(String(cls, CopyString), String(name, CopyString)), 
+          retval, num_args, args);
+}
+
+extern "C" void ijk_vm_include(const char* path) {
+  IJK::globals_to_vm();
+  require(String(path, CopyString), false, "", true);
+  IJK::globals_from_vm();
+}
+
+extern "C" void ijk_vm_load(const char* path) {
+  auto const unit = lookupUnit(String(path, CopyString).get(), "", nullptr);
+  if (!unit) raise_error("ijk: can't load %s", path);
+  unit->merge();
+}
+
+extern "C" void ijk_vm_global(const char* name, typed_value_t* value) {
+  // The slot holds a reference of its own.
+  auto const tv = g_context->m_globalVarEnv->lookup(makeStaticString(name));
+  if (tv && tvToCell(tv)->m_type == KindOfObject) {
+    IJK::from_variant(init_null(), value, 1);
+    return;
+  }
+  IJK::from_variant(tv ? tvAsCVarRef(tvToCell(tv)) : Variant(init_null()), value, 1);
+}
+
+extern "C" void ijk_vm_await(void* vm_handle, typed_value_t* result) {
+  static const StaticString s_join("join");
+  Object handle(static_cast<ObjectData*>(vm_handle));
+  IJK::globals_to_vm();
+  Variant value = vm_call_user_func(make_packed_array(handle, s_join), Array::Create());
+  IJK::globals_from_vm();
+  // The wait handle keeps the result.
+  IJK::from_variant(value, result, 1);
+}
+
+extern "C" void ijk_vm_release(void* vm_handle) {
+  decRefObj(static_cast<ObjectData*>(vm_handle));
+}
@@ -0,0 +1,37 @@
+#ifndef IJK_VM_BRIDGE_H
+#define IJK_VM_BRIDGE_H
+
+#include "hphp/runtime/base/base-includes.h"
+
+#include "ijk-runtime.h"
+
+namespace HPHP {
+namespace IJK {
+
+// Conversions between VM values and the typed_value_t of translated
+// code.  from_variant() allocates strings and arrays with the given
+// refcount; objects don't cross and become null.
+Variant to_variant(const typed_value_t* tv);
+void from_variant(const Variant& value, typed_value_t* tv, int32_t count);
+
+// Copy the globals translated code has slots for, that changed since
+// they were last synced, from the VM's global scope and back on either
+// side of a call from one into the other.  Objects stay where they
+// are.  visit is ijk_globals_visit() of the runtime that holds the slots.
+typedef void (*globals_visit_fn)(global_visit_fn fn, void* ctx);
+void globals_from_vm(globals_visit_fn visit = ijk_globals_visit);
+void globals_to_vm(globals_visit_fn visit = ijk_globals_visit);
+// Bracket translated code entered from the VM.  Values the VM replaced
+// in the meantime are only released once none of it is running, as it
+// may still point into them.
+void enter_native(globals_visit_fn visit = ijk_globals_visit);
+void leave_native(globals_visit_fn visit = ijk_globals_visit);
+
+// Calls function in a translated module built as a shared library,
+// through the function's exported dispatch thunk.
+Variant call_native(const String& library, const String& function, const Array& args);
+
+}
+}
+
+#endif